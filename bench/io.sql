@@ -0,0 +1,51 @@
+-- Text input and output throughput of itree in rows per second.
+-- Run it against the build before and after a change and compare the NOTICE lines:
+--   psql -d postgres -f bench/io.sql
+--   psql -d postgres -v rows=5000000 -f bench/io.sql
+\set ON_ERROR_STOP on
+\if :{?rows}
+\else
+\set rows 1000000
+\endif
+
+CREATE EXTENSION IF NOT EXISTS itree;
+DROP TABLE IF EXISTS itree_io_bench;
+-- 1 to 7 levels, a third of the segments take 2 bytes, so every value fits
+CREATE UNLOGGED TABLE itree_io_bench AS
+SELECT i, txt, txt::itree AS id
+FROM (SELECT i, string_agg(CASE WHEN random() < 0.33 THEN 256 + floor(random() * 65280)::int
+                                ELSE 1 + floor(random() * 255)::int END::text, '.') AS txt
+      FROM generate_series(1, :rows) i,
+           LATERAL (SELECT l FROM generate_series(1, 1 + (i * 0 + floor(random() * 7))::int) l) s
+      GROUP BY i) t;
+VACUUM ANALYZE itree_io_bench;
+
+DO $$
+DECLARE
+    n bigint;
+    t0 timestamptz;
+    scan float8;
+    secs float8;
+BEGIN
+    SELECT count(*) INTO n FROM itree_io_bench;
+
+    -- the scan alone, subtracted from the timings below
+    t0 := clock_timestamp();
+    PERFORM count(txt) FROM itree_io_bench;
+    scan := extract(epoch FROM clock_timestamp() - t0);
+
+    t0 := clock_timestamp();
+    PERFORM count(txt::itree) FROM itree_io_bench;
+    secs := extract(epoch FROM clock_timestamp() - t0);
+    RAISE NOTICE 'itree_in:  % rows/s (% rows/s with the scan)',
+        round(n / greatest(secs - scan, 1e-6)), round(n / secs);
+
+    t0 := clock_timestamp();
+    PERFORM count(id::text) FROM itree_io_bench;
+    secs := extract(epoch FROM clock_timestamp() - t0);
+    RAISE NOTICE 'itree_out: % rows/s (% rows/s with the scan)',
+        round(n / greatest(secs - scan, 1e-6)), round(n / secs);
+END;
+$$;
+
+DROP TABLE itree_io_bench;
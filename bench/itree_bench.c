@@ -0,0 +1,361 @@
+/**
+ * Standalone microbenchmark of the itree core routines, no server needed:
+ *   make bench
+ *   bench/itree_bench [repetitions]
+ *
+ * Prints ns/op of each routine for key shapes of different depth and segment width.
+ * Run it before and after a change of itree_core.c, on an otherwise idle machine.
+ */
+#include "c.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "itree_core.h"
+
+#define ITREE_BENCH_VALUES 4096
+#define ITREE_BENCH_DEFAULT_REPS 200
+
+typedef struct {
+    const char *name;
+    int min_levels;
+    int max_levels;
+    int wide_percent; // share of 2-byte segments 256..65535, the rest are 1..255
+} itree_bench_shape;
+
+static const itree_bench_shape itree_bench_shapes[] = {
+    {"shallow 1-byte", 2, 3, 0},
+    {"deep 1-byte", 12, 16, 0},
+    {"shallow 2-byte", 2, 3, 100},
+    {"deep 2-byte", 6, 8, 100},
+    {"mixed", 1, 8, 33},
+};
+
+typedef struct {
+    itree trees[ITREE_BENCH_VALUES];
+    itree sorted[ITREE_BENCH_VALUES];
+    uint16_t segments[ITREE_BENCH_VALUES][ITREE_MAX_LEVELS];
+    int nsegments[ITREE_BENCH_VALUES];
+    char text[ITREE_BENCH_VALUES][ITREE_MAX_TEXT_LEN + 1];
+    itree subtree; // first level of trees[0], the constant of a <@ filter
+    itree_key keys[ITREE_BENCH_VALUES];        // trees as itree_key
+    itree_key sorted_keys[ITREE_BENCH_VALUES]; // sorted as itree_key
+    itree_key subtree_key;
+    uint8_t sorted_vars[ITREE_BENCH_VALUES][ITREE_VAR_MAX_ITREE_LEN]; // sorted in the itree_var form
+    int sorted_var_lens[ITREE_BENCH_VALUES];
+    uint8_t vars[ITREE_BENCH_VALUES][ITREE_VAR_MAX_ITREE_LEN];        // trees in the itree_var form
+    int var_lens[ITREE_BENCH_VALUES];
+    uint8_t subtree_var[ITREE_VAR_MAX_ITREE_LEN];
+    int subtree_var_len;
+} itree_bench_data;
+
+typedef uint64 (*itree_bench_fn) (itree_bench_data *data);
+
+static uint64 itree_bench_state = 0x9E3779B97F4A7C15;
+
+// xorshift64, the same values on every run
+static uint32 itree_bench_random(uint32 bound) {
+    itree_bench_state ^= itree_bench_state << 13;
+    itree_bench_state ^= itree_bench_state >> 7;
+    itree_bench_state ^= itree_bench_state << 17;
+    return (uint32) (itree_bench_state % bound);
+}
+
+static int itree_bench_cmp(const void *a, const void *b) {
+    return itree_packed_cmp((const itree *) a, (const itree *) b);
+}
+
+static void itree_bench_generate(const itree_bench_shape *shape, itree_bench_data *data) {
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        int levels = shape->min_levels + (int) itree_bench_random(shape->max_levels - shape->min_levels + 1);
+        int bytes = 0;
+        int n = 0;
+
+        while (n < levels) {
+            bool wide = (int) itree_bench_random(100) < shape->wide_percent;
+            uint16_t val = wide ? (uint16_t) (256 + itree_bench_random(65280)) : (uint16_t) (1 + itree_bench_random(255));
+
+            if (bytes + (wide ? 2 : 1) > ITREE_MAX_LEVELS) {
+                break;
+            }
+            bytes += wide ? 2 : 1;
+            data->segments[i][n++] = val;
+        }
+        data->nsegments[i] = n;
+        itree_set_segments(data->segments[i], n, &data->trees[i]);
+        itree_format(&data->trees[i], data->text[i]);
+    }
+    itree_prefix_copy(&data->trees[0], itree_level_len(&data->trees[0], 1), &data->subtree);
+    memcpy(data->sorted, data->trees, sizeof(data->trees));
+    qsort(data->sorted, ITREE_BENCH_VALUES, sizeof(itree), itree_bench_cmp);
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        itree_key_encode(&data->trees[i], &data->keys[i]);
+        itree_key_encode(&data->sorted[i], &data->sorted_keys[i]);
+        data->var_lens[i] = itree_var_encode_itree(&data->trees[i], data->vars[i]);
+        data->sorted_var_lens[i] = itree_var_encode_itree(&data->sorted[i], data->sorted_vars[i]);
+    }
+    itree_key_encode(&data->subtree, &data->subtree_key);
+    data->subtree_var_len = itree_var_encode_itree(&data->subtree, data->subtree_var);
+}
+
+static uint64 itree_bench_parse(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree tree;
+    const char *error_at;
+    int nsegments;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_parse(data->text[i], &tree, &error_at, &nsegments) + tree.data[0];
+    }
+    return sink;
+}
+
+static uint64 itree_bench_format(itree_bench_data *data) {
+    uint64 sink = 0;
+    char text[ITREE_MAX_TEXT_LEN + 1];
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_format(&data->trees[i], text);
+    }
+    return sink;
+}
+
+static uint64 itree_bench_get_segments(itree_bench_data *data) {
+    uint64 sink = 0;
+    uint16_t segments[ITREE_MAX_LEVELS];
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_get_segments(&data->trees[i], segments) + segments[0];
+    }
+    return sink;
+}
+
+static uint64 itree_bench_set_segments(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree tree;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_set_segments(data->segments[i], data->nsegments[i], &tree) + tree.data[1];
+    }
+    return sink;
+}
+
+// random pairs mostly differ in the first segment
+static uint64 itree_bench_cmp_random(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_packed_cmp(&data->trees[i], &data->trees[(i + 1) % ITREE_BENCH_VALUES]) + 1;
+    }
+    return sink;
+}
+
+// neighbours in btree order share a prefix, as in the leaf pages of an index
+static uint64 itree_bench_cmp_sorted(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_packed_cmp(&data->sorted[i], &data->sorted[(i + 1) % ITREE_BENCH_VALUES]) + 1;
+    }
+    return sink;
+}
+
+// the GIN prefix keys of a value
+static uint64 itree_bench_prefix_keys(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree keys[ITREE_MAX_LEVELS];
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_prefix_keys(&data->trees[i], keys) + keys[0].data[0];
+    }
+    return sink;
+}
+
+// the GIN keys of itree_gin_fp_ops, against the 18 byte keys of itree_gin_ops above
+static uint64 itree_bench_prefix_fingerprints(itree_bench_data *data) {
+    uint64 sink = 0;
+    uint32 fingerprints[ITREE_MAX_LEVELS];
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_prefix_fingerprints(&data->trees[i], fingerprints) + fingerprints[0];
+    }
+    return sink;
+}
+
+// subpath(id, 0, -1), the parent cut out of the packed bytes
+static uint64 itree_bench_subpath(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree parent;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        const itree *tree = &data->trees[i];
+
+        itree_splice_copy(tree, 0, tree, 0, itree_level_len(tree, data->nsegments[i] - 1), &parent);
+        sink += parent.data[0];
+    }
+    return sink + 1;
+}
+
+// parent || n, the key of a new child in a bulk load
+static uint64 itree_bench_append(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree child;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_append_segment(&data->trees[i], (uint16_t) (i + 1), &child) + child.data[0];
+    }
+    return sink;
+}
+
+// a seq scan filter id <@ const, testing against the unprepared constant
+static uint64 itree_bench_is_prefix(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_packed_is_prefix(&data->subtree, &data->trees[i]);
+    }
+    return sink + 1;
+}
+
+// the same filter with the constant prepared once, as the <@ operator does through fn_extra
+static uint64 itree_bench_matcher(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree_prefix_matcher matcher;
+
+    itree_prefix_matcher_init(&data->subtree, &matcher);
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_prefix_matcher_test(&matcher, &data->trees[i]);
+    }
+    return sink + 1;
+}
+
+// the same filter over a packed batch into a bitmap, as itree_descendant_bitmap(bytea, itree)
+static uint64 itree_bench_batch(itree_bench_data *data) {
+    uint8_t bits[ITREE_BENCH_VALUES / 8] = {0};
+    itree_prefix_matcher matcher;
+
+    itree_prefix_matcher_init(&data->subtree, &matcher);
+    return itree_prefix_matcher_batch(&matcher, data->trees, ITREE_BENCH_VALUES, bits) + bits[0] + 1;
+}
+
+// cmp_sort on the itree_key form, a plain memcmp
+static uint64 itree_bench_key_cmp_sorted(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += memcmp(&data->sorted_keys[i], &data->sorted_keys[(i + 1) % ITREE_BENCH_VALUES], sizeof(itree_key)) > 0;
+    }
+    return sink + 1;
+}
+
+// is_prefix on the itree_key form
+static uint64 itree_bench_key_is_prefix(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_key_is_prefix(&data->subtree_key, &data->keys[i]);
+    }
+    return sink + 1;
+}
+
+// the itree to itree_key cast
+static uint64 itree_bench_key_encode(itree_bench_data *data) {
+    uint64 sink = 0;
+    itree_key key;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        itree_key_encode(&data->trees[i], &key);
+        sink += key.bytes[1];
+    }
+    return sink + 1;
+}
+
+// cmp_sort on the itree_var form
+static uint64 itree_bench_var_cmp_sorted(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        int j = (i + 1) % ITREE_BENCH_VALUES;
+
+        sink += itree_var_packed_cmp(data->sorted_vars[i], data->sorted_var_lens[i],
+                                     data->sorted_vars[j], data->sorted_var_lens[j]) > 0;
+    }
+    return sink + 1;
+}
+
+// is_prefix on the itree_var form
+static uint64 itree_bench_var_is_prefix(itree_bench_data *data) {
+    uint64 sink = 0;
+
+    for (int i = 0; i < ITREE_BENCH_VALUES; i++) {
+        sink += itree_var_is_prefix(data->subtree_var, data->subtree_var_len, data->vars[i], data->var_lens[i]);
+    }
+    return sink + 1;
+}
+
+static const struct {
+    const char *name;
+    itree_bench_fn fn;
+} itree_bench_ops[] = {
+    {"parse", itree_bench_parse},
+    {"format", itree_bench_format},
+    {"get_segs", itree_bench_get_segments},
+    {"set_segs", itree_bench_set_segments},
+    {"cmp_rand", itree_bench_cmp_random},
+    {"cmp_sort", itree_bench_cmp_sorted},
+    {"prefixes", itree_bench_prefix_keys},
+    {"fp_keys", itree_bench_prefix_fingerprints},
+    {"subpath", itree_bench_subpath},
+    {"append", itree_bench_append},
+    {"is_prefix", itree_bench_is_prefix},
+    {"matcher", itree_bench_matcher},
+    {"batch", itree_bench_batch},
+    {"key_cmp", itree_bench_key_cmp_sorted},
+    {"key_pref", itree_bench_key_is_prefix},
+    {"key_enc", itree_bench_key_encode},
+    {"var_cmp", itree_bench_var_cmp_sorted},
+    {"var_pref", itree_bench_var_is_prefix},
+};
+
+static double itree_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    int reps = argc > 1 ? atoi(argv[1]) : ITREE_BENCH_DEFAULT_REPS;
+    itree_bench_data *data = malloc(sizeof(itree_bench_data));
+    volatile uint64 sink = 0;
+
+    if (reps <= 0 || data == NULL) {
+        fprintf(stderr, "usage: %s [repetitions]\n", argv[0]);
+        return 1;
+    }
+
+    printf("ns/op, %d values x %d repetitions\n%-16s", ITREE_BENCH_VALUES, reps, "shape");
+    for (int op = 0; op < lengthof(itree_bench_ops); op++) {
+        printf("%10s", itree_bench_ops[op].name);
+    }
+    printf("\n");
+
+    for (int s = 0; s < lengthof(itree_bench_shapes); s++) {
+        itree_bench_generate(&itree_bench_shapes[s], data);
+        printf("%-16s", itree_bench_shapes[s].name);
+        for (int op = 0; op < lengthof(itree_bench_ops); op++) {
+            double start;
+
+            sink += itree_bench_ops[op].fn(data); // warm up
+            start = itree_bench_now();
+            for (int r = 0; r < reps; r++) {
+                sink += itree_bench_ops[op].fn(data);
+            }
+            printf("%10.2f", (itree_bench_now() - start) / ((double) reps * ITREE_BENCH_VALUES));
+        }
+        printf("\n");
+    }
+
+    free(data);
+    return sink == 0; // keeps the results alive
+}
@@ -0,0 +1,60 @@
+-- Synthetic ontology for bench/workload.sh in the reference_data/entity schema of the README,
+-- with ltree columns holding the same paths:
+--   reference_data  every node of a tree with fanout children per node, depth levels deep
+--   entity_base     entities attached to nodes picked uniformly, so most sit on the leaves
+--   entity          empty, workload.sh refills it from entity_base before each index
+--   psql -d postgres -v fanout=10 -v depth=4 -v entities=1000000 -f bench/ontology.sql
+-- A fanout above 255 takes 2 bytes per level, so depth * 2 must stay within 16.
+\set ON_ERROR_STOP on
+\if :{?fanout}
+\else
+\set fanout 10
+\endif
+\if :{?depth}
+\else
+\set depth 4
+\endif
+\if :{?entities}
+\else
+\set entities 1000000
+\endif
+
+CREATE EXTENSION IF NOT EXISTS itree;
+CREATE EXTENSION IF NOT EXISTS ltree;
+DROP TABLE IF EXISTS entity, entity_base, reference_data;
+DROP FUNCTION IF EXISTS itree_bench_random_node(int, int);
+DROP FUNCTION IF EXISTS itree_bench_node(int[], int);
+
+-- a node picked uniformly from the whole tree: level d holds fanout^d nodes, so deep levels are likelier
+CREATE FUNCTION itree_bench_random_node(fanout int, depth int) RETURNS text
+    VOLATILE STRICT LANGUAGE sql AS $$
+    SELECT string_agg((1 + floor(random() * fanout))::int::text, '.')
+    FROM generate_series(1, greatest(1, depth - floor(-ln(1 - random()) / ln(fanout))::int))
+$$;
+
+-- the first levels of segments as text; immutable, so the planner folds the pgbench literals into a constant
+CREATE FUNCTION itree_bench_node(segments int[], levels int) RETURNS text
+    IMMUTABLE STRICT LANGUAGE sql AS $$
+    SELECT array_to_string(segments[1:levels], '.')
+$$;
+
+CREATE TABLE reference_data (id itree PRIMARY KEY, label text, label_path ltree);
+
+WITH RECURSIVE node(path, level) AS (
+    SELECT g::text, 1 FROM generate_series(1, :fanout) g
+    UNION ALL
+    SELECT path || '.' || g, level + 1 FROM node, generate_series(1, :fanout) g WHERE level < :depth
+)
+INSERT INTO reference_data SELECT path::itree, 'node ' || path, path::ltree FROM node;
+
+CREATE TABLE entity_base (id uuid, reference_id itree, reference_path ltree);
+
+INSERT INTO entity_base
+SELECT gen_random_uuid(), node::itree, node::ltree
+FROM (SELECT itree_bench_random_node(:fanout, :depth) AS node FROM generate_series(1, :entities)) n;
+
+CREATE TABLE entity (id uuid, reference_id itree REFERENCES reference_data (id), reference_path ltree);
+
+VACUUM ANALYZE reference_data, entity_base;
+
+SELECT (SELECT count(*) FROM reference_data) AS nodes, (SELECT count(*) FROM entity_base) AS entities;
@@ -0,0 +1,5 @@
+-- bulk insert: batch entities in one statement, both columns are filled so every index kind is maintained
+-- variables from workload.sh: fanout, depth, batch
+INSERT INTO entity
+SELECT gen_random_uuid(), node::itree, node::ltree
+FROM (SELECT itree_bench_random_node(:fanout, :depth) AS node FROM generate_series(1, :batch)) n;
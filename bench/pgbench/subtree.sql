@@ -0,0 +1,19 @@
+-- subtree scan: the entities under one node of level subtree_level
+-- variables from workload.sh: col, type, fanout, subtree_level
+\set s1 random(1, :fanout)
+\set s2 random(1, :fanout)
+\set s3 random(1, :fanout)
+\set s4 random(1, :fanout)
+\set s5 random(1, :fanout)
+\set s6 random(1, :fanout)
+\set s7 random(1, :fanout)
+\set s8 random(1, :fanout)
+\set s9 random(1, :fanout)
+\set s10 random(1, :fanout)
+\set s11 random(1, :fanout)
+\set s12 random(1, :fanout)
+\set s13 random(1, :fanout)
+\set s14 random(1, :fanout)
+\set s15 random(1, :fanout)
+\set s16 random(1, :fanout)
+SELECT count(*) FROM entity WHERE :col <@ CAST(itree_bench_node(ARRAY[:s1, :s2, :s3, :s4, :s5, :s6, :s7, :s8, :s9, :s10, :s11, :s12, :s13, :s14, :s15, :s16], :subtree_level) AS :type);
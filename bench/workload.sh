@@ -0,0 +1,97 @@
+#!/bin/sh
+# pgbench workloads over the itree indexes and their ltree counterparts, against a local server.
+# Loads bench/ontology.sql, then for each index kind refills entity, builds the index alone
+# and runs the point, subtree, ancestor and insert scripts of bench/pgbench.
+#   bench/workload.sh
+#   FANOUT=4 DEPTH=8 ENTITIES=200000 DURATION=30 bench/workload.sh | tee report.txt
+# Connection settings come from the libpq environment: PGHOST, PGPORT, PGDATABASE, PGUSER.
+# The report has one line per index kind and script: index build time, index size,
+# TPS and latency percentiles from the pgbench transaction log.
+set -eu
+
+FANOUT=${FANOUT:-10}
+DEPTH=${DEPTH:-4}
+ENTITIES=${ENTITIES:-1000000}
+CLIENTS=${CLIENTS:-4}
+DURATION=${DURATION:-10}
+BATCH=${BATCH:-1000}
+SUBTREE_LEVEL=${SUBTREE_LEVEL:-$((DEPTH > 1 ? DEPTH - 1 : 1))}
+INDEXES=${INDEXES:-"itree_btree itree_gin itree_gin_fp itree_gist itree_spgist ltree_btree ltree_gist"}
+SCRIPTS=${SCRIPTS:-"point subtree ancestor insert"}
+LOAD=${LOAD:-1}
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+LOGS=$(mktemp -d)
+trap 'rm -rf "$LOGS"' EXIT
+
+psql_q() {
+    psql -X -Atq -v ON_ERROR_STOP=1 "$@"
+}
+
+index_ddl() {
+    case $1 in
+        itree_btree) echo "CREATE INDEX entity_bench_idx ON entity (reference_id)" ;;
+        itree_gin) echo "CREATE INDEX entity_bench_idx ON entity USING gin (reference_id itree_gin_ops)" ;;
+        itree_gin_fp) echo "CREATE INDEX entity_bench_idx ON entity USING gin (reference_id itree_gin_fp_ops)" ;;
+        itree_gist) echo "CREATE INDEX entity_bench_idx ON entity USING gist (reference_id itree_gist_ops)" ;;
+        itree_spgist) echo "CREATE INDEX entity_bench_idx ON entity USING spgist (reference_id itree_spgist_ops)" ;;
+        ltree_btree) echo "CREATE INDEX entity_bench_idx ON entity (reference_path)" ;;
+        ltree_gist) echo "CREATE INDEX entity_bench_idx ON entity USING gist (reference_path)" ;;
+        *) echo "unknown index kind $1" >&2; exit 1 ;;
+    esac
+}
+
+# p50, p95 and p99 in ms of the latencies in us, the third field of the pgbench log
+percentiles() {
+    cat "$@" | awk '{ print $3 }' | sort -n | awk '
+        { lat[NR] = $1 }
+        END {
+            if (NR == 0) { print "- - -"; exit }
+            printf "%.3f %.3f %.3f\n", lat[int((NR - 1) * 0.50) + 1] / 1000,
+                lat[int((NR - 1) * 0.95) + 1] / 1000, lat[int((NR - 1) * 0.99) + 1] / 1000
+        }'
+}
+
+if [ "$LOAD" = 1 ]; then
+    psql_q -v fanout="$FANOUT" -v depth="$DEPTH" -v entities="$ENTITIES" -f "$BENCH/ontology.sql" >/dev/null
+fi
+
+echo "fanout=$FANOUT depth=$DEPTH entities=$ENTITIES clients=$CLIENTS duration=${DURATION}s batch=$BATCH subtree_level=$SUBTREE_LEVEL"
+printf '%-12s %9s %10s %-9s %10s %9s %9s %9s\n' index build_ms size script tps p50_ms p95_ms p99_ms
+
+for kind in $INDEXES; do
+    case $kind in
+        itree_*) col=reference_id; type=itree ;;
+        *) col=reference_path; type=ltree ;;
+    esac
+    ddl=$(index_ddl "$kind")
+
+    # the same rows and a fresh index for every kind, the insert script of the previous kind added rows
+    psql_q <<SQL
+DROP INDEX IF EXISTS entity_bench_idx;
+TRUNCATE entity;
+INSERT INTO entity SELECT * FROM entity_base;
+VACUUM ANALYZE entity;
+SQL
+    build_ms=$(psql_q <<SQL
+SELECT clock_timestamp() AS t0 \gset
+$ddl;
+SELECT round(extract(epoch FROM clock_timestamp() - :'t0'::timestamptz) * 1000);
+SQL
+)
+    psql_q -c "ANALYZE entity"
+    size=$(psql_q -c "SELECT pg_size_pretty(pg_relation_size('entity_bench_idx'))" | tr -d ' ')
+
+    for script in $SCRIPTS; do
+        out=$(pgbench -n -c "$CLIENTS" -j "$CLIENTS" -T "$DURATION" \
+            -D col="$col" -D type="$type" -D fanout="$FANOUT" -D depth="$DEPTH" \
+            -D subtree_level="$SUBTREE_LEVEL" -D batch="$BATCH" \
+            --log --log-prefix="$LOGS/$kind.$script" -f "$BENCH/pgbench/$script.sql" 2>&1) || {
+            echo "$out" >&2
+            exit 1
+        }
+        tps=$(echo "$out" | awk '/^tps = / { tps = $3 } END { printf "%.1f", tps }')
+        printf '%-12s %9s %10s %-9s %10s %9s %9s %9s\n' "$kind" "$build_ms" "$size" "$script" "$tps" \
+            $(percentiles "$LOGS/$kind.$script".*)
+    done
+done
@@ -0,0 +1,1331 @@
+-- Extension: itree, version 1.1
+
+-- Step 1: Create a shell type
+CREATE TYPE itree;
+
+-- Step 2: Define the I/O and typmod functions
+CREATE FUNCTION itree_in(cstring) RETURNS itree
+    AS 'MODULE_PATHNAME', 'itree_in'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_out(itree) RETURNS cstring
+    AS 'MODULE_PATHNAME', 'itree_out'
+    LANGUAGE C IMMUTABLE STRICT;
+-- Binary I/O: 2 byte big endian control word and 16 data bytes, the layout of ITree.value in type.py
+CREATE FUNCTION itree_recv(internal) RETURNS itree
+    AS 'MODULE_PATHNAME', 'itree_recv'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_send(itree) RETURNS bytea
+    AS 'MODULE_PATHNAME', 'itree_send'
+    LANGUAGE C IMMUTABLE STRICT;
+
+-- Typmod is broken in postgresql, for user defined datatypes it is ignored in most statements and -1 is sent
+-- works for create table, but not enforced in any way
+CREATE FUNCTION itree_typmod_in(cstring[]) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_typmod_in'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_typmod_out(int4) RETURNS cstring
+    AS 'MODULE_PATHNAME', 'itree_typmod_out'
+    LANGUAGE C IMMUTABLE STRICT;
+
+-- Step 3: Complete the type definition, the 2 control bytes and 16 data bytes of the C struct
+CREATE TYPE itree (
+    INPUT = itree_in,
+    OUTPUT = itree_out,
+    RECEIVE = itree_recv,
+    SEND = itree_send,
+    STORAGE = plain,
+    TYPMOD_IN = itree_typmod_in,
+    TYPMOD_OUT = itree_typmod_out,
+    INTERNALLENGTH = 18
+);
+
+-- Step 3: Define btree operators and their functions
+-- Comparison operators
+CREATE FUNCTION itree_lt(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_lt'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_le(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_le'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_eq(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_eq'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_ge(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_ge'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gt(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_gt'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_cmp(itree, itree) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_cmp'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_ne(itree, itree) RETURNS boolean AS $$
+    SELECT NOT itree_eq($1, $2);
+$$ LANGUAGE SQL IMMUTABLE;
+
+CREATE OPERATOR <> (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_ne
+);
+
+CREATE OPERATOR < (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_lt,
+    COMMUTATOR = >,
+    NEGATOR = >=
+);
+CREATE OPERATOR <= (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_le,
+    COMMUTATOR = >=,
+    NEGATOR = >
+);
+CREATE OPERATOR = (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_eq,
+    COMMUTATOR = =,
+    NEGATOR = <>,
+    HASHES,
+    MERGES
+);
+CREATE OPERATOR >= (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_ge,
+    COMMUTATOR = <=,
+    NEGATOR = <
+);
+CREATE OPERATOR > (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_gt,
+    COMMUTATOR = <,
+    NEGATOR = <=
+);
+
+-- B-tree operator class with sort support and abbreviated keys
+CREATE FUNCTION itree_sortsupport(internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_sortsupport'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE OPERATOR CLASS itree_btree_ops
+    DEFAULT FOR TYPE itree USING btree AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        FUNCTION 1 itree_cmp(itree, itree),
+        FUNCTION 2 itree_sortsupport(internal);
+
+-- Step 4: Define operators and their functions
+-- The support functions turn x <@ const and const @> x into a btree range scan on x
+CREATE FUNCTION itree_descendant_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_descendant_support'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_ancestor_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_ancestor_support'
+    LANGUAGE C IMMUTABLE STRICT;
+-- Estimators: subtree size from the MCVs and the btree order histogram, ancestors as equality on each prefix
+CREATE FUNCTION itree_descendant_sel(internal, oid, internal, integer) RETURNS float8
+    AS 'MODULE_PATHNAME', 'itree_descendant_sel'
+    LANGUAGE C STABLE STRICT;
+CREATE FUNCTION itree_ancestor_sel(internal, oid, internal, integer) RETURNS float8
+    AS 'MODULE_PATHNAME', 'itree_ancestor_sel'
+    LANGUAGE C STABLE STRICT;
+CREATE FUNCTION itree_descendant_joinsel(internal, oid, internal, smallint, internal) RETURNS float8
+    AS 'MODULE_PATHNAME', 'itree_descendant_joinsel'
+    LANGUAGE C STABLE STRICT;
+CREATE FUNCTION itree_ancestor_joinsel(internal, oid, internal, smallint, internal) RETURNS float8
+    AS 'MODULE_PATHNAME', 'itree_ancestor_joinsel'
+    LANGUAGE C STABLE STRICT;
+CREATE FUNCTION itree_is_descendant(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_is_descendant'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+    SUPPORT itree_descendant_support;
+CREATE FUNCTION itree_is_ancestor(itree, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_is_ancestor'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+    SUPPORT itree_ancestor_support;
+
+CREATE OPERATOR <@ (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_is_descendant,
+    COMMUTATOR = @>,
+    RESTRICT = itree_descendant_sel,
+    JOIN = itree_descendant_joinsel
+);
+CREATE OPERATOR @> (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_is_ancestor,
+    COMMUTATOR = <@,
+    RESTRICT = itree_ancestor_sel,
+    JOIN = itree_ancestor_joinsel
+);
+
+-- Hash operator class for hash joins, hash aggregates and hash partitioning
+CREATE FUNCTION itree_hash(itree) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_hash'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_hash_extended(itree, int8) RETURNS int8
+    AS 'MODULE_PATHNAME', 'itree_hash_extended'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS itree_hash_ops
+    DEFAULT FOR TYPE itree USING hash AS
+        OPERATOR 1 =,
+        FUNCTION 1 itree_hash(itree),
+        FUNCTION 2 itree_hash_extended(itree, int8);
+
+/**
+Util functions
+*/
+-- return number of levels in the tree
+CREATE FUNCTION ilevel(itree)
+RETURNS int4
+AS 'MODULE_PATHNAME', 'ilevel'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION itree_additree(itree,itree)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR || (
+        LEFTARG = itree,
+	    RIGHTARG = itree,
+	PROCEDURE = itree_additree
+);
+
+CREATE FUNCTION itree_addint(itree,int)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR || (
+        LEFTARG = itree,
+	    RIGHTARG = int,
+	PROCEDURE = itree_addint
+);
+
+CREATE FUNCTION itree_addtext(itree,text)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR || (
+        LEFTARG = itree,
+	    RIGHTARG = text,
+	PROCEDURE = itree_addtext
+);
+
+
+
+create function subitree(itree, int, int)
+returns itree
+as 'MODULE_PATHNAME'
+language c strict immutable parallel safe;
+
+create function subpath(itree, int, int)
+returns itree
+as 'MODULE_PATHNAME'
+language c strict immutable parallel safe;
+
+-- iquery: lquery style patterns over the levels, e.g. 1.*.3, 1.*{2}, 1.2|7.!4
+CREATE TYPE iquery;
+CREATE FUNCTION iquery_in(cstring) RETURNS iquery
+    AS 'MODULE_PATHNAME', 'iquery_in'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION iquery_out(iquery) RETURNS cstring
+    AS 'MODULE_PATHNAME', 'iquery_out'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE TYPE iquery (
+    INPUT = iquery_in,
+    OUTPUT = iquery_out,
+    STORAGE = extended,
+    ALIGNMENT = int4,
+    INTERNALLENGTH = VARIABLE
+);
+
+-- The support function turns x ~ const into a btree range scan over the fixed leading levels of const
+CREATE FUNCTION itree_match_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_match_support'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_matches(itree, iquery) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_matches'
+    LANGUAGE C IMMUTABLE STRICT
+    SUPPORT itree_match_support;
+CREATE FUNCTION iquery_matches(iquery, itree) RETURNS bool
+    AS 'MODULE_PATHNAME', 'iquery_matches'
+    LANGUAGE C IMMUTABLE STRICT
+    SUPPORT itree_match_support;
+CREATE OPERATOR ~ (
+    LEFTARG = itree,
+    RIGHTARG = iquery,
+    PROCEDURE = itree_matches,
+    COMMUTATOR = ~,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR ~ (
+    LEFTARG = iquery,
+    RIGHTARG = itree,
+    PROCEDURE = iquery_matches,
+    COMMUTATOR = ~,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+-- itree[] like ltree[]: an element is an ancestor of / a descendant of / matches the right argument,
+-- ?@> ?<@ ?~ return the first such element
+CREATE FUNCTION itree_array_has_ancestor(itree[], itree) RETURNS bool
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_is_descendant_array(itree, itree[]) RETURNS bool
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_array_has_descendant(itree[], itree) RETURNS bool
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_is_ancestor_array(itree, itree[]) RETURNS bool
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_array_matches(itree[], iquery) RETURNS bool
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION iquery_matches_array(iquery, itree[]) RETURNS bool
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_array_first_ancestor(itree[], itree) RETURNS itree
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_array_first_descendant(itree[], itree) RETURNS itree
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_array_first_match(itree[], iquery) RETURNS itree
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR @> (
+    LEFTARG = itree[],
+    RIGHTARG = itree,
+    PROCEDURE = itree_array_has_ancestor,
+    COMMUTATOR = <@,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR <@ (
+    LEFTARG = itree,
+    RIGHTARG = itree[],
+    PROCEDURE = itree_is_descendant_array,
+    COMMUTATOR = @>,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR <@ (
+    LEFTARG = itree[],
+    RIGHTARG = itree,
+    PROCEDURE = itree_array_has_descendant,
+    COMMUTATOR = @>,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR @> (
+    LEFTARG = itree,
+    RIGHTARG = itree[],
+    PROCEDURE = itree_is_ancestor_array,
+    COMMUTATOR = <@,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR ~ (
+    LEFTARG = itree[],
+    RIGHTARG = iquery,
+    PROCEDURE = itree_array_matches,
+    COMMUTATOR = ~,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR ~ (
+    LEFTARG = iquery,
+    RIGHTARG = itree[],
+    PROCEDURE = iquery_matches_array,
+    COMMUTATOR = ~,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR ?@> (
+    LEFTARG = itree[],
+    RIGHTARG = itree,
+    PROCEDURE = itree_array_first_ancestor
+);
+CREATE OPERATOR ?<@ (
+    LEFTARG = itree[],
+    RIGHTARG = itree,
+    PROCEDURE = itree_array_first_descendant
+);
+CREATE OPERATOR ?~ (
+    LEFTARG = itree[],
+    RIGHTARG = iquery,
+    PROCEDURE = itree_array_first_match
+);
+
+-- batch subtree filters: bit i of the result is set when value i is a descendant of the itree
+CREATE FUNCTION itree_pack(itree[]) RETURNS bytea
+    AS 'MODULE_PATHNAME' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_descendant_bitmap(itree[], itree) RETURNS varbit
+    AS 'MODULE_PATHNAME', 'itree_array_descendant_bitmap' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_descendant_bitmap(bytea, itree) RETURNS varbit
+    AS 'MODULE_PATHNAME', 'itree_packed_descendant_bitmap' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+
+/*
+Step 5: Define GIN support
+From postgres/src/include/access/gin.h:
+#define GIN_COMPARE_PROC			   1
+#define GIN_EXTRACTVALUE_PROC		   2
+#define GIN_EXTRACTQUERY_PROC		   3
+#define GIN_CONSISTENT_PROC			   4
+#define GIN_COMPARE_PARTIAL_PROC	   5
+#define GIN_TRICONSISTENT_PROC		   6
+#define GIN_OPTIONS_PROC	           7
+*/
+CREATE FUNCTION itree_compare(itree, itree) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_compare'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_extract_value(itree, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_extract_value'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_extract_query(itree, internal, smallint, internal, internal, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_extract_query'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_consistent(internal, smallint, itree, int, internal, internal, internal, internal) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_triconsistent(internal, smallint, itree, int, internal, internal, internal) RETURNS "char"
+    AS 'MODULE_PATHNAME', 'itree_triconsistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_compare_partial(itree, itree, smallint, internal) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_compare_partial'
+    LANGUAGE C IMMUTABLE STRICT;
+
+-- Keys are the prefixes of a value plus a self key for the value itself, <@ and @> need no recheck
+-- ~ matches the prefix keys of the fixed width leading items of the iquery with partial match
+CREATE OPERATOR CLASS itree_gin_ops
+    FOR TYPE itree USING gin AS
+        OPERATOR 1 <@,
+        OPERATOR 2 @>,
+        OPERATOR 3 ~ (itree, iquery),
+        FUNCTION 1 itree_compare(itree, itree),
+        FUNCTION 2 itree_extract_value(itree, internal, internal),
+        FUNCTION 3 itree_extract_query(itree, internal, smallint, internal, internal, internal, internal),
+        FUNCTION 4 itree_consistent(internal, smallint, itree, int, internal, internal, internal, internal),
+        FUNCTION 5 itree_compare_partial(itree, itree, smallint, internal),
+        FUNCTION 6 itree_triconsistent(internal, smallint, itree, int, internal, internal, internal)
+    ;
+
+-- itree[] under the keys of all its elements, the query side is the C code of itree_gin_ops
+-- declared on itree[], the query argument has the opclass type
+CREATE FUNCTION itree_array_extract_value(itree[], internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_array_extract_value'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_array_extract_query(itree[], internal, smallint, internal, internal, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_extract_query'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_array_consistent(internal, smallint, itree[], int, internal, internal, internal, internal) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_array_triconsistent(internal, smallint, itree[], int, internal, internal, internal) RETURNS "char"
+    AS 'MODULE_PATHNAME', 'itree_triconsistent'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS itree_array_gin_ops
+    FOR TYPE itree[] USING gin AS
+        OPERATOR 1 <@ (itree[], itree),
+        OPERATOR 2 @> (itree[], itree),
+        OPERATOR 3 ~ (itree[], iquery),
+        FUNCTION 1 itree_compare(itree, itree),
+        FUNCTION 2 itree_array_extract_value(itree[], internal, internal),
+        FUNCTION 3 itree_array_extract_query(itree[], internal, smallint, internal, internal, internal, internal),
+        FUNCTION 4 itree_array_consistent(internal, smallint, itree[], int, internal, internal, internal, internal),
+        FUNCTION 5 itree_compare_partial(itree, itree, smallint, internal),
+        FUNCTION 6 itree_array_triconsistent(internal, smallint, itree[], int, internal, internal, internal),
+        STORAGE itree
+    ;
+
+/*
+Step 6: Define GiST support
+Keys are [lower, upper] ranges in btree order, leaf keys are [value, value] for index-only scans.
+From postgres/src/include/access/gist.h:
+#define GIST_CONSISTENT_PROC			1
+#define GIST_UNION_PROC					2
+#define GIST_COMPRESS_PROC				3
+#define GIST_DECOMPRESS_PROC			4
+#define GIST_PENALTY_PROC				5
+#define GIST_PICKSPLIT_PROC				6
+#define GIST_EQUAL_PROC					7
+#define GIST_DISTANCE_PROC				8
+#define GIST_FETCH_PROC					9
+#define GIST_OPTIONS_PROC				10
+#define GIST_SORTSUPPORT_PROC			11
+*/
+CREATE FUNCTION itree_distance(itree, itree) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_distance'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR <-> (
+    LEFTARG = itree,
+    RIGHTARG = itree,
+    PROCEDURE = itree_distance,
+    COMMUTATOR = <->
+);
+
+CREATE TYPE itree_gist_key;
+CREATE FUNCTION itree_gist_key_in(cstring) RETURNS itree_gist_key
+    AS 'MODULE_PATHNAME', 'itree_gist_key_in'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_key_out(itree_gist_key) RETURNS cstring
+    AS 'MODULE_PATHNAME', 'itree_gist_key_out'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE TYPE itree_gist_key (
+    INPUT = itree_gist_key_in,
+    OUTPUT = itree_gist_key_out,
+    INTERNALLENGTH = 36
+);
+
+CREATE FUNCTION itree_gist_consistent(internal, itree, smallint, oid, internal) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_gist_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_union(internal, internal) RETURNS itree_gist_key
+    AS 'MODULE_PATHNAME', 'itree_gist_union'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_compress(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gist_compress'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_penalty(internal, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gist_penalty'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_picksplit(internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gist_picksplit'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_same(itree_gist_key, itree_gist_key, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gist_same'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_distance(internal, itree, smallint, oid, internal) RETURNS float8
+    AS 'MODULE_PATHNAME', 'itree_gist_distance'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_fetch(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gist_fetch'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gist_sortsupport(internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_gist_sortsupport'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS itree_gist_ops
+    DEFAULT FOR TYPE itree USING gist AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        OPERATOR 10 @>,
+        OPERATOR 11 <@,
+        OPERATOR 15 <-> (itree, itree) FOR ORDER BY pg_catalog.integer_ops,
+        FUNCTION 1 itree_gist_consistent(internal, itree, smallint, oid, internal),
+        FUNCTION 2 itree_gist_union(internal, internal),
+        FUNCTION 3 itree_gist_compress(internal),
+        FUNCTION 5 itree_gist_penalty(internal, internal, internal),
+        FUNCTION 6 itree_gist_picksplit(internal, internal),
+        FUNCTION 7 itree_gist_same(itree_gist_key, itree_gist_key, internal),
+        FUNCTION 8 itree_gist_distance(internal, itree, smallint, oid, internal),
+        FUNCTION 9 itree_gist_fetch(internal),
+        FUNCTION 11 itree_gist_sortsupport(internal),
+        STORAGE itree_gist_key;
+
+/*
+Step 7: Define BRIN support
+From postgres/src/include/access/brin_internal.h:
+#define BRIN_PROCNUM_OPCINFO		1
+#define BRIN_PROCNUM_ADDVALUE		2
+#define BRIN_PROCNUM_CONSISTENT		3
+#define BRIN_PROCNUM_UNION			4
+*/
+-- minmax in btree order with the built-in support functions,
+-- <@ and @> against a constant become a range scan through itree_descendant_support / itree_ancestor_support
+CREATE OPERATOR CLASS itree_minmax_ops
+    DEFAULT FOR TYPE itree USING brin AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        FUNCTION 1 brin_minmax_opcinfo(internal),
+        FUNCTION 2 brin_minmax_add_value(internal, internal, internal, internal),
+        FUNCTION 3 brin_minmax_consistent(internal, internal, internal),
+        FUNCTION 4 brin_minmax_union(internal, internal, internal);
+
+-- the common prefix of each block range, ranges on another branch than the query are skipped
+CREATE FUNCTION itree_brin_prefix_opcinfo(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_brin_prefix_opcinfo'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_brin_prefix_add_value(internal, internal, internal, internal) RETURNS boolean
+    AS 'MODULE_PATHNAME', 'itree_brin_prefix_add_value'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_brin_prefix_consistent(internal, internal, internal) RETURNS boolean
+    AS 'MODULE_PATHNAME', 'itree_brin_prefix_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_brin_prefix_union(internal, internal, internal) RETURNS boolean
+    AS 'MODULE_PATHNAME', 'itree_brin_prefix_union'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS itree_prefix_brin_ops
+    FOR TYPE itree USING brin AS
+        OPERATOR 3 =,
+        OPERATOR 10 @>,
+        OPERATOR 11 <@,
+        OPERATOR 12 ~ (itree, iquery),
+        FUNCTION 1 itree_brin_prefix_opcinfo(internal),
+        FUNCTION 2 itree_brin_prefix_add_value(internal, internal, internal, internal),
+        FUNCTION 3 itree_brin_prefix_consistent(internal, internal, internal),
+        FUNCTION 4 itree_brin_prefix_union(internal, internal, internal);
+
+-- ancestor at a level, GROUP BY rollup_to_level(id, 2) rolls facts up to the second level
+CREATE FUNCTION rollup_to_level(itree, int)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- lowest common ancestor: itree_lca(itree[]) and the aggregate itree_lca(itree)
+CREATE FUNCTION itree_lca(itree[])
+RETURNS itree
+AS 'MODULE_PATHNAME', 'itree_lca_array'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION itree_lca_transfn(itree, itree)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION itree_lca_finalfn(itree)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- the transition function is its own combine function, partial states are merged in parallel plans
+CREATE AGGREGATE itree_lca(itree) (
+    SFUNC = itree_lca_transfn,
+    STYPE = itree,
+    FINALFUNC = itree_lca_finalfn,
+    COMBINEFUNC = itree_lca_transfn,
+    PARALLEL = SAFE
+);
+
+-- walking the levels in one scan: one row per level, root first
+CREATE FUNCTION itree_prefixes(itree)
+RETURNS SETOF itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE ROWS 8;
+
+CREATE FUNCTION itree_ancestors(itree)
+RETURNS SETOF itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE ROWS 8;
+
+CREATE FUNCTION itree_path_segments(itree)
+RETURNS SETOF int4
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE ROWS 8;
+
+CREATE FUNCTION itree_parent(itree)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION itree_nlevel_prefix(itree, int)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- proper descendants are id BETWEEN lower AND upper
+CREATE FUNCTION itree_children_range(itree, OUT lower itree, OUT upper itree)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- bounds of a subtree in btree order
+CREATE FUNCTION itree_next_sibling(itree)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION itree_subtree_upper(itree)
+RETURNS itree
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- itree_key: 18 bytes in memcmp order
+CREATE TYPE itree_key;
+CREATE FUNCTION itree_key_in(cstring) RETURNS itree_key
+    AS 'MODULE_PATHNAME', 'itree_key_in'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_out(itree_key) RETURNS cstring
+    AS 'MODULE_PATHNAME', 'itree_key_out'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+-- Binary I/O is the itree layout
+CREATE FUNCTION itree_key_recv(internal) RETURNS itree_key
+    AS 'MODULE_PATHNAME', 'itree_key_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_send(itree_key) RETURNS bytea
+    AS 'MODULE_PATHNAME', 'itree_key_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- 16 symbols of 9 bits, byte aligned: memcmp() of the stored bytes is the itree order
+CREATE TYPE itree_key (
+    INPUT = itree_key_in,
+    OUTPUT = itree_key_out,
+    RECEIVE = itree_key_recv,
+    SEND = itree_key_send,
+    STORAGE = plain,
+    ALIGNMENT = char,
+    INTERNALLENGTH = 18
+);
+
+-- itree_key columns take itree values on insert and update, itree functions take itree_key values
+CREATE FUNCTION itree_to_key(itree) RETURNS itree_key
+    AS 'MODULE_PATHNAME', 'itree_to_key'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_to_itree(itree_key) RETURNS itree
+    AS 'MODULE_PATHNAME', 'itree_key_to_itree'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE CAST (itree AS itree_key) WITH FUNCTION itree_to_key(itree) AS ASSIGNMENT;
+CREATE CAST (itree_key AS itree) WITH FUNCTION itree_key_to_itree(itree_key) AS IMPLICIT;
+
+-- Comparison operators, all of them a memcmp()
+CREATE FUNCTION itree_key_lt(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_lt'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_le(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_le'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_eq(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_eq'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_ne(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_ne'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_ge(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_ge'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_gt(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_gt'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_cmp(itree_key, itree_key) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_key_cmp'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_sortsupport(internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_key_sortsupport'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR < (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_lt,
+    COMMUTATOR = >,
+    NEGATOR = >=,
+    RESTRICT = scalarltsel,
+    JOIN = scalarltjoinsel
+);
+CREATE OPERATOR <= (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_le,
+    COMMUTATOR = >=,
+    NEGATOR = >,
+    RESTRICT = scalarlesel,
+    JOIN = scalarlejoinsel
+);
+CREATE OPERATOR = (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_eq,
+    COMMUTATOR = =,
+    NEGATOR = <>,
+    RESTRICT = eqsel,
+    JOIN = eqjoinsel,
+    HASHES,
+    MERGES
+);
+CREATE OPERATOR <> (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_ne,
+    COMMUTATOR = <>,
+    NEGATOR = =,
+    RESTRICT = neqsel,
+    JOIN = neqjoinsel
+);
+CREATE OPERATOR >= (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_ge,
+    COMMUTATOR = <=,
+    NEGATOR = <,
+    RESTRICT = scalargesel,
+    JOIN = scalargejoinsel
+);
+CREATE OPERATOR > (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_gt,
+    COMMUTATOR = <,
+    NEGATOR = <=,
+    RESTRICT = scalargtsel,
+    JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR CLASS itree_key_btree_ops
+    DEFAULT FOR TYPE itree_key USING btree AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        FUNCTION 1 itree_key_cmp(itree_key, itree_key),
+        FUNCTION 2 itree_key_sortsupport(internal);
+
+-- Hash of the stored bytes
+CREATE FUNCTION itree_key_hash(itree_key) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_key_hash'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_key_hash_extended(itree_key, int8) RETURNS int8
+    AS 'MODULE_PATHNAME', 'itree_key_hash_extended'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS itree_key_hash_ops
+    DEFAULT FOR TYPE itree_key USING hash AS
+        OPERATOR 1 =,
+        FUNCTION 1 itree_key_hash(itree_key),
+        FUNCTION 2 itree_key_hash_extended(itree_key, int8);
+
+-- Subtree tests compare the leading bits, the support functions turn them into a btree range scan like for itree
+CREATE FUNCTION itree_key_descendant_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_key_descendant_support'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_key_ancestor_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_key_ancestor_support'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_key_is_descendant(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_is_descendant'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+    SUPPORT itree_key_descendant_support;
+CREATE FUNCTION itree_key_is_ancestor(itree_key, itree_key) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_key_is_ancestor'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+    SUPPORT itree_key_ancestor_support;
+
+CREATE OPERATOR <@ (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_is_descendant,
+    COMMUTATOR = @>,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR @> (
+    LEFTARG = itree_key,
+    RIGHTARG = itree_key,
+    PROCEDURE = itree_key_is_ancestor,
+    COMMUTATOR = <@,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+-- itree_var: itree values of any depth with segments up to 2147483647, the segments take 1 to 5 bytes
+-- in a varlena with a short header, so shallow values of small segments are smaller than the 18 bytes of itree.
+CREATE TYPE itree_var;
+CREATE FUNCTION itree_var_in(cstring) RETURNS itree_var
+    AS 'MODULE_PATHNAME', 'itree_var_in'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_out(itree_var) RETURNS cstring
+    AS 'MODULE_PATHNAME', 'itree_var_out'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+-- Binary I/O is the stored segment bytes
+CREATE FUNCTION itree_var_recv(internal) RETURNS itree_var
+    AS 'MODULE_PATHNAME', 'itree_var_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_send(itree_var) RETURNS bytea
+    AS 'MODULE_PATHNAME', 'itree_var_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- STORAGE extended lets a stored value have the 1 byte header, pglz leaves values this small alone
+CREATE TYPE itree_var (
+    INPUT = itree_var_in,
+    OUTPUT = itree_var_out,
+    RECEIVE = itree_var_recv,
+    SEND = itree_var_send,
+    INTERNALLENGTH = VARIABLE,
+    STORAGE = extended
+);
+
+-- Every itree is an itree_var, an itree_var is an itree when it fits
+CREATE FUNCTION itree_to_var(itree) RETURNS itree_var
+    AS 'MODULE_PATHNAME', 'itree_to_var'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_to_itree(itree_var) RETURNS itree
+    AS 'MODULE_PATHNAME', 'itree_var_to_itree'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE CAST (itree AS itree_var) WITH FUNCTION itree_to_var(itree) AS IMPLICIT;
+CREATE CAST (itree_var AS itree) WITH FUNCTION itree_var_to_itree(itree_var) AS ASSIGNMENT;
+
+-- Comparison operators, a memcmp() of the segment bytes, a prefix sorts first
+CREATE FUNCTION itree_var_lt(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_lt'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_le(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_le'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_eq(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_eq'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_ne(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_ne'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_ge(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_ge'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_gt(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_gt'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_cmp(itree_var, itree_var) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_var_cmp'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_sortsupport(internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_var_sortsupport'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR < (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_lt,
+    COMMUTATOR = >,
+    NEGATOR = >=,
+    RESTRICT = scalarltsel,
+    JOIN = scalarltjoinsel
+);
+CREATE OPERATOR <= (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_le,
+    COMMUTATOR = >=,
+    NEGATOR = >,
+    RESTRICT = scalarlesel,
+    JOIN = scalarlejoinsel
+);
+CREATE OPERATOR = (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_eq,
+    COMMUTATOR = =,
+    NEGATOR = <>,
+    RESTRICT = eqsel,
+    JOIN = eqjoinsel,
+    HASHES,
+    MERGES
+);
+CREATE OPERATOR <> (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_ne,
+    COMMUTATOR = <>,
+    NEGATOR = =,
+    RESTRICT = neqsel,
+    JOIN = neqjoinsel
+);
+CREATE OPERATOR >= (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_ge,
+    COMMUTATOR = <=,
+    NEGATOR = <,
+    RESTRICT = scalargesel,
+    JOIN = scalargejoinsel
+);
+CREATE OPERATOR > (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_gt,
+    COMMUTATOR = <,
+    NEGATOR = <=,
+    RESTRICT = scalargtsel,
+    JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR CLASS itree_var_btree_ops
+    DEFAULT FOR TYPE itree_var USING btree AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        FUNCTION 1 itree_var_cmp(itree_var, itree_var),
+        FUNCTION 2 itree_var_sortsupport(internal);
+
+CREATE FUNCTION itree_var_hash(itree_var) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_var_hash'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION itree_var_hash_extended(itree_var, int8) RETURNS int8
+    AS 'MODULE_PATHNAME', 'itree_var_hash_extended'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS itree_var_hash_ops
+    DEFAULT FOR TYPE itree_var USING hash AS
+        OPERATOR 1 =,
+        FUNCTION 1 itree_var_hash(itree_var),
+        FUNCTION 2 itree_var_hash_extended(itree_var, int8);
+
+-- A subtree is the values starting with the bytes of its root, a btree range up to the next sibling of the root
+CREATE FUNCTION itree_var_descendant_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_var_descendant_support'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_var_ancestor_support(internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_var_ancestor_support'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_var_is_descendant(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_is_descendant'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+    SUPPORT itree_var_descendant_support;
+CREATE FUNCTION itree_var_is_ancestor(itree_var, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_is_ancestor'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+    SUPPORT itree_var_ancestor_support;
+
+CREATE OPERATOR <@ (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_is_descendant,
+    COMMUTATOR = @>,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR @> (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_is_ancestor,
+    COMMUTATOR = <@,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+CREATE FUNCTION itree_var_matches(itree_var, iquery) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_var_matches'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE FUNCTION iquery_matches_var(iquery, itree_var) RETURNS bool
+    AS 'MODULE_PATHNAME', 'iquery_matches_var'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE OPERATOR ~ (
+    LEFTARG = itree_var,
+    RIGHTARG = iquery,
+    PROCEDURE = itree_var_matches,
+    COMMUTATOR = ~,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+CREATE OPERATOR ~ (
+    LEFTARG = iquery,
+    RIGHTARG = itree_var,
+    PROCEDURE = iquery_matches_var,
+    COMMUTATOR = ~,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+-- Concatenation copies the segment bytes, no level limit
+CREATE FUNCTION itree_var_concat(itree_var, itree_var) RETURNS itree_var
+    AS 'MODULE_PATHNAME', 'itree_var_concat'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE OPERATOR || (
+    LEFTARG = itree_var,
+    RIGHTARG = itree_var,
+    PROCEDURE = itree_var_concat
+);
+CREATE FUNCTION itree_var_addint(itree_var, int) RETURNS itree_var
+    AS 'MODULE_PATHNAME', 'itree_var_addint'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+CREATE OPERATOR || (
+    LEFTARG = itree_var,
+    RIGHTARG = int,
+    PROCEDURE = itree_var_addint
+);
+
+-- not an ilevel() overload, ilevel('1.2.3') would no longer resolve
+CREATE FUNCTION itree_var_ilevel(itree_var) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_var_ilevel'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- The keys of itree_gin_ops in the variable length form, the consistent functions are those of itree_gin_ops
+-- declared on itree_var, the query argument has the opclass type
+CREATE FUNCTION itree_var_gin_extract_value(itree_var, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_var_gin_extract_value'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_var_gin_extract_query(itree_var, internal, smallint, internal, internal, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_var_gin_extract_query'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_var_gin_consistent(internal, smallint, itree_var, int, internal, internal, internal, internal) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_var_gin_triconsistent(internal, smallint, itree_var, int, internal, internal, internal) RETURNS "char"
+    AS 'MODULE_PATHNAME', 'itree_triconsistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_var_gin_compare_partial(itree_var, itree_var, smallint, internal) RETURNS int4
+    AS 'MODULE_PATHNAME', 'itree_var_gin_compare_partial'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS itree_var_gin_ops
+    FOR TYPE itree_var USING gin AS
+        OPERATOR 1 <@,
+        OPERATOR 2 @>,
+        OPERATOR 3 ~ (itree_var, iquery),
+        FUNCTION 1 itree_var_cmp(itree_var, itree_var),
+        FUNCTION 2 itree_var_gin_extract_value(itree_var, internal, internal),
+        FUNCTION 3 itree_var_gin_extract_query(itree_var, internal, smallint, internal, internal, internal, internal),
+        FUNCTION 4 itree_var_gin_consistent(internal, smallint, itree_var, int, internal, internal, internal, internal),
+        FUNCTION 5 itree_var_gin_compare_partial(itree_var, itree_var, smallint, internal),
+        FUNCTION 6 itree_var_gin_triconsistent(internal, smallint, itree_var, int, internal, internal, internal)
+    ;
+
+-- minmax in btree order, <@ and @> against a constant become a range through the support functions
+CREATE OPERATOR CLASS itree_var_minmax_ops
+    DEFAULT FOR TYPE itree_var USING brin AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        FUNCTION 1 brin_minmax_opcinfo(internal),
+        FUNCTION 2 brin_minmax_add_value(internal, internal, internal, internal),
+        FUNCTION 3 brin_minmax_consistent(internal, internal, internal),
+        FUNCTION 4 brin_minmax_union(internal, internal, internal);
+
+-- Closure table of an itree column: rows per node and per subtree, merged once per statement, see itree_closure.c
+CREATE FUNCTION itree_closure_trigger() RETURNS trigger
+    AS 'MODULE_PATHNAME', 'itree_closure_trigger'
+    LANGUAGE C;
+
+-- itree_closure_create(source, col [, measure [, closure]]) creates the closure table of source.col,
+-- by default <table>_<col>_closure in the schema of the table, fills it and installs the triggers.
+-- measure is an optional smallint, integer or bigint column summed into self_sum and subtree_sum.
+CREATE FUNCTION itree_closure_create(source regclass, col name, measure name DEFAULT NULL, closure name DEFAULT NULL)
+RETURNS regclass
+LANGUAGE plpgsql AS $$
+DECLARE
+    -- the extension is relocatable and need not be on the search_path
+    ext text := (SELECT quote_ident(n.nspname) FROM pg_extension e JOIN pg_namespace n ON n.oid = e.extnamespace
+                 WHERE e.extname = 'itree');
+    nsp name;
+    rel name;
+    target text;
+    args text;
+BEGIN
+    SELECT n.nspname, c.relname INTO nsp, rel FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace WHERE c.oid = source;
+    IF NOT EXISTS (SELECT FROM pg_attribute WHERE attrelid = source AND attname = col AND NOT attisdropped
+                   AND atttypid = format('%s.itree', ext)::regtype) THEN
+        RAISE EXCEPTION 'column "%" of % is not an itree column', col, source;
+    END IF;
+    IF measure IS NOT NULL AND NOT EXISTS (SELECT FROM pg_attribute WHERE attrelid = source AND attname = measure AND NOT attisdropped
+                                           AND atttypid IN ('int2'::regtype, 'int4'::regtype, 'int8'::regtype)) THEN
+        RAISE EXCEPTION 'column "%" of % is not a smallint, integer or bigint column', measure, source;
+    END IF;
+    closure := coalesce(closure, rel || '_' || col || '_closure');
+    target := format('%I.%I', nsp, closure);
+    args := format('%L, %L', col, target) || CASE WHEN measure IS NULL THEN '' ELSE format(', %L', measure) END;
+
+    EXECUTE format('CREATE TABLE %s (node %s.itree PRIMARY KEY, self_count bigint NOT NULL, subtree_count bigint NOT NULL%s)',
+                   target, ext, CASE WHEN measure IS NULL THEN '' ELSE ', self_sum bigint NOT NULL, subtree_sum bigint NOT NULL' END);
+    -- a trigger with transition tables has a single event, the triggers lock the source before the fill
+    EXECUTE format('CREATE TRIGGER %I AFTER INSERT ON %s REFERENCING NEW TABLE AS new_rows '
+                   'FOR EACH STATEMENT EXECUTE FUNCTION %s.itree_closure_trigger(%s)', closure || '_insert', source, ext, args);
+    EXECUTE format('CREATE TRIGGER %I AFTER UPDATE ON %s REFERENCING OLD TABLE AS old_rows NEW TABLE AS new_rows '
+                   'FOR EACH STATEMENT EXECUTE FUNCTION %s.itree_closure_trigger(%s)', closure || '_update', source, ext, args);
+    EXECUTE format('CREATE TRIGGER %I AFTER DELETE ON %s REFERENCING OLD TABLE AS old_rows '
+                   'FOR EACH STATEMENT EXECUTE FUNCTION %s.itree_closure_trigger(%s)', closure || '_delete', source, ext, args);
+    EXECUTE format('CREATE TRIGGER %I AFTER TRUNCATE ON %s '
+                   'FOR EACH STATEMENT EXECUTE FUNCTION %s.itree_closure_trigger(%s)', closure || '_truncate', source, ext, args);
+
+    EXECUTE format('INSERT INTO %1$s SELECT p, count(*) FILTER (WHERE p OPERATOR(%2$s.=) t.%3$I), count(*)%4$s '
+                   'FROM %5$s t, %2$s.itree_prefixes(t.%3$I) p GROUP BY p',
+                   target, ext, col,
+                   CASE WHEN measure IS NULL THEN ''
+                        ELSE format(', coalesce(sum(t.%2$I) FILTER (WHERE p OPERATOR(%1$s.=) t.%3$I), 0), coalesce(sum(t.%2$I), 0)',
+                                    ext, measure, col) END,
+                   source);
+    RETURN target::regclass;
+END;
+$$;
+
+-- SP-GiST trie branching on the segments, see itree_spgist.c
+CREATE FUNCTION itree_spgist_config(internal, internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_spgist_config'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_spgist_choose(internal, internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_spgist_choose'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_spgist_picksplit(internal, internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_spgist_picksplit'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_spgist_inner_consistent(internal, internal) RETURNS void
+    AS 'MODULE_PATHNAME', 'itree_spgist_inner_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_spgist_leaf_consistent(internal, internal) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_spgist_leaf_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS itree_spgist_ops
+    DEFAULT FOR TYPE itree USING spgist AS
+        OPERATOR 1 <,
+        OPERATOR 2 <=,
+        OPERATOR 3 =,
+        OPERATOR 4 >=,
+        OPERATOR 5 >,
+        OPERATOR 10 @>,
+        OPERATOR 11 <@,
+        OPERATOR 15 <-> (itree, itree) FOR ORDER BY pg_catalog.integer_ops,
+        FUNCTION 1 itree_spgist_config(internal, internal),
+        FUNCTION 2 itree_spgist_choose(internal, internal),
+        FUNCTION 3 itree_spgist_picksplit(internal, internal),
+        FUNCTION 4 itree_spgist_inner_consistent(internal, internal),
+        FUNCTION 5 itree_spgist_leaf_consistent(internal, internal);
+
+-- The keys of itree_gin_ops as int4 fingerprints, every match is rechecked, see itree_gin.c
+CREATE FUNCTION itree_gin_fp_extract_value(itree, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gin_fp_extract_value'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gin_fp_extract_query(itree, internal, smallint, internal, internal, internal, internal) RETURNS internal
+    AS 'MODULE_PATHNAME', 'itree_gin_fp_extract_query'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gin_fp_consistent(internal, smallint, itree, int, internal, internal, internal, internal) RETURNS bool
+    AS 'MODULE_PATHNAME', 'itree_gin_fp_consistent'
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION itree_gin_fp_triconsistent(internal, smallint, itree, int, internal, internal, internal) RETURNS "char"
+    AS 'MODULE_PATHNAME', 'itree_gin_fp_triconsistent'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OPERATOR CLASS itree_gin_fp_ops
+    FOR TYPE itree USING gin AS
+        OPERATOR 1 <@,
+        OPERATOR 2 @>,
+        OPERATOR 3 ~ (itree, iquery),
+        FUNCTION 1 btint4cmp(int4, int4),
+        FUNCTION 2 itree_gin_fp_extract_value(itree, internal, internal),
+        FUNCTION 3 itree_gin_fp_extract_query(itree, internal, smallint, internal, internal, internal, internal),
+        FUNCTION 4 itree_gin_fp_consistent(internal, smallint, itree, int, internal, internal, internal, internal),
+        FUNCTION 6 itree_gin_fp_triconsistent(internal, smallint, itree, int, internal, internal, internal),
+        STORAGE int4
+    ;
+
+-- itree_next_child(rel, parent): parent || n for the next free n, rel is the table or its btree index on the
+-- itree column. The counters live in shared memory and are seeded from the index, see itree_alloc.c
+CREATE FUNCTION itree_next_child(regclass, itree) RETURNS itree
+    AS 'MODULE_PATHNAME', 'itree_next_child'
+    LANGUAGE C VOLATILE STRICT PARALLEL UNSAFE;
+
+-- itree_rebase(id, old_prefix, new_prefix): id moved from the subtree of old_prefix under new_prefix, on the packed bytes
+CREATE FUNCTION itree_rebase(itree, itree, itree) RETURNS itree
+    AS 'MODULE_PATHNAME', 'itree_rebase'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- CALL itree_move_subtree(rel, col, old_prefix, new_prefix [, batch_size]) moves the rows of the subtree of
+-- old_prefix under new_prefix, batch_size rows per transaction in btree order of the subtree range.
+-- Before the first batch every row is rebased once to find a key over the 16 data bytes, and the rebased keys
+-- are checked against the rows outside the subtree; each batch checks its keys again before the update.
+-- The move is not atomic: it commits after each batch, so CALL it outside of a transaction block, and a batch
+-- that fails leaves the batches before it moved.
+-- The batches walk the old keys with a cursor. Under an ancestor of old_prefix a rebased key can be in the
+-- subtree again, fewer levels down: the levels are then moved from the top, one cursor each, so the key of
+-- a row is free before a row of the next level takes it and the rebased rows are behind the cursor.
+CREATE PROCEDURE itree_move_subtree(rel regclass, col name, old_prefix itree, new_prefix itree, batch_size int DEFAULT 10000)
+LANGUAGE plpgsql AS $$
+DECLARE
+    -- the extension is relocatable and need not be on the search_path
+    ext text := (SELECT quote_ident(n.nspname) FROM pg_extension e JOIN pg_namespace n ON n.oid = e.extnamespace
+                 WHERE e.extname = 'itree');
+    inside boolean;
+    total bigint;
+    collisions bigint := 0;
+    moved bigint := 0;
+    n bigint;
+    levels int[] := ARRAY[NULL::int];
+    level int;
+    -- %TYPE, the extension schema need not be on the search_path
+    last old_prefix%TYPE;
+    upto old_prefix%TYPE;
+    batch text;
+BEGIN
+    IF NOT EXISTS (SELECT FROM pg_attribute WHERE attrelid = rel AND attname = col AND NOT attisdropped
+                   AND atttypid = format('%s.itree', ext)::regtype) THEN
+        RAISE EXCEPTION 'column "%" of % is not an itree column', col, rel;
+    END IF;
+    IF batch_size < 1 THEN
+        RAISE EXCEPTION 'batch_size must be at least 1 (got %)', batch_size;
+    END IF;
+    EXECUTE format('SELECT $2 OPERATOR(%s.<@) $1', ext) INTO inside USING old_prefix, new_prefix;
+    IF inside THEN
+        RAISE EXCEPTION 'cannot move % into its own subtree %', old_prefix, new_prefix;
+    END IF;
+    EXECUTE format('SELECT $1 OPERATOR(%s.<@) $2', ext) INTO inside USING old_prefix, new_prefix;
+    IF inside THEN
+        EXECUTE format('SELECT array(SELECT generate_series(%s.ilevel($1), 16))', ext)
+            INTO levels USING old_prefix;
+    END IF;
+
+    -- itree_rebase() raises the error of the first key that does not fit
+    EXECUTE format('SELECT count(%1$s.itree_rebase(t.%2$I, $1, $2)) FROM %3$s t WHERE t.%2$I OPERATOR(%1$s.<@) $1',
+                   ext, col, rel)
+        INTO total USING old_prefix, new_prefix;
+    EXECUTE format('SELECT EXISTS (SELECT FROM %3$s WHERE %2$I OPERATOR(%1$s.<@) $1)', ext, col, rel)
+        INTO inside USING new_prefix;
+    IF inside THEN
+        EXECUTE format('SELECT count(*) FROM %3$s t WHERE t.%2$I OPERATOR(%1$s.<@) $1 '
+                       'AND EXISTS (SELECT FROM %3$s o WHERE o.%2$I OPERATOR(%1$s.=) %1$s.itree_rebase(t.%2$I, $1, $2) '
+                       'AND NOT o.%2$I OPERATOR(%1$s.<@) $1)',
+                       ext, col, rel)
+            INTO collisions USING old_prefix, new_prefix;
+    END IF;
+    IF collisions > 0 THEN
+        RAISE EXCEPTION '% rows of % would take the key of an existing row under %', collisions, old_prefix, new_prefix;
+    END IF;
+
+    -- a batch runs from the key after the last one moved up to the batch_size-th key, with all rows of that key
+    FOREACH level IN ARRAY levels LOOP
+        last := NULL;
+        LOOP
+            batch := format('%2$I OPERATOR(%1$s.<@) $1', ext, col);
+            IF last IS NOT NULL THEN
+                batch := batch || format(' AND %2$I OPERATOR(%1$s.>) $3', ext, col);
+            END IF;
+            IF level IS NOT NULL THEN
+                batch := batch || format(' AND %1$s.ilevel(%2$I) = $5', ext, col);
+            END IF;
+            EXECUTE format('SELECT %2$I FROM %3$s WHERE %4$s ORDER BY %2$I OFFSET $4 - 1 LIMIT 1', ext, col, rel, batch)
+                INTO upto USING old_prefix, new_prefix, last, batch_size, level;
+            IF upto IS NOT NULL THEN
+                batch := batch || format(' AND %2$I OPERATOR(%1$s.<=) $4', ext, col);
+            END IF;
+
+            EXECUTE format('SELECT count(*) FROM %3$s t WHERE %4$s AND EXISTS (SELECT FROM %3$s o '
+                           'WHERE o.%2$I OPERATOR(%1$s.=) %1$s.itree_rebase(t.%2$I, $1, $2))',
+                           ext, col, rel, batch)
+                INTO collisions USING old_prefix, new_prefix, last, upto, level;
+            IF collisions > 0 THEN
+                RAISE EXCEPTION '% rows of % would take the key of an existing row under %', collisions, old_prefix, new_prefix
+                    USING DETAIL = format('%s of %s rows were moved before.', moved, total);
+            END IF;
+            EXECUTE format('UPDATE %3$s SET %2$I = %1$s.itree_rebase(%2$I, $1, $2) WHERE %4$s', ext, col, rel, batch)
+                USING old_prefix, new_prefix, last, upto, level;
+            GET DIAGNOSTICS n = ROW_COUNT;
+            IF n > 0 THEN
+                moved := moved + n;
+                COMMIT;
+                RAISE NOTICE 'itree_move_subtree: moved % of % rows', moved, total;
+            END IF;
+            EXIT WHEN upto IS NULL;
+            last := upto;
+        END LOOP;
+    END LOOP;
+END;
+$$;
@@ -3,30 +3,81 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "utils/array.h"
+#include "itree_core.h"
 
+#define DatumGetITree(X) ((itree *)DatumGetPointer(X))
+#define ITreeGetDatum(X) PointerGetDatum(X)
+#define PG_RETURN_ITREE(x) PG_RETURN_POINTER(x)
+#define PG_GETARG_ITREE(n) DatumGetITree(PG_GETARG_DATUM(n))
 
+/**
+ * itree_var: the variable length form, the segments of itree_var_encode_segment() back to back in a varlena.
+ * Values are read with their short header, VARDATA_ANY and VARSIZE_ANY_EXHDR.
+ */
+typedef struct {
+    int32 vl_len_;   // varlena header, do not touch directly
+    uint8_t data[FLEXIBLE_ARRAY_MEMBER];
+} itree_var;
 
-#define ITREE_MAX_LEVELS 16  // Max 16 1-byte segments
-#define ITREE_SIZE ITREE_MAX_LEVELS + 2 // 2 bytes for control
-#define ITREE_MAX_SEGMENT_LENGTH 2  // Max 2 bytes for segment length
+#define DatumGetITreeVarPP(X) ((itree_var *) PG_DETOAST_DATUM_PACKED(X))
+#define PG_GETARG_ITREE_VAR_PP(n) DatumGetITreeVarPP(PG_GETARG_DATUM(n))
+#define ITREE_VAR_DATA(v) ((const uint8_t *) VARDATA_ANY(v))
+#define ITREE_VAR_LEN(v) ((int) VARSIZE_ANY_EXHDR(v))
+
+/**
+ * iquery: a pattern over the levels of an itree, like lquery for ltree.
+ * Items are separated by '.':
+ * 5        the level is 5
+ * 5|7|300  the level is one of the values
+ * !5|7     the level is none of the values
+ * *        any number of levels, *{n} exactly n, *{n,} at least n, *{,m} at most m, *{n,m}
+ */
+#define IQUERY_MAX_ITEMS 32
+#define IQUERY_MAX_VALUES 255
+#define IQUERY_MAX_BOUND 254  // largest level count of a * item, itree_var values can be deeper than itree
+#define IQUERY_UNBOUNDED 255  // high of a * item without upper bound
+
+#define IQUERY_ITEM_ANY 0x01 // * item, repeated low..high times
+#define IQUERY_ITEM_NOT 0x02 // ! item, none of the values
 
 typedef struct {
-    uint8_t control[2];  //all control bits used for segments
-    uint8_t data[ITREE_MAX_LEVELS]; // 16 bytes for segments
-} itree;
+    uint8_t flags;
+    uint8_t nvalues;
+    uint8_t low;     // number of levels the item matches: low..high, 1..1 for a value item
+    uint8_t high;
+    uint16_t values[FLEXIBLE_ARRAY_MEMBER];
+} iquery_item;
 
+typedef struct {
+    int32 vl_len_;   // varlena header, do not touch directly
+    uint16_t nitems;
+    uint16_t reserved;
+    char items[FLEXIBLE_ARRAY_MEMBER];
+} iquery;
 
-#define DatumGetITree(X) ((itree *)DatumGetPointer(X))
-#define ITreeGetDatum(X) PointerGetDatum(X)
-#define PG_RETURN_ITREE(x) PG_RETURN_POINTER(x)
-#define PG_GETARG_ITREE(n) DatumGetITree(PG_GETARG_DATUM(n))
+#define IQUERY_HDRSIZE offsetof(iquery, items)
+#define IQUERY_ITEM_SIZE(nvalues) (offsetof(iquery_item, values) + (nvalues) * sizeof(uint16_t))
+#define IQUERY_FIRST(q) ((iquery_item *) (q)->items)
+#define IQUERY_NEXT(item) ((iquery_item *) ((char *) (item) + IQUERY_ITEM_SIZE((item)->nvalues)))
+
+#define DatumGetIQuery(X) ((iquery *) PG_DETOAST_DATUM(X))
+#define PG_GETARG_IQUERY(n) DatumGetIQuery(PG_GETARG_DATUM(n))
+#define PG_RETURN_IQUERY(x) PG_RETURN_POINTER(x)
 
 
 
 
+//text input with the errors of itree_in
+void itree_parse_text(const char *input, itree *dst);
+void itree_size_error(int sqlerrcode, const char *what);
+
 //in out functions
 PGDLLEXPORT Datum itree_in(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_out(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_send(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_recv(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_legacy_text(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_typmod_in(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_typmod_out(PG_FUNCTION_ARGS);
 //comparison functions
@@ -37,9 +88,96 @@ PGDLLEXPORT Datum itree_le(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_ge(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_gt(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_ne(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_sortsupport(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_hash(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_hash_extended(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_is_descendant(PG_FUNCTION_ARGS);
  PGDLLEXPORT Datum itree_is_ancestor(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_ilevel(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_distance(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum iquery_in(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum iquery_out(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_matches(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum iquery_matches(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_match_support(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_has_ancestor(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_is_descendant_array(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_has_descendant(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_is_ancestor_array(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_matches(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum iquery_matches_array(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_first_ancestor(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_first_descendant(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_first_match(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_pack(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_array_descendant_bitmap(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_packed_descendant_bitmap(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum rollup_to_level(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_lca_transfn(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_lca_finalfn(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_lca_array(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_prefixes(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_ancestors(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_path_segments(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_parent(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_nlevel_prefix(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_children_range(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_next_sibling(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_subtree_upper(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_rebase(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_descendant_support(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_ancestor_support(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_descendant_support(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_ancestor_support(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_descendant_sel(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_ancestor_sel(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_descendant_joinsel(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_ancestor_joinsel(PG_FUNCTION_ARGS);
+//itree_key, the memcmp ordered storage
+PGDLLEXPORT Datum itree_key_in(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_out(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_recv(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_send(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_to_key(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_to_itree(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_cmp(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_lt(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_le(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_eq(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_ne(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_ge(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_gt(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_sortsupport(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_hash(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_hash_extended(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_is_descendant(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_key_is_ancestor(PG_FUNCTION_ARGS);
+//itree_var, the variable length form
+PGDLLEXPORT Datum itree_var_in(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_out(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_recv(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_send(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_to_var(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_to_itree(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_cmp(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_lt(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_le(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_eq(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_ne(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_ge(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_gt(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_sortsupport(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_hash(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_hash_extended(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_is_descendant(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_is_ancestor(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_matches(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum iquery_matches_var(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_ilevel(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_concat(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_addint(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_descendant_support(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum itree_var_ancestor_support(PG_FUNCTION_ARGS);
 /* Concatenation functions */
 PGDLLEXPORT Datum itree_additree(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum itree_addint(PG_FUNCTION_ARGS);
@@ -48,8 +186,19 @@ PGDLLEXPORT Datum itree_intadd(PG_FUNCTION_ARGS);
 //helper functions
 void set_control_bit(itree* tree_instance, int data_index, int bit_value);
 int get_control_bit(const itree* tree_instance, int data_index);
-int itree_get_segments(itree *tree, uint16_t *segments);
 itree *init_itree();
 itree *create_itree_from_segments(const uint16_t *segments);
 
+//iquery helpers
+bool iquery_match(const iquery *query, const itree *tree);
+int iquery_fixed_prefix(const iquery *query, itree *prefix);
+iquery *iquery_head(const iquery *query, int *head_levels);
+bool iquery_match_var(const iquery *query, const uint8_t *data, int len);
+
+//itree_var helpers
+itree_var *itree_var_make(const uint8_t *data, int len);
+
+//itree[] helpers
+ArrayIterator itree_array_iterator(ArrayType *array);
+
 #endif
\ No newline at end of file
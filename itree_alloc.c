@@ -0,0 +1,345 @@
+/**
+ * itree_next_child(rel, parent): the key of a new child of parent, without SELECT max(id) ... FOR UPDATE.
+ * The greatest child segment handed out so far is cached per (database, btree index, parent) in a shared
+ * memory table of the DSM registry, so no shared_preload_libraries entry is needed. On first use of a
+ * parent the counter is seeded from the btree: a backward scan of the subtree range of parent with
+ * SnapshotAny, which also sees the rows of transactions still in progress.
+ *
+ * The cache is not WAL logged, the btree is the durable state: after a restart or a crash the counters
+ * are seeded again, a key handed to a transaction that never committed can be handed out again.
+ * Like nextval(), a key of a rolled back transaction leaves a gap. A slot is only evicted once every
+ * transaction that got a key from it has ended, so its keys are either in the index or free again.
+ * Ended means older than the oldest running xid, not the xmin horizon: long snapshots, replication
+ * slots and hot_standby_feedback hold the horizon back but don't keep a key out of the index.
+ * Keys must be inserted by the transaction that allocated them, and rows inserted with keys of their
+ * own under a parent in use are not seen by the counter.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "access/genam.h"
+#include "access/itup.h"
+#include "access/relscan.h"
+#include "access/stratnum.h"
+#include "access/table.h"
+#include "access/transam.h"
+#include "access/xact.h"
+#include "catalog/index.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "common/hashfn.h"
+#include "nodes/pg_list.h"
+#include "storage/dsm_registry.h"
+#include "storage/lwlock.h"
+#include "storage/procarray.h"
+#include "utils/acl.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+#include "utils/snapmgr.h"
+#include "itree.h"
+
+#if PG_VERSION_NUM < 170000
+#error "itree needs PostgreSQL 17 or later for the DSM registry"
+#endif
+
+#define ITREE_ALLOC_BUCKETS 512
+#define ITREE_ALLOC_WAYS 8
+
+typedef struct {
+    Oid dbid;           // InvalidOid for a free slot
+    Oid index;
+    itree parent;       // canonical
+    uint16 last;        // greatest child segment handed out or found in the index
+    TransactionId xid;  // latest top level xid that was handed a key
+    uint64 used;        // tick of the last allocation, the least recently used evictable slot goes first
+} itree_alloc_slot;
+
+typedef struct {
+    LWLock lock;
+    uint64 tick;
+    uint64 evictions;   // a seed read before an eviction may miss the keys of the evicted slot
+    itree_alloc_slot slots[ITREE_ALLOC_BUCKETS][ITREE_ALLOC_WAYS];
+} itree_alloc_shared;
+
+// the index a regclass argument stands for, kept in fn_extra
+typedef struct {
+    Oid rel;
+    Oid index;
+    Oid heap;
+} itree_alloc_target;
+
+static itree_alloc_shared *itree_alloc_state = NULL;
+
+static void itree_alloc_init_shmem(void *ptr) {
+    itree_alloc_shared *shared = (itree_alloc_shared *) ptr;
+
+    memset(shared, 0, sizeof(itree_alloc_shared));
+    LWLockInitialize(&shared->lock, LWLockNewTrancheId());
+}
+
+static itree_alloc_shared *itree_alloc_attach(void) {
+    bool found;
+
+    if (itree_alloc_state == NULL) {
+        itree_alloc_state = GetNamedDSMSegment("itree_next_child", sizeof(itree_alloc_shared),
+                                               itree_alloc_init_shmem, &found);
+        LWLockRegisterTranche(itree_alloc_state->lock.tranche, "itree_next_child");
+    }
+    return itree_alloc_state;
+}
+
+/**
+ * A valid btree index without predicate whose first column is a plain itree column in the itree btree order.
+ */
+static bool itree_alloc_usable(Relation index, Oid itree_type) {
+    return index->rd_rel->relam == BTREE_AM_OID && index->rd_index->indisvalid &&
+           index->rd_index->indkey.values[0] != 0 && index->rd_opcintype[0] == itree_type &&
+           OidIsValid(get_opfamily_member(index->rd_opfamily[0], itree_type, itree_type, BTGreaterStrategyNumber)) &&
+           RelationGetIndexPredicate(index) == NIL;
+}
+
+/**
+ * The btree index of rel, an index or a table with usable indexes on one itree column only.
+ */
+static void itree_alloc_resolve(Oid rel, Oid itree_type, itree_alloc_target *target) {
+    List *candidates;
+    ListCell *lc;
+    AttrNumber column = 0;
+    AclResult aclresult;
+
+    // set last, an error half way leaves nothing cached
+    target->rel = InvalidOid;
+    target->index = InvalidOid;
+    if (get_rel_relkind(rel) == RELKIND_INDEX) {
+        target->heap = IndexGetRelation(rel, false);
+        candidates = list_make1_oid(rel);
+    } else {
+        Relation heap = table_open(rel, AccessShareLock);
+
+        target->heap = rel;
+        candidates = RelationGetIndexList(heap);
+        table_close(heap, AccessShareLock);
+    }
+
+    foreach (lc, candidates) {
+        Relation index = index_open(lfirst_oid(lc), AccessShareLock);
+
+        if (itree_alloc_usable(index, itree_type)) {
+            if (OidIsValid(target->index) && index->rd_index->indkey.values[0] != column) {
+                ereport(ERROR, (errcode(ERRCODE_AMBIGUOUS_PARAMETER),
+                                errmsg("\"%s\" has btree indexes on more than one itree column", get_rel_name(rel)),
+                                errhint("Pass the index of the column instead of the table.")));
+            }
+            target->index = RelationGetRelid(index);
+            column = index->rd_index->indkey.values[0];
+        }
+        index_close(index, AccessShareLock);
+    }
+    if (!OidIsValid(target->index)) {
+        ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+                        errmsg("\"%s\" has no btree index on an itree column", get_rel_name(rel)),
+                        errhint("The index must be a valid btree index without predicate with the itree column first.")));
+    }
+
+    // the seed scan reads the keys of the table
+    aclresult = pg_class_aclcheck(target->heap, GetUserId(), ACL_SELECT);
+    if (aclresult != ACLCHECK_OK) {
+        aclcheck_error(aclresult, OBJECT_TABLE, get_rel_name(target->heap));
+    }
+    target->rel = rel;
+}
+
+static RegProcedure itree_alloc_btree_proc(Relation index, StrategyNumber strategy) {
+    return get_opcode(get_opfamily_member(index->rd_opfamily[0], index->rd_opcintype[0], index->rd_opcintype[0], strategy));
+}
+
+/**
+ * Greatest child segment of parent in the index, 0 when it has none: the last entry of the subtree range
+ * (parent, itree_subtree_upper(parent)] is the greatest descendant, its next level is the greatest child.
+ * SnapshotAny includes the entries of transactions in progress and dead ones, a dead one only leaves a gap.
+ */
+static uint16 itree_alloc_seed(const itree_alloc_target *target, const itree *parent) {
+    Relation heap = table_open(target->heap, AccessShareLock);
+    Relation index = index_open(target->index, AccessShareLock);
+    IndexScanDesc scan;
+    ScanKeyData keys[2];
+    itree upper;
+    uint16 last = 0;
+
+    itree_subtree_upper_copy(parent, &upper);
+    ScanKeyInit(&keys[0], 1, BTGreaterStrategyNumber, itree_alloc_btree_proc(index, BTGreaterStrategyNumber),
+                ITreeGetDatum(parent));
+    ScanKeyInit(&keys[1], 1, BTLessEqualStrategyNumber, itree_alloc_btree_proc(index, BTLessEqualStrategyNumber),
+                ITreeGetDatum(&upper));
+
+    scan = index_beginscan(heap, index, SnapshotAny, 2, 0);
+    scan->xs_want_itup = true;
+    index_rescan(scan, keys, 2, NULL, 0);
+    if (index_getnext_tid(scan, BackwardScanDirection) != NULL) {
+        bool isnull;
+        Datum value = index_getattr(scan->xs_itup, 1, scan->xs_itupdesc, &isnull);
+        uint16_t segments[ITREE_MAX_LEVELS];
+
+        if (!isnull) {
+            itree_get_segments(DatumGetITree(value), segments);
+            last = segments[itree_packed_depth(parent)];
+        }
+    }
+    index_endscan(scan);
+
+    index_close(index, AccessShareLock);
+    table_close(heap, AccessShareLock);
+    return last;
+}
+
+static itree_alloc_slot *itree_alloc_lookup(itree_alloc_slot *bucket, Oid index, const itree *parent) {
+    for (int way = 0; way < ITREE_ALLOC_WAYS; way++) {
+        if (bucket[way].dbid == MyDatabaseId && bucket[way].index == index &&
+            memcmp(&bucket[way].parent, parent, sizeof(itree)) == 0) {
+            return &bucket[way];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A free slot of the bucket, else the least recently used slot whose transactions have all ended:
+ * every key it handed out is then in the index or was never committed. NULL when there is none.
+ * slot->xid is the latest xid of the slot, all of them ended when it is older than the oldest running xid.
+ */
+static itree_alloc_slot *itree_alloc_claim(itree_alloc_shared *shared, itree_alloc_slot *bucket) {
+    itree_alloc_slot *victim = NULL;
+    TransactionId oldest_running;
+
+    for (int way = 0; way < ITREE_ALLOC_WAYS; way++) {
+        if (bucket[way].dbid == InvalidOid) {
+            return &bucket[way];
+        }
+    }
+    oldest_running = GetOldestActiveTransactionId();
+    for (int way = 0; way < ITREE_ALLOC_WAYS; way++) {
+        if (TransactionIdPrecedes(bucket[way].xid, oldest_running) && (victim == NULL || bucket[way].used < victim->used)) {
+            victim = &bucket[way];
+        }
+    }
+    if (victim != NULL) {
+        shared->evictions++;
+    }
+    return victim;
+}
+
+/**
+ * Greatest child segment that fits after nbytes data bytes of a parent: 2-byte segments up to 65535,
+ * only 1..255 when one byte is left, none when the parent is full.
+ */
+static uint16 itree_alloc_max_segment(int nbytes) {
+    if (nbytes + 2 <= ITREE_MAX_LEVELS) {
+        return 65535;
+    }
+    return nbytes < ITREE_MAX_LEVELS ? 255 : 0;
+}
+
+static void itree_alloc_exhausted(const itree *parent, int nbytes) {
+    ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                    errmsg("itree %s has no free child segment",
+                           DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(parent)))),
+                    nbytes == ITREE_MAX_LEVELS ? errdetail("All %d data bytes are used.", ITREE_MAX_LEVELS) :
+                    nbytes + 1 == ITREE_MAX_LEVELS ? errdetail("One data byte is left, children above 255 take 2 bytes.") :
+                    errdetail("Child segments end at 65535.")));
+}
+
+/**
+ * itree_next_child ( rel regclass, parent itree ) → itree
+ * parent || n for the next free n, rel is the table or its btree index on the itree column.
+ * Concurrent callers get distinct keys without waiting on row locks, the shared counter is held
+ * for the increment only.
+ */
+PG_FUNCTION_INFO_V1(itree_next_child);
+Datum itree_next_child(PG_FUNCTION_ARGS) {
+    Oid rel = PG_GETARG_OID(0);
+    itree parent;
+    int nbytes;
+    uint16 max_segment;
+    itree_alloc_target *target = (itree_alloc_target *) fcinfo->flinfo->fn_extra;
+    itree_alloc_shared *shared;
+    itree_alloc_slot *bucket;
+    TransactionId xid;
+    uint64 evictions = 0;
+    uint16 seed = 0;
+    bool seeded = false;
+    uint16 segment = 0;
+    itree *result;
+
+    itree_canonical_copy(PG_GETARG_ITREE(1), &parent);
+    nbytes = itree_packed_len(&parent);
+    max_segment = itree_alloc_max_segment(nbytes);
+    if (max_segment == 0) {
+        itree_alloc_exhausted(&parent, nbytes);
+    }
+
+    if (target == NULL || target->rel != rel) {
+        Oid itree_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+
+        // the btree opclass is matched on the itree type, which only the call expression tells
+        if (!OidIsValid(itree_type)) {
+            ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                            errmsg("itree_next_child: could not determine the itree type of the call")));
+        }
+        if (target == NULL) {
+            target = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(itree_alloc_target));
+            fcinfo->flinfo->fn_extra = target;
+        }
+        itree_alloc_resolve(rel, itree_type, target);
+    }
+
+    // before the lock: assigning the xid may have to wait
+    xid = GetTopTransactionId();
+    shared = itree_alloc_attach();
+    bucket = shared->slots[hash_bytes((const unsigned char *) &parent, sizeof(itree)) % ITREE_ALLOC_BUCKETS];
+
+    for (;;) {
+        itree_alloc_slot *slot;
+
+        LWLockAcquire(&shared->lock, LW_EXCLUSIVE);
+        slot = itree_alloc_lookup(bucket, target->index, &parent);
+        // a seed read while a slot was evicted may be behind the keys of that slot, read it again
+        if (slot == NULL && seeded && evictions == shared->evictions) {
+            slot = itree_alloc_claim(shared, bucket);
+            if (slot == NULL) {
+                LWLockRelease(&shared->lock);
+                ereport(ERROR, (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+                                errmsg("itree_next_child: no free counter slot for itree parents"),
+                                errhint("Commit the transactions that allocate children of many parents.")));
+            }
+            slot->dbid = MyDatabaseId;
+            slot->index = target->index;
+            slot->parent = parent;
+            slot->last = seed;
+            slot->xid = xid;
+        }
+        if (slot != NULL) {
+            if (slot->last < max_segment) {
+                segment = ++slot->last;
+                if (TransactionIdFollows(xid, slot->xid)) {
+                    slot->xid = xid;
+                }
+                slot->used = ++shared->tick;
+            }
+            LWLockRelease(&shared->lock);
+            break;
+        }
+        evictions = shared->evictions;
+        LWLockRelease(&shared->lock);
+
+        seed = itree_alloc_seed(target, &parent);
+        seeded = true;
+    }
+
+    if (segment == 0) {
+        itree_alloc_exhausted(&parent, nbytes);
+    }
+    result = (itree *) palloc(sizeof(itree));
+    itree_append_segment(&parent, segment, result);
+    PG_RETURN_ITREE(result);
+}
@@ -0,0 +1,156 @@
+/**
+ * itree[] operators, like the ltree[] ones:
+ * itree[] @> itree   an element is an ancestor of the itree (or equal), itree <@ itree[] is the same
+ * itree[] <@ itree   an element is a descendant of the itree (or equal), itree @> itree[] is the same
+ * itree[] ~ iquery   an element matches the iquery, iquery ~ itree[] is the same
+ * ?@>, ?<@, ?~       the first such element, NULL if there is none
+ *
+ * The elements are visited once in array order with the packed comparisons, NULL elements are skipped.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "utils/array.h"
+#include "itree.h"
+
+typedef bool (*itree_array_pred)(const itree *elem, const void *arg);
+
+static bool itree_elem_is_ancestor(const itree *elem, const void *arg) {
+    return itree_packed_is_prefix(elem, (const itree *) arg);
+}
+
+// arg is the itree_prefix_matcher of the itree, prepared once for all elements
+static bool itree_elem_is_descendant(const itree *elem, const void *arg) {
+    return itree_prefix_matcher_test((const itree_prefix_matcher *) arg, elem);
+}
+
+static bool itree_elem_matches(const itree *elem, const void *arg) {
+    return iquery_match((const iquery *) arg, elem);
+}
+
+/**
+ * An iterator over the elements of an itree[]. The element layout is known,
+ * this saves the type lookup of array_create_iterator(), which copies the meta state.
+ */
+ArrayIterator itree_array_iterator(ArrayType *array) {
+    ArrayMetaState meta = {.element_type = ARR_ELEMTYPE(array),
+                           .typlen = sizeof(itree),
+                           .typbyval = false,
+                           .typalign = TYPALIGN_INT};
+
+    return array_create_iterator(array, 0, &meta);
+}
+
+/**
+ * The first element of array for which pred holds, NULL if there is none.
+ * The result points into the array.
+ */
+static const itree *itree_array_find(ArrayType *array, itree_array_pred pred, const void *arg) {
+    ArrayIterator iterator = itree_array_iterator(array);
+    const itree *found = NULL;
+    Datum value;
+    bool isnull;
+
+    while (array_iterate(iterator, &value, &isnull)) {
+        if (!isnull && pred(DatumGetITree(value), arg)) {
+            found = DatumGetITree(value);
+            break;
+        }
+    }
+    array_free_iterator(iterator);
+    return found;
+}
+
+/**
+ * The first element for which pred holds as a new itree value.
+ */
+static Datum itree_array_first(FunctionCallInfo fcinfo, ArrayType *array, itree_array_pred pred, const void *arg) {
+    const itree *found = itree_array_find(array, pred, arg);
+    itree *result;
+
+    if (found == NULL) {
+        PG_RETURN_NULL();
+    }
+    result = (itree *) palloc(sizeof(itree));
+    itree_canonical_copy(found, result);
+    PG_RETURN_ITREE(result);
+}
+
+PG_FUNCTION_INFO_V1(itree_array_has_ancestor);
+Datum itree_array_has_ancestor(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    itree *tree = PG_GETARG_ITREE(1);
+
+    PG_RETURN_BOOL(itree_array_find(array, itree_elem_is_ancestor, tree) != NULL);
+}
+
+PG_FUNCTION_INFO_V1(itree_is_descendant_array);
+Datum itree_is_descendant_array(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+
+    PG_RETURN_BOOL(itree_array_find(array, itree_elem_is_ancestor, tree) != NULL);
+}
+
+PG_FUNCTION_INFO_V1(itree_array_has_descendant);
+Datum itree_array_has_descendant(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    itree_prefix_matcher matcher;
+
+    itree_prefix_matcher_init(PG_GETARG_ITREE(1), &matcher);
+    PG_RETURN_BOOL(itree_array_find(array, itree_elem_is_descendant, &matcher) != NULL);
+}
+
+PG_FUNCTION_INFO_V1(itree_is_ancestor_array);
+Datum itree_is_ancestor_array(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+    itree_prefix_matcher matcher;
+
+    itree_prefix_matcher_init(PG_GETARG_ITREE(0), &matcher);
+    PG_RETURN_BOOL(itree_array_find(array, itree_elem_is_descendant, &matcher) != NULL);
+}
+
+PG_FUNCTION_INFO_V1(itree_array_matches);
+Datum itree_array_matches(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    iquery *query = PG_GETARG_IQUERY(1);
+
+    PG_RETURN_BOOL(itree_array_find(array, itree_elem_matches, query) != NULL);
+}
+
+PG_FUNCTION_INFO_V1(iquery_matches_array);
+Datum iquery_matches_array(PG_FUNCTION_ARGS) {
+    iquery *query = PG_GETARG_IQUERY(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+
+    PG_RETURN_BOOL(itree_array_find(array, itree_elem_matches, query) != NULL);
+}
+
+/**
+ * itree[] ?@> itree: the first element that is an ancestor of the itree.
+ * '{1.3, 1.2, 1}' ?@> '1.2.5' → 1.2
+ */
+PG_FUNCTION_INFO_V1(itree_array_first_ancestor);
+Datum itree_array_first_ancestor(PG_FUNCTION_ARGS) {
+    return itree_array_first(fcinfo, PG_GETARG_ARRAYTYPE_P(0), itree_elem_is_ancestor, PG_GETARG_ITREE(1));
+}
+
+/**
+ * itree[] ?<@ itree: the first element that is a descendant of the itree.
+ * '{2.1, 1.2.5, 1.2}' ?<@ '1.2' → 1.2.5
+ */
+PG_FUNCTION_INFO_V1(itree_array_first_descendant);
+Datum itree_array_first_descendant(PG_FUNCTION_ARGS) {
+    itree_prefix_matcher matcher;
+
+    itree_prefix_matcher_init(PG_GETARG_ITREE(1), &matcher);
+    return itree_array_first(fcinfo, PG_GETARG_ARRAYTYPE_P(0), itree_elem_is_descendant, &matcher);
+}
+
+/**
+ * itree[] ?~ iquery: the first element that matches the iquery.
+ * '{2.1, 1.2.5}' ?~ '1.*' → 1.2.5
+ */
+PG_FUNCTION_INFO_V1(itree_array_first_match);
+Datum itree_array_first_match(PG_FUNCTION_ARGS) {
+    return itree_array_first(fcinfo, PG_GETARG_ARRAYTYPE_P(0), itree_elem_matches, PG_GETARG_IQUERY(1));
+}
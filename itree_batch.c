@@ -0,0 +1,96 @@
+/**
+ * Batch subtree filters: one call tests many itree values against one prefix and returns a bit string,
+ * bit i set when value i is a descendant of the prefix (or equal to it).
+ * itree_descendant_bitmap(itree[], itree)  the elements of an array, NULL elements give 0
+ * itree_descendant_bitmap(bytea, itree)    a packed batch of itree_pack(), 18 bytes per value
+ *
+ * The prefix is prepared once, every value is then compared with two 8 byte word operations,
+ * see itree_prefix_matcher_test().
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "utils/array.h"
+#include "utils/varbit.h"
+#include "itree.h"
+
+static VarBit *itree_bitmap_alloc(int nbits) {
+    int len = VARBITTOTALLEN(nbits);
+    VarBit *result = (VarBit *) palloc0(len);
+
+    SET_VARSIZE(result, len);
+    VARBITLEN(result) = nbits;
+    return result;
+}
+
+/**
+ * itree_pack ( itree[] ) → bytea
+ * The canonical elements back to back in the 18 byte in-memory layout, the input of the bytea batch functions.
+ * itree_pack('{1.2, 1.3}') → 36 bytes
+ */
+PG_FUNCTION_INFO_V1(itree_pack);
+Datum itree_pack(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    int n = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+    bytea *result = (bytea *) palloc(VARHDRSZ + n * sizeof(itree));
+    itree *packed = (itree *) VARDATA(result);
+    Datum *elems;
+    bool *nulls;
+    int nelems;
+
+    deconstruct_array(array, ARR_ELEMTYPE(array), sizeof(itree), false, TYPALIGN_INT, &elems, &nulls, &nelems);
+    for (int i = 0; i < nelems; i++) {
+        if (nulls[i]) {
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                            errmsg("array must not contain nulls")));
+        }
+        itree_canonical_copy(DatumGetITree(elems[i]), &packed[i]);
+    }
+    SET_VARSIZE(result, VARHDRSZ + nelems * sizeof(itree));
+    PG_RETURN_BYTEA_P(result);
+}
+
+/**
+ * itree_descendant_bitmap ( itree[], itree ) → varbit
+ * itree_descendant_bitmap('{1.2.3, 2, 1.2, NULL}', '1.2') → 1010
+ */
+PG_FUNCTION_INFO_V1(itree_array_descendant_bitmap);
+Datum itree_array_descendant_bitmap(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    VarBit *result = itree_bitmap_alloc(ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)));
+    bits8 *bits = VARBITS(result);
+    ArrayIterator iterator = itree_array_iterator(array);
+    itree_prefix_matcher matcher;
+    Datum value;
+    bool isnull;
+
+    itree_prefix_matcher_init(PG_GETARG_ITREE(1), &matcher);
+    for (int i = 0; array_iterate(iterator, &value, &isnull); i++) {
+        if (!isnull && itree_prefix_matcher_test(&matcher, DatumGetITree(value))) {
+            bits[i / 8] |= (bits8) (0x80 >> (i % 8));
+        }
+    }
+    array_free_iterator(iterator);
+    PG_RETURN_VARBIT_P(result);
+}
+
+/**
+ * itree_descendant_bitmap ( bytea, itree ) → varbit
+ * Only the length of the batch is checked, as for the storage of the itree type the bytes are trusted.
+ * itree_descendant_bitmap(itree_pack('{1.2.3, 2, 1.2}'), '1.2') → 101
+ */
+PG_FUNCTION_INFO_V1(itree_packed_descendant_bitmap);
+Datum itree_packed_descendant_bitmap(PG_FUNCTION_ARGS) {
+    bytea *batch = PG_GETARG_BYTEA_PP(0);
+    int size = VARSIZE_ANY_EXHDR(batch);
+    VarBit *result;
+    itree_prefix_matcher matcher;
+
+    if (size % sizeof(itree) != 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("packed itree batch of %d bytes is not a multiple of %d bytes", size, (int) sizeof(itree))));
+    }
+    result = itree_bitmap_alloc(size / sizeof(itree));
+    itree_prefix_matcher_init(PG_GETARG_ITREE(1), &matcher);
+    itree_prefix_matcher_batch(&matcher, (const itree *) VARDATA_ANY(batch), size / sizeof(itree), VARBITS(result));
+    PG_RETURN_VARBIT_P(result);
+}
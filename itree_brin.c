@@ -0,0 +1,133 @@
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/brin_internal.h" // For BrinDesc and BrinOpcInfo
+#include "access/brin_tuple.h"    // For BrinValues
+#include "access/skey.h"          // For ScanKey
+#include "access/stratnum.h"      // For StrategyNumber
+#include "utils/typcache.h"
+#include "itree.h"
+
+/**
+ * BRIN support for itree beyond minmax: the summary of a block range is the longest common prefix
+ * of its values, like a single itree_lca() per range. Every value of the range is that prefix or below it,
+ * so a range is skipped when the prefix and the queried itree are on different branches.
+ * That answers <@ and ~ like minmax does, and also @>, which minmax cannot:
+ * the ancestors of an itree are not one range in btree order, but they all lie on the path to it.
+ *
+ * The summary only gets shorter, a range of unrelated values summarizes to the empty itree and matches everything,
+ * so the opclass pays off when the table is loaded in subtree order, as minmax does when it is loaded in btree order.
+ *
+ * Strategy numbers follow the itree GiST opclass:
+ * 3 =, 10 @>, 11 <@, 12 ~ (itree, iquery)
+ */
+#define ITREE_BRIN_ANCESTOR_STRATEGY   10
+#define ITREE_BRIN_DESCENDANT_STRATEGY 11
+#define ITREE_BRIN_MATCH_STRATEGY      12
+
+/**
+ * FUNCTION 1 BrinOpcInfo *opcInfo(Oid type_oid)
+ * One stored itree per range, NULL values are left to BRIN.
+ */
+PG_FUNCTION_INFO_V1(itree_brin_prefix_opcinfo);
+Datum itree_brin_prefix_opcinfo(PG_FUNCTION_ARGS) {
+    Oid typoid = PG_GETARG_OID(0);
+    BrinOpcInfo *result = (BrinOpcInfo *) palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+
+    result->oi_nstored = 1;
+    result->oi_regular_nulls = true;
+    result->oi_typcache[0] = lookup_type_cache(typoid, 0);
+
+    PG_RETURN_POINTER(result);
+}
+
+/**
+ * Replaces the summary of column by the first len bytes of tree.
+ */
+static void itree_brin_set_summary(BrinValues *column, const itree *tree, int len) {
+    itree *summary = (itree *) palloc(sizeof(itree));
+
+    itree_prefix_copy(tree, len, summary);
+    if (!column->bv_allnulls) {
+        pfree(DatumGetPointer(column->bv_values[0]));
+    }
+    column->bv_values[0] = ITreeGetDatum(summary);
+    column->bv_allnulls = false;
+}
+
+/**
+ * FUNCTION 2 bool addValue(BrinDesc *bdesc, BrinValues *column, Datum newval, bool isnull)
+ * The summary is cut back to the prefix it shares with the new value. True if it changed.
+ */
+PG_FUNCTION_INFO_V1(itree_brin_prefix_add_value);
+Datum itree_brin_prefix_add_value(PG_FUNCTION_ARGS) {
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    itree *value = PG_GETARG_ITREE(2);
+    itree *summary;
+    int len;
+
+    if (column->bv_allnulls) {
+        itree_brin_set_summary(column, value, itree_packed_len(value));
+        PG_RETURN_BOOL(true);
+    }
+
+    summary = DatumGetITree(column->bv_values[0]);
+    len = itree_packed_lcp_len(summary, value);
+    if (len == itree_packed_len(summary)) {
+        PG_RETURN_BOOL(false);
+    }
+    itree_brin_set_summary(column, summary, len);
+    PG_RETURN_BOOL(true);
+}
+
+/**
+ * True if the subtree of a and the subtree of b overlap: one of them is an ancestor of the other.
+ */
+static bool itree_brin_on_one_path(const itree *a, const itree *b) {
+    return itree_packed_is_prefix(a, b) || itree_packed_is_prefix(b, a);
+}
+
+/**
+ * FUNCTION 3 bool consistent(BrinDesc *bdesc, BrinValues *column, ScanKey key)
+ * False when no value below the summary prefix can satisfy the key.
+ */
+PG_FUNCTION_INFO_V1(itree_brin_prefix_consistent);
+Datum itree_brin_prefix_consistent(PG_FUNCTION_ARGS) {
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    ScanKey key = (ScanKey) PG_GETARG_POINTER(2);
+    itree *summary = DatumGetITree(column->bv_values[0]);
+    itree prefix;
+
+    switch (key->sk_strategy) {
+        case BTEqualStrategyNumber:
+        case ITREE_BRIN_ANCESTOR_STRATEGY:
+            // the value and all its ancestors in the range are below the summary
+            PG_RETURN_BOOL(itree_packed_is_prefix(summary, DatumGetITree(key->sk_argument)));
+        case ITREE_BRIN_DESCENDANT_STRATEGY:
+            PG_RETURN_BOOL(itree_brin_on_one_path(summary, DatumGetITree(key->sk_argument)));
+        case ITREE_BRIN_MATCH_STRATEGY:
+            // every match starts with the fixed leading levels of the iquery
+            iquery_fixed_prefix(DatumGetIQuery(key->sk_argument), &prefix);
+            PG_RETURN_BOOL(itree_brin_on_one_path(summary, &prefix));
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", key->sk_strategy);
+            PG_RETURN_BOOL(false); // keep compiler quiet
+    }
+}
+
+/**
+ * FUNCTION 4 void union(BrinDesc *bdesc, BrinValues *a, BrinValues *b)
+ * The common prefix of both summaries, stored in a. BRIN has handled the all-NULL ranges.
+ */
+PG_FUNCTION_INFO_V1(itree_brin_prefix_union);
+Datum itree_brin_prefix_union(PG_FUNCTION_ARGS) {
+    BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+    BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+    itree *a = DatumGetITree(col_a->bv_values[0]);
+    itree *b = DatumGetITree(col_b->bv_values[0]);
+    int len = itree_packed_lcp_len(a, b);
+
+    if (len < itree_packed_len(a)) {
+        itree_brin_set_summary(col_a, a, len);
+    }
+    PG_RETURN_VOID();
+}
@@ -0,0 +1,286 @@
+/**
+ * Closure tables of an itree column, kept up to date by statement level triggers.
+ * The closure table has a row per node on the path of any value: the rows at the node (self_count)
+ * and at the node or below it (subtree_count), with an optional bigint measure summed the same way.
+ * "How many entities under 1.2" is then one primary key lookup instead of a subtree scan.
+ * itree_closure_create() in itree--1.0--1.1.sql creates and fills the table and installs the triggers.
+ *
+ * The trigger reads the transition tables of the statement, adds up the changes per node in a hash table
+ * and merges them with one INSERT ... ON CONFLICT, whatever the number of changed rows.
+ * Nodes are merged in btree order, so concurrent statements lock the closure rows in the same order.
+ * An UPDATE that does not change the column adds +1 and -1 to the same nodes and merges nothing.
+ *
+ * Trigger arguments: the itree column, the closure table (qualified and quoted) and optionally the measure column.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "common/int.h"
+#include "executor/spi.h"
+#include "executor/tuptable.h"
+#include "lib/stringinfo.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
+#include "itree.h"
+
+typedef struct {
+    itree node;             // hash key, canonical
+    int64 self_count;       // change of the rows at the node
+    int64 subtree_count;    // change of the rows at the node or below
+    int64 self_sum;
+    int64 subtree_sum;
+} itree_closure_delta;
+
+typedef struct {
+    int itree_attnum;
+    int measure_attnum;     // 0 without a measure
+    Oid measure_type;
+    HTAB *deltas;
+} itree_closure_state;
+
+static int64 itree_closure_add_s64(int64 a, int64 b) {
+    int64 result;
+
+    if (pg_add_s64_overflow(a, b, &result)) {
+        ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                        errmsg("itree closure measure out of range")));
+    }
+    return result;
+}
+
+/**
+ * Adds sign times one row of value and measure to the node of value and to each of its ancestors.
+ */
+static void itree_closure_add(itree_closure_state *state, const itree *value, int64 sign, int64 measure) {
+    itree nodes[ITREE_MAX_LEVELS];
+    int n = itree_prefix_keys(value, nodes);
+
+    measure = sign < 0 ? -measure : measure;
+    for (int i = 0; i < n; i++) {
+        bool found;
+        itree_closure_delta *delta = hash_search(state->deltas, &nodes[i], HASH_ENTER, &found);
+
+        if (!found) {
+            delta->self_count = delta->subtree_count = delta->self_sum = delta->subtree_sum = 0;
+        }
+        delta->subtree_count += sign;
+        delta->subtree_sum = itree_closure_add_s64(delta->subtree_sum, measure);
+        if (i == n - 1) {
+            delta->self_count += sign;
+            delta->self_sum = itree_closure_add_s64(delta->self_sum, measure);
+        }
+    }
+}
+
+static int64 itree_closure_measure(itree_closure_state *state, TupleTableSlot *slot) {
+    bool isnull;
+    Datum value;
+
+    if (state->measure_attnum == 0) {
+        return 0;
+    }
+    value = slot_getattr(slot, state->measure_attnum, &isnull);
+    if (isnull) {
+        return 0;
+    }
+    switch (state->measure_type) {
+        case INT2OID:
+            return DatumGetInt16(value);
+        case INT4OID:
+            return DatumGetInt32(value);
+        default:
+            return DatumGetInt64(value);
+    }
+}
+
+/**
+ * Adds the rows of a transition table with sign +1 (new rows) or -1 (old rows).
+ * The table is read with its own read pointer, like a NamedTuplestoreScan, other readers are not moved.
+ */
+static void itree_closure_scan(itree_closure_state *state, Tuplestorestate *rows, TupleDesc tupdesc, int64 sign) {
+    TupleTableSlot *slot;
+    int readptr;
+
+    if (rows == NULL) {
+        return;
+    }
+    slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+    readptr = tuplestore_alloc_read_pointer(rows, EXEC_FLAG_REWIND);
+    tuplestore_select_read_pointer(rows, readptr);
+    tuplestore_rescan(rows);
+    while (tuplestore_gettupleslot(rows, true, false, slot)) {
+        bool isnull;
+        Datum value = slot_getattr(slot, state->itree_attnum, &isnull);
+
+        if (!isnull) {
+            itree_closure_add(state, DatumGetITree(value), sign, itree_closure_measure(state, slot));
+        }
+    }
+    tuplestore_select_read_pointer(rows, 0);
+    ExecDropSingleTupleTableSlot(slot);
+}
+
+static int itree_closure_delta_cmp(const void *a, const void *b) {
+    return itree_packed_cmp(&(*(itree_closure_delta *const *) a)->node, &(*(itree_closure_delta *const *) b)->node);
+}
+
+static Datum itree_closure_int8_array(Datum *values, int n) {
+    return PointerGetDatum(construct_array(values, n, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, TYPALIGN_DOUBLE));
+}
+
+/**
+ * One upsert of all non zero deltas, then one delete of the nodes left without rows.
+ */
+static void itree_closure_merge(itree_closure_state *state, const char *closure, Oid itree_type, const char *schema) {
+    long total = hash_get_num_entries(state->deltas);
+    itree_closure_delta **changed = palloc(Max(total, 1) * sizeof(itree_closure_delta *));
+    itree_closure_delta *delta;
+    HASH_SEQ_STATUS scan;
+    bool removes = false;
+    int n = 0;
+    Datum *nodes, *self_counts, *subtree_counts, *self_sums, *subtree_sums;
+    Datum args[5];
+    Oid argtypes[5] = {get_array_type(itree_type), INT8ARRAYOID, INT8ARRAYOID, INT8ARRAYOID, INT8ARRAYOID};
+    StringInfoData sql;
+
+    hash_seq_init(&scan, state->deltas);
+    while ((delta = hash_seq_search(&scan)) != NULL) {
+        if (delta->self_count != 0 || delta->subtree_count != 0 || delta->self_sum != 0 || delta->subtree_sum != 0) {
+            changed[n++] = delta;
+            removes |= delta->subtree_count < 0;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+    qsort(changed, n, sizeof(itree_closure_delta *), itree_closure_delta_cmp);
+
+    nodes = palloc(n * sizeof(Datum));
+    self_counts = palloc(n * sizeof(Datum));
+    subtree_counts = palloc(n * sizeof(Datum));
+    self_sums = palloc(n * sizeof(Datum));
+    subtree_sums = palloc(n * sizeof(Datum));
+    for (int i = 0; i < n; i++) {
+        nodes[i] = ITreeGetDatum(&changed[i]->node);
+        self_counts[i] = Int64GetDatum(changed[i]->self_count);
+        subtree_counts[i] = Int64GetDatum(changed[i]->subtree_count);
+        self_sums[i] = Int64GetDatum(changed[i]->self_sum);
+        subtree_sums[i] = Int64GetDatum(changed[i]->subtree_sum);
+    }
+    args[0] = PointerGetDatum(construct_array(nodes, n, itree_type, sizeof(itree), false, TYPALIGN_INT));
+    args[1] = itree_closure_int8_array(self_counts, n);
+    args[2] = itree_closure_int8_array(subtree_counts, n);
+    args[3] = itree_closure_int8_array(self_sums, n);
+    args[4] = itree_closure_int8_array(subtree_sums, n);
+
+    initStringInfo(&sql);
+    if (state->measure_attnum == 0) {
+        appendStringInfo(&sql,
+                         "INSERT INTO %s AS c (node, self_count, subtree_count) "
+                         "SELECT * FROM unnest($1, $2, $3) "
+                         "ON CONFLICT (node) DO UPDATE SET self_count = c.self_count + excluded.self_count, "
+                         "subtree_count = c.subtree_count + excluded.subtree_count",
+                         closure);
+    } else {
+        appendStringInfo(&sql,
+                         "INSERT INTO %s AS c (node, self_count, subtree_count, self_sum, subtree_sum) "
+                         "SELECT * FROM unnest($1, $2, $3, $4, $5) "
+                         "ON CONFLICT (node) DO UPDATE SET self_count = c.self_count + excluded.self_count, "
+                         "subtree_count = c.subtree_count + excluded.subtree_count, "
+                         "self_sum = c.self_sum + excluded.self_sum, subtree_sum = c.subtree_sum + excluded.subtree_sum",
+                         closure);
+    }
+    if (SPI_execute_with_args(sql.data, state->measure_attnum == 0 ? 3 : 5, argtypes, args, NULL, false, 0) != SPI_OK_INSERT) {
+        elog(ERROR, "itree_closure_trigger: merge into %s failed", closure);
+    }
+
+    if (removes) {
+        // the operator of the extension schema, which need not be on the search_path
+        resetStringInfo(&sql);
+        appendStringInfo(&sql, "DELETE FROM %s WHERE node OPERATOR(%s.=) ANY ($1) AND subtree_count = 0", closure, schema);
+        if (SPI_execute_with_args(sql.data, 1, argtypes, args, NULL, false, 0) != SPI_OK_DELETE) {
+            elog(ERROR, "itree_closure_trigger: delete from %s failed", closure);
+        }
+    }
+}
+
+/**
+ * itree_closure_trigger(column, closure [, measure]): AFTER INSERT, UPDATE, DELETE or TRUNCATE FOR EACH STATEMENT,
+ * with REFERENCING NEW TABLE and OLD TABLE as the event has them.
+ */
+PG_FUNCTION_INFO_V1(itree_closure_trigger);
+Datum itree_closure_trigger(PG_FUNCTION_ARGS) {
+    TriggerData *trigdata = (TriggerData *) fcinfo->context;
+    Trigger *trigger;
+    TupleDesc tupdesc;
+    Oid namespace = get_func_namespace(fcinfo->flinfo->fn_oid);
+    const char *schema = quote_identifier(get_namespace_name(namespace));
+    Oid itree_type;
+    itree_closure_state state = {0};
+    HASHCTL ctl;
+
+    if (!CALLED_AS_TRIGGER(fcinfo)) {
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                        errmsg("itree_closure_trigger: not called by trigger manager")));
+    }
+    if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) || !TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event)) {
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                        errmsg("itree_closure_trigger: must be fired AFTER ... FOR EACH STATEMENT")));
+    }
+    trigger = trigdata->tg_trigger;
+    if (trigger->tgnargs != 2 && trigger->tgnargs != 3) {
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                        errmsg("itree_closure_trigger: expected arguments column, closure table and optional measure column")));
+    }
+
+    SPI_connect();
+    if (TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event)) {
+        if (SPI_execute(psprintf("TRUNCATE %s", trigger->tgargs[1]), false, 0) != SPI_OK_UTILITY) {
+            elog(ERROR, "itree_closure_trigger: truncate of %s failed", trigger->tgargs[1]);
+        }
+        SPI_finish();
+        return PointerGetDatum(NULL);
+    }
+
+    tupdesc = RelationGetDescr(trigdata->tg_relation);
+    itree_type = GetSysCacheOid2(TYPENAMENSP, Anum_pg_type_oid, CStringGetDatum("itree"), ObjectIdGetDatum(namespace));
+    state.itree_attnum = SPI_fnumber(tupdesc, trigger->tgargs[0]);
+    if (state.itree_attnum <= 0 || SPI_gettypeid(tupdesc, state.itree_attnum) != itree_type) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("itree_closure_trigger: \"%s\" is not an itree column of \"%s\"",
+                               trigger->tgargs[0], RelationGetRelationName(trigdata->tg_relation))));
+    }
+    if (trigger->tgnargs == 3) {
+        state.measure_attnum = SPI_fnumber(tupdesc, trigger->tgargs[2]);
+        state.measure_type = state.measure_attnum > 0 ? SPI_gettypeid(tupdesc, state.measure_attnum) : InvalidOid;
+        if (state.measure_type != INT2OID && state.measure_type != INT4OID && state.measure_type != INT8OID) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("itree_closure_trigger: \"%s\" is not a smallint, integer or bigint column of \"%s\"",
+                                   trigger->tgargs[2], RelationGetRelationName(trigdata->tg_relation))));
+        }
+    }
+
+    if ((!TRIGGER_FIRED_BY_DELETE(trigdata->tg_event) && trigdata->tg_newtable == NULL) ||
+        (!TRIGGER_FIRED_BY_INSERT(trigdata->tg_event) && trigdata->tg_oldtable == NULL)) {
+        ereport(ERROR, (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                        errmsg("itree_closure_trigger: the trigger needs REFERENCING NEW TABLE and OLD TABLE of its event")));
+    }
+
+    ctl.keysize = sizeof(itree);
+    ctl.entrysize = sizeof(itree_closure_delta);
+    ctl.hcxt = CurrentMemoryContext;
+    state.deltas = hash_create("itree closure deltas", 256, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+    itree_closure_scan(&state, trigdata->tg_oldtable, tupdesc, -1);
+    itree_closure_scan(&state, trigdata->tg_newtable, tupdesc, 1);
+    itree_closure_merge(&state, trigger->tgargs[1], itree_type, schema);
+
+    hash_destroy(state.deltas);
+    SPI_finish();
+    return PointerGetDatum(NULL);
+}
@@ -0,0 +1,938 @@
+/**
+ * Core routines of the packed itree form, shared by the module and the standalone benchmark.
+ * See itree_core.h: no fmgr, no palloc, no ereport in here.
+ */
+#include "c.h"
+#include "port/pg_bitutils.h"
+#include "port/pg_bswap.h"
+#include "itree_core.h"
+
+/**
+ * Decode the segments of an itree along the control bits, returns the number of segments.
+ */
+int itree_get_segments(const itree *tree, uint16_t *segments) {
+    int len = itree_packed_len(tree);
+    uint32 ctrl = ITREE_CONTROL_WORD(tree) | (1u << len);
+    int seg_count = 0;
+
+    for (int pos = 0; pos < len; pos++) {
+        uint16_t val = tree->data[pos];
+
+        // a segment start without a start bit after it has a continuation byte
+        if (!(ctrl & (1u << (pos + 1)))) {
+            val = (uint16_t) ((val << 8) | tree->data[++pos]);
+        }
+        segments[seg_count++] = val;
+    }
+    return seg_count;
+}
+
+/**
+ * Encode count segments of 1..65535 into dst in canonical form.
+ * Returns false when they do not fit in the data bytes, dst is undefined then.
+ */
+bool itree_set_segments(const uint16_t *segments, int count, itree *dst) {
+    uint32 ctrl = 0xFFFF;
+    int byte_pos = 0;
+
+    memset(dst->data, 0, sizeof(dst->data));
+    for (int i = 0; i < count; i++) {
+        if (segments[i] > 255) {
+            if (byte_pos + 2 > ITREE_MAX_LEVELS) {
+                return false;
+            }
+            dst->data[byte_pos] = (uint8_t) (segments[i] >> 8);
+            dst->data[byte_pos + 1] = (uint8_t) (segments[i] & 0xFF);
+            ctrl &= ~(1u << (byte_pos + 1));
+            byte_pos += 2;
+        } else {
+            if (byte_pos + 1 > ITREE_MAX_LEVELS) {
+                return false;
+            }
+            dst->data[byte_pos++] = (uint8_t) segments[i];
+        }
+    }
+    dst->control[0] = (uint8_t) (ctrl & 0xFF);
+    dst->control[1] = (uint8_t) (ctrl >> 8);
+    return true;
+}
+
+/**
+ * Parse the text form in one pass: the decimal digits of each segment are accumulated
+ * and stored right away, control bits are collected in a word and stored at the end.
+ * Every segment must be 1..65535, separated by a single '.', with nothing before or after,
+ * and all segments must fit in the 16 data bytes.
+ * On error error_at points at the offending segment or character and nsegments counts
+ * the segments up to and including the offending one.
+ */
+itree_parse_status itree_parse(const char *input, itree *dst, const char **error_at, int *nsegments) {
+    const char *ptr = input;
+    uint32 ctrl = 0xFFFF;
+    int byte_pos = 0;
+
+    *nsegments = 0;
+    memset(dst->data, 0, sizeof(dst->data));
+
+    for (;;) {
+        const char *digits = ptr;
+        uint32 val = 0;
+
+        // stop accumulating once out of range, the digits are still consumed
+        while (*ptr >= '0' && *ptr <= '9') {
+            if (val <= 65535) {
+                val = val * 10 + (uint32) (*ptr - '0');
+            }
+            ptr++;
+        }
+        (*nsegments)++;
+
+        if (ptr == digits) {
+            *error_at = ptr;
+            return (*ptr == '.' || *ptr == '\0') ? ITREE_PARSE_EMPTY_SEGMENT : ITREE_PARSE_UNEXPECTED_CHAR;
+        }
+        if (val == 0 || val > 65535) {
+            *error_at = digits;
+            return ITREE_PARSE_OUT_OF_RANGE;
+        }
+        if (byte_pos + (val > 255 ? 2 : 1) > ITREE_MAX_LEVELS) {
+            *error_at = digits;
+            return ITREE_PARSE_TOO_LONG;
+        }
+
+        if (val > 255) {
+            // 2-byte segment: high then low byte, the second byte is a continuation
+            dst->data[byte_pos] = (uint8_t) (val >> 8);
+            dst->data[byte_pos + 1] = (uint8_t) (val & 0xFF);
+            ctrl &= ~(1u << (byte_pos + 1));
+            byte_pos += 2;
+        } else {
+            dst->data[byte_pos++] = (uint8_t) val;
+        }
+
+        if (*ptr == '\0') {
+            break;
+        }
+        if (*ptr != '.') {
+            *error_at = ptr;
+            return ITREE_PARSE_UNEXPECTED_CHAR;
+        }
+        ptr++;
+    }
+
+    dst->control[0] = (uint8_t) (ctrl & 0xFF);
+    dst->control[1] = (uint8_t) (ctrl >> 8);
+    return ITREE_PARSE_OK;
+}
+
+/**
+ * Write the decimal digits of a segment, 1..65535, returns the number of characters.
+ */
+static inline int itree_format_segment(uint32 val, char *dst) {
+    int len = val >= 10000 ? 5 : val >= 1000 ? 4 : val >= 100 ? 3 : val >= 10 ? 2 : 1;
+
+    for (int i = len - 1; i > 0; i--) {
+        dst[i] = (char) ('0' + val % 10);
+        val /= 10;
+    }
+    dst[0] = (char) ('0' + val);
+    return len;
+}
+
+/**
+ * Format the text form straight from the packed bytes into dst, which must hold
+ * ITREE_MAX_TEXT_LEN + 1 characters. Returns the length without the terminating 0.
+ */
+int itree_format(const itree *tree, char *dst) {
+    int len = itree_packed_len(tree);
+    uint32 ctrl = ITREE_CONTROL_WORD(tree) | (1u << len);
+    char *ptr = dst;
+
+    for (int pos = 0; pos < len; pos++) {
+        uint32 val = tree->data[pos];
+
+        if (!(ctrl & (1u << (pos + 1)))) {
+            val = (val << 8) | tree->data[++pos];
+        }
+        if (ptr != dst) {
+            *ptr++ = '.';
+        }
+        ptr += itree_format_segment(val, ptr);
+    }
+    *ptr = '\0';
+    return (int) (ptr - dst);
+}
+
+/**
+ * The prefixes of tree cut after each of its segments, shortest first, in canonical form.
+ * The last one is tree itself. keys must hold ITREE_MAX_LEVELS values, returns the number of prefixes.
+ */
+int itree_prefix_keys(const itree *tree, itree *keys) {
+    uint32 ends = itree_packed_ends(tree);
+    int n = 0;
+
+    for (; ends; ends &= ends - 1) {
+        itree_prefix_copy(tree, pg_rightmost_one_pos32(ends), &keys[n++]);
+    }
+    return n;
+}
+
+/**
+ * 32 bit fingerprints of the prefixes of tree, shortest first, like the keys of itree_prefix_keys().
+ * Each one folds the next segment into the fingerprint of the parent, so equal prefixes have equal
+ * fingerprints whatever value they come from. fingerprints must hold ITREE_MAX_LEVELS values,
+ * returns the number of prefixes.
+ */
+int itree_prefix_fingerprints(const itree *tree, uint32 *fingerprints) {
+    uint16_t segments[ITREE_MAX_LEVELS];
+    int n = itree_get_segments(tree, segments);
+    uint64 h = ITREE_FINGERPRINT_SEED;
+
+    for (int i = 0; i < n; i++) {
+        // a multiply per level on 64 bits, the high half has taken in every bit of the chain
+        h = (h ^ segments[i]) * UINT64CONST(0x9E3779B97F4A7C15);
+        h ^= h >> 29;
+        fingerprints[i] = (uint32) (h >> 32);
+    }
+    return n;
+}
+
+/**
+ * Load 8 data bytes as a word with data[0] in the lowest byte on any platform.
+ */
+static inline uint64 itree_load_word(const uint8_t *bytes) {
+    uint64 word;
+
+    memcpy(&word, bytes, sizeof(word));
+#ifdef WORDS_BIGENDIAN
+    word = pg_bswap64(word);
+#endif
+    return word;
+}
+
+/**
+ * Collapse the high bit of every byte of a word into an 8 bit mask, bit i for byte i.
+ */
+static inline uint32 itree_byte_high_bits(uint64 word) {
+    return (uint32)((((word >> 7) & UINT64CONST(0x0101010101010101)) * UINT64CONST(0x0102040810204080)) >> 56);
+}
+
+/**
+ * Mask of the nonzero bytes of a word, bit i set when byte i is not 0.
+ */
+static inline uint32 itree_nonzero_bytes(uint64 word) {
+    const uint64 low7 = UINT64CONST(0x7F7F7F7F7F7F7F7F);
+
+    return itree_byte_high_bits(((word & low7) + low7) | word);
+}
+
+/**
+ * 16 bit mask of the data bytes equal to 0, bit i for data[i].
+ */
+uint32 itree_zero_byte_mask(const uint8_t *data) {
+    uint32 nonzero = itree_nonzero_bytes(itree_load_word(data)) |
+                     (itree_nonzero_bytes(itree_load_word(data + 8)) << 8);
+
+    return ~nonzero & 0xFFFF;
+}
+
+/**
+ * 16 bit mask of the data bytes that differ between a and b, bit i for data[i].
+ */
+uint32 itree_diff_byte_mask(const uint8_t *a, const uint8_t *b) {
+    return itree_nonzero_bytes(itree_load_word(a) ^ itree_load_word(b)) |
+           (itree_nonzero_bytes(itree_load_word(a + 8) ^ itree_load_word(b + 8)) << 8);
+}
+
+/**
+ * Number of used data bytes: position of the first 0 byte with a control bit of 1,
+ * the same end marker itree_get_segments() stops at.
+ */
+int itree_packed_len(const itree *tree) {
+    uint32 end = itree_zero_byte_mask(tree->data) & ITREE_CONTROL_WORD(tree);
+
+    return end ? pg_rightmost_one_pos32(end) : ITREE_MAX_LEVELS;
+}
+
+/**
+ * Copy the first nbytes data bytes of an itree in canonical form: control bits after them set to 1
+ * and data bytes after them set to 0, as init_itree() leaves them.
+ * nbytes must be at a segment boundary, e.g. itree_packed_len() or the end of a segment.
+ */
+void itree_prefix_copy(const itree *src, int nbytes, itree *dst) {
+    uint32 keep = (1u << nbytes) - 1;
+    uint32 ctrl = (ITREE_CONTROL_WORD(src) & keep) | (~keep & 0xFFFF);
+
+    dst->control[0] = (uint8_t)(ctrl & 0xFF);
+    dst->control[1] = (uint8_t)(ctrl >> 8);
+    memset(dst->data, 0, sizeof(dst->data));
+    memcpy(dst->data, src->data, nbytes);
+}
+
+/**
+ * Concatenate the first alen data bytes of a and the data bytes from..to of b into dst in canonical form.
+ * The control bits are cut and shifted as one word, nothing is decoded. All offsets must be at segment
+ * boundaries, e.g. itree_level_len() values. subpath is splice(a, 0, b, from, to), a || b is
+ * splice(a, len(a), b, 0, len(b)). Returns false when the result does not fit in the data bytes,
+ * dst is untouched then. dst must not overlap a or b.
+ */
+bool itree_splice_copy(const itree *a, int alen, const itree *b, int from, int to, itree *dst) {
+    int blen = to - from;
+    uint32 ctrl;
+
+    if (alen + blen > ITREE_MAX_LEVELS) {
+        return false;
+    }
+    ctrl = (ITREE_CONTROL_WORD(a) & ((1u << alen) - 1)) |
+           (((ITREE_CONTROL_WORD(b) >> from) & ((1u << blen) - 1)) << alen) |
+           (~((1u << (alen + blen)) - 1) & 0xFFFF);
+    dst->control[0] = (uint8_t) (ctrl & 0xFF);
+    dst->control[1] = (uint8_t) (ctrl >> 8);
+    memcpy(dst->data, a->data, alen);
+    memcpy(dst->data + alen, b->data + from, blen);
+    memset(dst->data + alen + blen, 0, ITREE_MAX_LEVELS - alen - blen);
+    return true;
+}
+
+/**
+ * Append one segment of 1..65535 to tree in canonical form.
+ * Returns false when it does not fit in the data bytes, dst is untouched then. dst must not overlap tree.
+ */
+bool itree_append_segment(const itree *tree, uint16_t segment, itree *dst) {
+    int len = itree_packed_len(tree);
+    uint32 ctrl = (ITREE_CONTROL_WORD(tree) & ((1u << len) - 1)) | (~((1u << len) - 1) & 0xFFFF);
+
+    if (len + (segment > 255 ? 2 : 1) > ITREE_MAX_LEVELS) {
+        return false;
+    }
+    memcpy(dst->data, tree->data, len);
+    memset(dst->data + len, 0, ITREE_MAX_LEVELS - len);
+    if (segment > 255) {
+        // 2-byte segment: high then low byte, the second byte is a continuation
+        dst->data[len] = (uint8_t) (segment >> 8);
+        dst->data[len + 1] = (uint8_t) (segment & 0xFF);
+        ctrl &= ~(1u << (len + 1));
+    } else {
+        dst->data[len] = (uint8_t) segment;
+    }
+    dst->control[0] = (uint8_t) (ctrl & 0xFF);
+    dst->control[1] = (uint8_t) (ctrl >> 8);
+    return true;
+}
+
+/**
+ * Copy an itree in its canonical form. Equal itree values have byte equal canonical forms.
+ */
+void itree_canonical_copy(const itree *src, itree *dst) {
+    itree_prefix_copy(src, itree_packed_len(src), dst);
+}
+
+/**
+ * Mask of the data bytes that start a segment, bit i for data[i], up to the end of the itree.
+ */
+uint32 itree_packed_starts(const itree *tree) {
+    return ITREE_CONTROL_WORD(tree) & ((1u << itree_packed_len(tree)) - 1);
+}
+
+/**
+ * Mask of the positions right after each segment: every segment start after data[0] and the end
+ * of the itree, bit i when a segment ends before data[i]. The prefix of level k is cut at the k-th bit.
+ * 0 for the empty itree.
+ */
+uint32 itree_packed_ends(const itree *tree) {
+    int len = itree_packed_len(tree);
+
+    return len == 0 ? 0 : (itree_packed_starts(tree) | (1u << len)) & ~1u;
+}
+
+/**
+ * Number of segments, counted from the control bits.
+ */
+int itree_packed_depth(const itree *tree) {
+    return pg_popcount32(itree_packed_starts(tree));
+}
+
+/**
+ * Number of data bytes of the lowest common ancestor of two itree values.
+ * Bytes are equal up to the first differing data byte or control bit, the common
+ * ancestor ends at the last position up to there where a segment ends in both.
+ */
+int itree_packed_lcp_len(const itree *a, const itree *b) {
+    uint32 a_ctrl = ITREE_CONTROL_WORD(a) | (1u << ITREE_MAX_LEVELS);
+    uint32 b_ctrl = ITREE_CONTROL_WORD(b) | (1u << ITREE_MAX_LEVELS);
+    int limit = Min(itree_packed_len(a), itree_packed_len(b));
+    uint32 diff = (itree_diff_byte_mask(a->data, b->data) | (a_ctrl ^ b_ctrl)) & ((1u << limit) - 1);
+    int same = diff ? pg_rightmost_one_pos32(diff) : limit;
+
+    // below same the control bits are equal, at same both must end a segment; position 0 always does
+    return pg_leftmost_one_pos32((a_ctrl & b_ctrl & ((2u << same) - 1)) | 1u);
+}
+
+/**
+ * Number of leading segments two itree values have in common.
+ */
+int itree_packed_lcp(const itree *a, const itree *b) {
+    return pg_popcount32(ITREE_CONTROL_WORD(a) & ((1u << itree_packed_lcp_len(a, b)) - 1));
+}
+
+/**
+ * Number of data bytes of the first levels segments, the whole itree when it has fewer levels.
+ */
+int itree_level_len(const itree *tree, int levels) {
+    uint32 ends = itree_packed_ends(tree);
+
+    if (ends == 0 || levels <= 0) {
+        return 0;
+    }
+    // drop the ends of the first levels - 1 segments, the lowest end left is the one wanted
+    for (int i = 1; i < levels && (ends & (ends - 1)); i++) {
+        ends &= ends - 1;
+    }
+    return pg_rightmost_one_pos32(ends);
+}
+
+/**
+ * True if prefix is an ancestor of tree or equal to it:
+ * same bytes and control bits up to the end of prefix, and a segment of tree starts right after.
+ */
+bool itree_packed_is_prefix(const itree *prefix, const itree *tree) {
+    int len = itree_packed_len(prefix);
+    uint32 keep = (1u << len) - 1;
+    uint32 tree_ctrl = ITREE_CONTROL_WORD(tree) | (1u << ITREE_MAX_LEVELS);
+
+    if (len > itree_packed_len(tree)) {
+        return false;
+    }
+    if ((itree_diff_byte_mask(prefix->data, tree->data) | (ITREE_CONTROL_WORD(prefix) ^ tree_ctrl)) & keep) {
+        return false;
+    }
+    return (tree_ctrl >> len) & 1;
+}
+
+/**
+ * Prepare the test tree <@ prefix for many values of tree: the end of prefix and its control bits
+ * are worked out once. prefix is copied, the matcher does not point to it.
+ */
+void itree_prefix_matcher_init(const itree *prefix, itree_prefix_matcher *matcher) {
+    itree_canonical_copy(prefix, &matcher->prefix);
+    matcher->len = itree_packed_len(prefix);
+    matcher->keep = (1u << matcher->len) - 1;
+    matcher->ctrl = ITREE_CONTROL_WORD(&matcher->prefix) & matcher->keep;
+}
+
+/**
+ * itree_packed_is_prefix() against a prepared prefix. The length of tree is not needed:
+ * if tree ended before the end of prefix, its end marker, a 0 byte with a start bit,
+ * would differ from the byte of prefix at that position.
+ */
+bool itree_prefix_matcher_test(const itree_prefix_matcher *matcher, const itree *tree) {
+    uint32 tree_ctrl = ITREE_CONTROL_WORD(tree) | (1u << ITREE_MAX_LEVELS);
+
+    if ((itree_diff_byte_mask(matcher->prefix.data, tree->data) | (matcher->ctrl ^ tree_ctrl)) & matcher->keep) {
+        return false;
+    }
+    return (tree_ctrl >> matcher->len) & 1;
+}
+
+/**
+ * Test n consecutive packed values against a prepared prefix and set the bits of the matches in bits,
+ * which must hold (n + 7) / 8 zeroed bytes. Value i is bit 7 - i % 8 of bits[i / 8], the bit string order.
+ * Returns the number of matches.
+ */
+int itree_prefix_matcher_batch(const itree_prefix_matcher *matcher, const itree *trees, int n, uint8_t *bits) {
+    int matches = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (itree_prefix_matcher_test(matcher, &trees[i])) {
+            bits[i / 8] |= (uint8_t) (0x80 >> (i % 8));
+            matches++;
+        }
+    }
+    return matches;
+}
+
+/**
+ * Tree distance: number of edges on the path between two nodes.
+ */
+int itree_packed_distance(const itree *a, const itree *b) {
+    return itree_packed_depth(a) + itree_packed_depth(b) - 2 * itree_packed_lcp(a, b);
+}
+
+/**
+ * Greatest descendant of tree in btree order: tree followed by as many 65535 segments as fit,
+ * and a last 255 segment when 1 byte is left. tree and its descendants are exactly the range
+ * [tree, itree_subtree_upper_copy(tree)], even when tree has no representable next sibling.
+ */
+void itree_subtree_upper_copy(const itree *tree, itree *dst) {
+    int len = itree_packed_len(tree);
+
+    itree_prefix_copy(tree, len, dst);
+    for (; len + 2 <= ITREE_MAX_LEVELS; len += 2) {
+        dst->data[len] = 0xFF;
+        dst->data[len + 1] = 0xFF;
+        dst->control[(len + 1) / 8] &= ~(1u << ((len + 1) % 8));
+    }
+    if (len < ITREE_MAX_LEVELS) {
+        dst->data[len] = 0xFF;
+    }
+}
+
+/**
+ * Order preserving 64 bit key of the leading segments.
+ * Segments are written as a prefix free byte code in big endian order:
+ * 1-byte segment 1..254 -> v, 255 -> 0xFF 0x00, 2-byte segment -> 0xFF hi lo (hi >= 1).
+ * The end of the itree is 0x00, so a prefix sorts first, and cutting the code
+ * at 8 bytes keeps key(a) <= key(b) for every a < b.
+ */
+uint64 itree_order_key(const itree *tree) {
+    uint32 ctrl = ITREE_CONTROL_WORD(tree) | (1u << ITREE_MAX_LEVELS);
+    int len = itree_packed_len(tree);
+    uint64 key = 0;
+    int shift = 64;
+    int pos = 0;
+
+#define ITREE_ORDER_KEY_PUSH(b) \
+    do { if (shift > 0) { shift -= 8; key |= (uint64) (b) << shift; } } while (0)
+
+    while (pos < len && shift > 0) {
+        if (!(ctrl & (1u << (pos + 1)))) {
+            ITREE_ORDER_KEY_PUSH(0xFF);
+            ITREE_ORDER_KEY_PUSH(tree->data[pos]);
+            ITREE_ORDER_KEY_PUSH(tree->data[pos + 1]);
+            pos += 2;
+        } else if (tree->data[pos] == 0xFF) {
+            ITREE_ORDER_KEY_PUSH(0xFF);
+            ITREE_ORDER_KEY_PUSH(0x00);
+            pos++;
+        } else {
+            ITREE_ORDER_KEY_PUSH(tree->data[pos]);
+            pos++;
+        }
+    }
+
+#undef ITREE_ORDER_KEY_PUSH
+
+    return key;
+}
+
+/**
+ * Compare two itree values on the packed form: -1 (a < b), 0 (a = b), 1 (a > b)
+ * Gives the order of the segment-wise compare without decoding:
+ * 1. Find the first data byte or control bit that differs before the shorter end.
+ * 2. A control bit of 1 against 0 there means a 1-byte segment against a 2-byte one
+ *    with the same high byte, the 1-byte segment is smaller.
+ * 3. A differing first byte of a segment: a 1-byte segment is smaller than a 2-byte one,
+ *    otherwise the bytes decide as the high byte comes first.
+ * 4. No difference: the shorter itree is a prefix and wins.
+ */
+int itree_packed_cmp(const itree *a, const itree *b) {
+    // bit 16 stands for the start of a segment after the last data byte
+    uint32 a_ctrl = ITREE_CONTROL_WORD(a) | (1u << ITREE_MAX_LEVELS);
+    uint32 b_ctrl = ITREE_CONTROL_WORD(b) | (1u << ITREE_MAX_LEVELS);
+    int a_len = itree_packed_len(a);
+    int b_len = itree_packed_len(b);
+    int limit = Min(a_len, b_len);
+    uint32 diff = (itree_diff_byte_mask(a->data, b->data) | (a_ctrl ^ b_ctrl)) & ((1u << limit) - 1);
+    uint32 bit;
+    int pos;
+
+    if (diff == 0) {
+        return (a_len > b_len) - (a_len < b_len);
+    }
+
+    pos = pg_rightmost_one_pos32(diff);
+    bit = 1u << pos;
+
+    if ((a_ctrl ^ b_ctrl) & bit) {
+        return (a_ctrl & bit) ? -1 : 1;
+    }
+
+    if (a_ctrl & bit) {
+        // both start a segment here: 2-byte segments have a continuation bit next
+        int a_wide = !(a_ctrl & (bit << 1));
+        int b_wide = !(b_ctrl & (bit << 1));
+
+        if (a_wide != b_wide) {
+            return a_wide ? 1 : -1;
+        }
+    }
+
+    return a->data[pos] < b->data[pos] ? -1 : 1;
+}
+
+/**
+ * Read the 9 bit symbol of data position pos from a key, see itree_key_encode().
+ */
+static inline uint32 itree_key_symbol(const itree_key *key, int pos) {
+    int bit = pos * 9;
+    uint32 window = ((uint32) key->bytes[bit / 8] << 8) | key->bytes[bit / 8 + 1];
+
+    return (window >> (7 - bit % 8)) & 0x1FF;
+}
+
+/**
+ * Encode an itree in the memcmp ordered key form. Every data position becomes a 9 bit symbol:
+ * a flag set where a 2-byte segment starts, then the data byte. The 16 symbols are written
+ * big endian over the 18 bytes, the end of the itree and all positions after it are 0 symbols.
+ * memcmp() of two keys is the itree_packed_cmp() of the values:
+ * at the first differing segment a 1-byte segment (flag 0) sorts before a 2-byte one (flag 1),
+ * equal flags leave it to the bytes, and an end (0) sorts before any segment, so a prefix comes first.
+ */
+void itree_key_encode(const itree *tree, itree_key *key) {
+    int len = itree_packed_len(tree);
+    uint32 ctrl = ITREE_CONTROL_WORD(tree) | (1u << len);
+
+    memset(key->bytes, 0, sizeof(key->bytes));
+    for (int pos = 0; pos < len; pos++) {
+        uint32 wide = (ctrl >> pos) & ~(ctrl >> (pos + 1)) & 1;
+        uint32 symbol = (wide << 8) | tree->data[pos];
+        int bit = pos * 9;
+
+        key->bytes[bit / 8] |= (uint8_t) (symbol >> (1 + bit % 8));
+        key->bytes[bit / 8 + 1] |= (uint8_t) (symbol << (7 - bit % 8));
+    }
+}
+
+/**
+ * Decode a key of itree_key_encode() into the canonical itree.
+ */
+void itree_key_decode(const itree_key *key, itree *dst) {
+    uint32 ctrl = 0xFFFF;
+    int pos = 0;
+
+    memset(dst->data, 0, sizeof(dst->data));
+    while (pos < ITREE_MAX_LEVELS) {
+        uint32 symbol = itree_key_symbol(key, pos);
+
+        // a 0 symbol where a segment starts is the end
+        if (symbol == 0) {
+            break;
+        }
+        dst->data[pos] = (uint8_t) symbol;
+        if ((symbol & 0x100) && pos + 1 < ITREE_MAX_LEVELS) {
+            dst->data[pos + 1] = (uint8_t) itree_key_symbol(key, pos + 1);
+            ctrl &= ~(1u << (pos + 1));
+            pos += 2;
+        } else {
+            pos++;
+        }
+    }
+    dst->control[0] = (uint8_t) (ctrl & 0xFF);
+    dst->control[1] = (uint8_t) (ctrl >> 8);
+}
+
+/**
+ * Number of data positions of the itree a key stands for, itree_packed_len() of the decoded value.
+ */
+int itree_key_len(const itree_key *key) {
+    int pos = 0;
+
+    while (pos < ITREE_MAX_LEVELS) {
+        uint32 symbol = itree_key_symbol(key, pos);
+
+        if (symbol == 0) {
+            break;
+        }
+        pos += (symbol & 0x100) ? 2 : 1;
+    }
+    return Min(pos, ITREE_MAX_LEVELS);
+}
+
+/**
+ * True if prefix is an ancestor of key or equal to it: the keys agree on the symbols of prefix.
+ * The flags are part of the symbols, so the last segment of prefix has the same width in key
+ * and a segment of key starts right after prefix.
+ */
+bool itree_key_is_prefix(const itree_key *prefix, const itree_key *key) {
+    int nbits = itree_key_len(prefix) * 9;
+    int nbytes = nbits / 8;
+
+    if (memcmp(prefix->bytes, key->bytes, nbytes) != 0) {
+        return false;
+    }
+    return nbits % 8 == 0 || ((prefix->bytes[nbytes] ^ key->bytes[nbytes]) & (0xFF00 >> (nbits % 8))) == 0;
+}
+
+/**
+ * Write a segment of 1..ITREE_VAR_MAX_SEGMENT in the variable length form, returns the number of bytes.
+ * The leading 1 bits of the first byte count the bytes that follow it, the value is stored big endian
+ * in the remaining bits, always in the shortest form:
+ * 0xxxxxxx                     1..127
+ * 10xxxxxx +1 byte             128..16383
+ * 110xxxxx +2 bytes            16384..2097151
+ * 1110xxxx +3 bytes            2097152..268435455
+ * 11110xxx +4 bytes            268435456..2147483647
+ * A longer form has a greater first byte and a greater value, so memcmp() orders segments by value,
+ * and no form is the prefix of another, so memcmp() of concatenated segments orders by the first
+ * differing segment.
+ */
+int itree_var_encode_segment(uint32 value, uint8_t *dst) {
+    int extra = value < 0x80 ? 0 : value < 0x4000 ? 1 : value < 0x200000 ? 2 : value < 0x10000000 ? 3 : 4;
+
+    for (int i = extra; i > 0; i--) {
+        dst[i] = (uint8_t) value;
+        value >>= 8;
+    }
+    dst[0] = (uint8_t) ((0xFF00 >> extra) | value);
+    return extra + 1;
+}
+
+/**
+ * Read the segment at the start of src, len bytes are available.
+ * Returns the number of bytes of the segment, 0 when they are not a segment written by
+ * itree_var_encode_segment(): truncated, 0, above ITREE_VAR_MAX_SEGMENT or not in the shortest form.
+ */
+int itree_var_decode_segment(const uint8_t *src, int len, uint32 *value) {
+    static const uint32 min_value[] = {1, 0x80, 0x4000, 0x200000, 0x10000000};
+    int extra = 0;
+    uint64 val;
+
+    while (extra < 5 && (src[0] & (0x80 >> extra))) {
+        extra++;
+    }
+    if (extra > 4 || extra >= len) {
+        return 0;
+    }
+    val = src[0] & (0x7F >> extra);
+    for (int i = 1; i <= extra; i++) {
+        val = (val << 8) | src[i];
+    }
+    if (val < min_value[extra] || val > ITREE_VAR_MAX_SEGMENT) {
+        return 0;
+    }
+    *value = (uint32) val;
+    return extra + 1;
+}
+
+/**
+ * Number of bytes of the segment starting with byte first, from its leading 1 bits.
+ */
+static inline int itree_var_segment_len(uint8_t first) {
+    return first < 0x80 ? 1 : first < 0xC0 ? 2 : first < 0xE0 ? 3 : first < 0xF0 ? 4 : 5;
+}
+
+/**
+ * Parse the text form into the variable length form, as itree_parse() does for itree:
+ * segments of 1..ITREE_VAR_MAX_SEGMENT separated by a single '.', with nothing before or after.
+ * A segment takes no more bytes than it has digits, dst must hold strlen(input) bytes.
+ * len is set to the number of bytes written.
+ */
+itree_parse_status itree_var_parse(const char *input, uint8_t *dst, int *len, const char **error_at, int *nsegments) {
+    const char *ptr = input;
+
+    *nsegments = 0;
+    *len = 0;
+    for (;;) {
+        const char *digits = ptr;
+        uint64 val = 0;
+
+        while (*ptr >= '0' && *ptr <= '9') {
+            if (val <= ITREE_VAR_MAX_SEGMENT) {
+                val = val * 10 + (uint64) (*ptr - '0');
+            }
+            ptr++;
+        }
+        (*nsegments)++;
+
+        if (ptr == digits) {
+            *error_at = ptr;
+            return (*ptr == '.' || *ptr == '\0') ? ITREE_PARSE_EMPTY_SEGMENT : ITREE_PARSE_UNEXPECTED_CHAR;
+        }
+        if (val == 0 || val > ITREE_VAR_MAX_SEGMENT) {
+            *error_at = digits;
+            return ITREE_PARSE_OUT_OF_RANGE;
+        }
+        *len += itree_var_encode_segment((uint32) val, dst + *len);
+
+        if (*ptr == '\0') {
+            return ITREE_PARSE_OK;
+        }
+        if (*ptr != '.') {
+            *error_at = ptr;
+            return ITREE_PARSE_UNEXPECTED_CHAR;
+        }
+        ptr++;
+    }
+}
+
+/**
+ * Write the decimal digits of a segment of 1..ITREE_VAR_MAX_SEGMENT, returns the number of characters.
+ */
+static int itree_var_format_segment(uint32 val, char *dst) {
+    char digits[10];
+    int len = 0;
+
+    do {
+        digits[len++] = (char) ('0' + val % 10);
+        val /= 10;
+    } while (val > 0);
+    for (int i = 0; i < len; i++) {
+        dst[i] = digits[len - 1 - i];
+    }
+    return len;
+}
+
+/**
+ * Format the text form of len bytes of the variable length form into dst,
+ * which must hold ITREE_VAR_MAX_TEXT_LEN(len) + 1 characters. Returns the length without the terminating 0.
+ */
+int itree_var_format(const uint8_t *data, int len, char *dst) {
+    char *ptr = dst;
+    uint32 val;
+
+    for (int pos = 0; pos < len; ) {
+        int n = itree_var_decode_segment(data + pos, len - pos, &val);
+
+        if (n == 0) {
+            break;
+        }
+        if (ptr != dst) {
+            *ptr++ = '.';
+        }
+        ptr += itree_var_format_segment(val, ptr);
+        pos += n;
+    }
+    *ptr = '\0';
+    return (int) (ptr - dst);
+}
+
+/**
+ * Check that len bytes are a sequence of segments of itree_var_encode_segment().
+ * Returns the number of segments, -1 when the bytes are not valid.
+ */
+int itree_var_validate(const uint8_t *data, int len) {
+    int depth = 0;
+    uint32 val;
+
+    for (int pos = 0; pos < len; depth++) {
+        int n = itree_var_decode_segment(data + pos, len - pos, &val);
+
+        if (n == 0) {
+            return -1;
+        }
+        pos += n;
+    }
+    return depth;
+}
+
+/**
+ * Decode the segments of the variable length form, segments must hold itree_var_depth() values.
+ * Returns the number of segments.
+ */
+int itree_var_get_segments(const uint8_t *data, int len, uint32 *segments) {
+    int depth = 0;
+
+    for (int pos = 0; pos < len; ) {
+        int n = itree_var_decode_segment(data + pos, len - pos, &segments[depth]);
+
+        if (n == 0) {
+            break;
+        }
+        pos += n;
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Number of levels, counted from the first byte of each segment without decoding the values.
+ */
+int itree_var_depth(const uint8_t *data, int len) {
+    int depth = 0;
+
+    for (int pos = 0; pos < len; pos += itree_var_segment_len(data[pos])) {
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Number of bytes of the first levels of the variable length form, all len bytes when it has fewer levels.
+ */
+int itree_var_level_len(const uint8_t *data, int len, int levels) {
+    int pos = 0;
+
+    for (; pos < len && levels > 0; levels--) {
+        pos += itree_var_segment_len(data[pos]);
+    }
+    return Min(pos, len);
+}
+
+/**
+ * Order of two values in the variable length form, the same order as itree_packed_cmp():
+ * memcmp() orders by the first differing segment, a prefix comes first.
+ */
+int itree_var_packed_cmp(const uint8_t *a, int alen, const uint8_t *b, int blen) {
+    int cmp = memcmp(a, b, Min(alen, blen));
+
+    if (cmp != 0) {
+        return cmp > 0 ? 1 : -1;
+    }
+    return (alen > blen) - (alen < blen);
+}
+
+/**
+ * True if prefix is an ancestor of tree or equal to it. No segment form is the prefix of another,
+ * so when the bytes of prefix start tree a segment of tree starts right after them.
+ */
+bool itree_var_is_prefix(const uint8_t *prefix, int plen, const uint8_t *tree, int tlen) {
+    return plen <= tlen && memcmp(prefix, tree, plen) == 0;
+}
+
+/**
+ * The least value after the subtree of a value in the variable length form: the next sibling of the value,
+ * or of its nearest ancestor whose segment is below ITREE_VAR_MAX_SEGMENT. dst must hold len + 1 bytes.
+ * Returns its length, -1 when no value follows the subtree.
+ */
+int itree_var_subtree_next(const uint8_t *data, int len, uint8_t *dst) {
+    for (int level = itree_var_depth(data, len); level > 0; level--) {
+        int start = itree_var_level_len(data, len, level - 1);
+        int end = itree_var_level_len(data, len, level);
+        uint32 val;
+
+        if (itree_var_decode_segment(data + start, end - start, &val) > 0 && val < ITREE_VAR_MAX_SEGMENT) {
+            memcpy(dst, data, start);
+            return start + itree_var_encode_segment(val + 1, dst + start);
+        }
+    }
+    return -1;
+}
+
+/**
+ * Write an itree in the variable length form, dst must hold ITREE_VAR_MAX_ITREE_LEN bytes.
+ * Returns the number of bytes written.
+ */
+int itree_var_encode_itree(const itree *tree, uint8_t *dst) {
+    uint16_t segments[ITREE_MAX_LEVELS];
+    int depth = itree_get_segments(tree, segments);
+    int len = 0;
+
+    for (int i = 0; i < depth; i++) {
+        len += itree_var_encode_segment(segments[i], dst + len);
+    }
+    return len;
+}
+
+/**
+ * Convert len bytes of the variable length form to a canonical itree.
+ * Returns ITREE_PARSE_OUT_OF_RANGE for a segment above 65535 and ITREE_PARSE_TOO_LONG
+ * when the segments do not fit in the data bytes.
+ */
+itree_parse_status itree_var_decode_itree(const uint8_t *data, int len, itree *dst) {
+    uint16_t segments[ITREE_MAX_LEVELS];
+    int depth = 0;
+    uint32 val;
+
+    for (int pos = 0; pos < len; depth++) {
+        int n = itree_var_decode_segment(data + pos, len - pos, &val);
+
+        if (n == 0 || val > 65535) {
+            return ITREE_PARSE_OUT_OF_RANGE;
+        }
+        if (depth == ITREE_MAX_LEVELS) {
+            return ITREE_PARSE_TOO_LONG;
+        }
+        segments[depth] = (uint16_t) val;
+        pos += n;
+    }
+    return itree_set_segments(segments, depth, dst) ? ITREE_PARSE_OK : ITREE_PARSE_TOO_LONG;
+}
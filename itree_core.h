@@ -0,0 +1,110 @@
+#ifndef ITREE_CORE_H
+#define ITREE_CORE_H
+
+/**
+ * The packed itree form and the routines that encode, decode and compare it.
+ * Nothing here uses fmgr, palloc or ereport: errors are returned as status codes,
+ * so itree_core.c links into the standalone benchmark (make bench) as well as the module.
+ */
+#include "c.h"
+
+#define ITREE_MAX_LEVELS 16  // Max 16 1-byte segments
+#define ITREE_SIZE ITREE_MAX_LEVELS + 2 // 2 bytes for control
+#define ITREE_MAX_SEGMENT_LENGTH 2  // Max 2 bytes for segment length
+#define ITREE_LEGACY_SIZE 16 // INTERNALLENGTH of itree 1.0: the control word and data[0..13]
+
+// 16 control bits as one word: bit i belongs to data[i], same as get_control_bit()
+#define ITREE_CONTROL_WORD(t) ((uint32)(t)->control[0] | ((uint32)(t)->control[1] << 8))
+
+// text form: a data byte takes at most 4 characters, "255." or half of "65535."
+#define ITREE_MAX_TEXT_LEN (ITREE_MAX_LEVELS * 4)
+
+typedef struct {
+    uint8_t control[2];  //all control bits used for segments
+    uint8_t data[ITREE_MAX_LEVELS]; // 16 bytes for segments
+} itree;
+
+// variable length form of itree_var: segments of 1 to 5 bytes, see itree_var_encode_segment()
+#define ITREE_VAR_MAX_SEGMENT 0x7FFFFFFF
+// bytes of an itree in the variable length form, 1-byte segments 128..255 take 2 bytes
+#define ITREE_VAR_MAX_ITREE_LEN (ITREE_MAX_LEVELS * 2)
+// text form of len bytes: a byte takes at most 4 characters, "127." or 6 for 2 bytes of "16383."
+#define ITREE_VAR_MAX_TEXT_LEN(len) ((len) * 4)
+
+// start of the prefix fingerprint chain, see itree_prefix_fingerprints(); changing it changes the GIN fingerprint keys
+#define ITREE_FINGERPRINT_SEED UINT64CONST(0x2545F4914F6CDD1D)
+
+// memcmp ordered form of an itree, 9 bits per data position, see itree_key_encode()
+typedef struct {
+    uint8_t bytes[ITREE_SIZE];
+} itree_key;
+
+// a prefix prepared for testing many itree values against it, see itree_prefix_matcher_init()
+typedef struct {
+    itree prefix;  // canonical copy
+    int len;       // data bytes of prefix
+    uint32 keep;   // mask of the data bytes of prefix
+    uint32 ctrl;   // control bits of prefix under keep
+} itree_prefix_matcher;
+
+typedef enum {
+    ITREE_PARSE_OK = 0,
+    ITREE_PARSE_EMPTY_SEGMENT,   // no digits before a '.' or the end
+    ITREE_PARSE_UNEXPECTED_CHAR, // anything but digits and '.'
+    ITREE_PARSE_OUT_OF_RANGE,    // a segment of 0 or above 65535
+    ITREE_PARSE_TOO_LONG         // the segments do not fit in the data bytes
+} itree_parse_status;
+
+//segments and text
+int itree_get_segments(const itree *tree, uint16_t *segments);
+bool itree_set_segments(const uint16_t *segments, int count, itree *dst);
+itree_parse_status itree_parse(const char *input, itree *dst, const char **error_at, int *nsegments);
+int itree_format(const itree *tree, char *dst);
+int itree_prefix_keys(const itree *tree, itree *keys);
+int itree_prefix_fingerprints(const itree *tree, uint32 *fingerprints);
+
+//packed helpers, work on the 18 byte form without decoding
+uint32 itree_zero_byte_mask(const uint8_t *data);
+uint32 itree_diff_byte_mask(const uint8_t *a, const uint8_t *b);
+int itree_packed_len(const itree *tree);
+int itree_packed_cmp(const itree *a, const itree *b);
+void itree_prefix_copy(const itree *src, int nbytes, itree *dst);
+void itree_canonical_copy(const itree *src, itree *dst);
+bool itree_splice_copy(const itree *a, int alen, const itree *b, int from, int to, itree *dst);
+bool itree_append_segment(const itree *tree, uint16_t segment, itree *dst);
+uint32 itree_packed_starts(const itree *tree);
+uint32 itree_packed_ends(const itree *tree);
+int itree_packed_depth(const itree *tree);
+int itree_packed_lcp_len(const itree *a, const itree *b);
+int itree_packed_lcp(const itree *a, const itree *b);
+int itree_level_len(const itree *tree, int levels);
+bool itree_packed_is_prefix(const itree *prefix, const itree *tree);
+void itree_prefix_matcher_init(const itree *prefix, itree_prefix_matcher *matcher);
+bool itree_prefix_matcher_test(const itree_prefix_matcher *matcher, const itree *tree);
+int itree_prefix_matcher_batch(const itree_prefix_matcher *matcher, const itree *trees, int n, uint8_t *bits);
+int itree_packed_distance(const itree *a, const itree *b);
+uint64 itree_order_key(const itree *tree);
+void itree_subtree_upper_copy(const itree *tree, itree *dst);
+
+//memcmp ordered keys
+void itree_key_encode(const itree *tree, itree_key *key);
+void itree_key_decode(const itree_key *key, itree *dst);
+int itree_key_len(const itree_key *key);
+bool itree_key_is_prefix(const itree_key *prefix, const itree_key *key);
+
+//variable length form
+int itree_var_encode_segment(uint32 value, uint8_t *dst);
+int itree_var_decode_segment(const uint8_t *src, int len, uint32 *value);
+itree_parse_status itree_var_parse(const char *input, uint8_t *dst, int *len, const char **error_at, int *nsegments);
+int itree_var_format(const uint8_t *data, int len, char *dst);
+int itree_var_validate(const uint8_t *data, int len);
+int itree_var_get_segments(const uint8_t *data, int len, uint32 *segments);
+int itree_var_depth(const uint8_t *data, int len);
+int itree_var_level_len(const uint8_t *data, int len, int levels);
+int itree_var_packed_cmp(const uint8_t *a, int alen, const uint8_t *b, int blen);
+bool itree_var_is_prefix(const uint8_t *prefix, int plen, const uint8_t *tree, int tlen);
+int itree_var_subtree_next(const uint8_t *data, int len, uint8_t *dst);
+int itree_var_encode_itree(const itree *tree, uint8_t *dst);
+itree_parse_status itree_var_decode_itree(const uint8_t *data, int len, itree *dst);
+
+#endif
@@ -2,94 +2,261 @@
 #include "fmgr.h"
 #include "access/gin.h"      // For GIN-specific types and functions
 #include "access/stratnum.h" // For StrategyNumber
+#include "utils/array.h"
 #include "itree.h"
 
+/**
+ * GIN support for itree. Every indexed value v with n segments gets n + 1 keys:
+ * - the n prefix keys: v cut after each of its segments, in canonical form, the last one is v itself
+ * - 1 self key: v with control bit 0 cleared. data[0] always starts a segment,
+ *   so no itree value has control bit 0 cleared and self keys never collide with prefix keys.
+ *
+ * That makes both operators exact, no heap recheck is needed:
+ * - v <@ q: q is a prefix of v, the single prefix key q is present
+ * - v @> q: v is one of the prefixes of q, one of the self keys of q's prefixes is present
+ *
+ * v ~ iquery uses the same keys with partial match: the leading fixed width items of the iquery
+ * (the head) cover a known number of levels, so the prefix key of v at that level must match the head.
+ * The scan starts at the fixed leading levels of the iquery and stops at the end of their subtree.
+ * When the head is the whole iquery the self keys are matched instead and no recheck is needed.
+ *
+ * itree_array_gin_ops indexes an itree[] under the keys of all its elements and shares the query side:
+ * an element below q has the prefix key q, an element above q has the self key of a prefix of q,
+ * an element matching an iquery has a matching prefix or self key, so the operators stay exact.
+ *
+ * Strategy numbers:
+ * 1 <@, 2 @>, 3 ~
+ */
+#define ITREE_GIN_DESCENDANT_STRATEGY 1
+#define ITREE_GIN_ANCESTOR_STRATEGY   2
+#define ITREE_GIN_MATCH_STRATEGY      3
+
+#define ITREE_GIN_SELF_BIT 0x01 // control[0] bit of data[0]
+
+static inline bool itree_gin_is_self_key(const itree *key) {
+    return (key->control[0] & ITREE_GIN_SELF_BIT) == 0;
+}
+
+/**
+ * extra_data of the ~ key, shared by compare_partial and the consistent functions.
+ */
+typedef struct {
+    itree prefix;    // the fixed leading levels of the iquery, where the scan starts (itree_gin_ops)
+    iquery *head;    // the leading fixed width items
+    int head_levels; // levels matched by the head
+    bool exact;      // the head is the whole iquery
+} itree_gin_match;
+
+/**
+ * Keys for the prefixes of tree, shortest first, one for each segment.
+ * With self_keys the self key of each prefix is returned instead of the prefix key.
+ */
+static Datum *itree_gin_prefix_keys(const itree *tree, bool self_keys, int32 *nkeys) {
+    itree *prefixes = (itree *) palloc(ITREE_MAX_LEVELS * sizeof(itree));
+    Datum *keys;
+
+    *nkeys = itree_prefix_keys(tree, prefixes);
+    if (*nkeys == 0) {
+        pfree(prefixes);
+        return NULL;
+    }
+
+    keys = (Datum *) palloc((*nkeys + 1) * sizeof(Datum));
+    for (int i = 0; i < *nkeys; i++) {
+        if (self_keys) {
+            prefixes[i].control[0] &= ~ITREE_GIN_SELF_BIT;
+        }
+        keys[i] = ITreeGetDatum(&prefixes[i]);
+    }
+    return keys;
+}
+
+/**
+ * FUNCTION 1 int compare(itree, itree)
+ * Compares two keys and returns an integer less than zero, zero, or greater than zero.
+ * Prefix keys are in btree order, a self key sorts right after the prefix key of the same value.
+ */
+PG_FUNCTION_INFO_V1(itree_compare);
+Datum itree_compare(PG_FUNCTION_ARGS) {
+    itree a = *PG_GETARG_ITREE(0);
+    itree b = *PG_GETARG_ITREE(1);
+    bool a_self = itree_gin_is_self_key(&a);
+    bool b_self = itree_gin_is_self_key(&b);
+    int result;
+
+    a.control[0] |= ITREE_GIN_SELF_BIT;
+    b.control[0] |= ITREE_GIN_SELF_BIT;
+    result = itree_packed_cmp(&a, &b);
+    if (result == 0) {
+        result = (int) a_self - (int) b_self;
+    }
+    PG_RETURN_INT32(result);
+}
+
+/**
+ * FUNCTION 5 int comparePartial(Datum partial_key, Datum key, StrategyNumber n, Pointer extra_data)
+ * Compares a partial-match query key to an index key. Returns an integer whose sign indicates the result:
+ * less than zero means the index key does not match the query, but the index scan should continue;
+ * zero means that the index key does match the query;
+ * greater than zero indicates that the index scan should stop because no more matches are possible.
+ *
+ * Only the ~ key is a partial match key: the keys of the subtree of the fixed leading levels are scanned,
+ * a key matches when it has the head levels and matches the head.
+ */
+PG_FUNCTION_INFO_V1(itree_compare_partial);
+Datum itree_compare_partial(PG_FUNCTION_ARGS) {
+    itree key = *PG_GETARG_ITREE(1);
+    itree_gin_match *match = (itree_gin_match *) PG_GETARG_POINTER(3);
+    bool self = itree_gin_is_self_key(&key);
+
+    key.control[0] |= ITREE_GIN_SELF_BIT;
+    if (!itree_packed_is_prefix(&match->prefix, &key)) {
+        // a subtree is one contiguous range of keys, the scan is past it
+        PG_RETURN_INT32(1);
+    }
+    if (self != match->exact || itree_packed_depth(&key) != match->head_levels) {
+        PG_RETURN_INT32(-1);
+    }
+    PG_RETURN_INT32(iquery_match(match->head, &key) ? 0 : -1);
+}
+
+/**
+ * Keys of value ~ query: no key when the iquery has no fixed width head,
+ * the self key of the fixed leading levels when they are the whole iquery,
+ * otherwise a partial match key.
+ */
+static Datum *itree_gin_match_keys(const iquery *query, int32 *nkeys, bool **pmatch,
+                                   Pointer **extra_data, int32 *searchMode) {
+    itree_gin_match *match = (itree_gin_match *) palloc(sizeof(itree_gin_match));
+    int prefix_levels = iquery_fixed_prefix(query, &match->prefix);
+    itree *key;
+    Datum *keys;
+
+    match->head = iquery_head(query, &match->head_levels);
+    *nkeys = 0;
+    if (match->head_levels > ITREE_MAX_LEVELS) {
+        // more levels than any itree has, nothing matches
+        return NULL;
+    }
+    if (match->head_levels == 0) {
+        *searchMode = GIN_SEARCH_MODE_ALL;
+        return NULL;
+    }
+    match->exact = match->head->nitems == query->nitems;
+
+    key = (itree *) palloc(sizeof(itree));
+    *key = match->prefix;
+    keys = (Datum *) palloc(sizeof(Datum));
+    keys[0] = ITreeGetDatum(key);
+    *nkeys = 1;
+    *extra_data = (Pointer *) palloc(sizeof(Pointer));
+    (*extra_data)[0] = (Pointer) match;
+
+    if (match->exact && prefix_levels == match->head_levels) {
+        // plain segment values only, the one value that matches
+        key->control[0] &= ~ITREE_GIN_SELF_BIT;
+    } else {
+        *pmatch = (bool *) palloc(sizeof(bool));
+        (*pmatch)[0] = true;
+    }
+    return keys;
+}
+
+/**
+ * Keys of an indexed value: the prefix key of every level and the self key of the value.
+ * keys must have room for ITREE_MAX_LEVELS + 1 keys, returns the number of keys.
+ */
+static int itree_gin_value_keys(const itree *tree, Datum *keys) {
+    itree *prefixes = (itree *) palloc((ITREE_MAX_LEVELS + 1) * sizeof(itree));
+    int n = itree_prefix_keys(tree, prefixes);
+
+    if (n == 0) {
+        pfree(prefixes);
+        return 0;
+    }
+    // the last prefix key is the canonical value itself
+    prefixes[n] = prefixes[n - 1];
+    prefixes[n].control[0] &= ~ITREE_GIN_SELF_BIT;
+    for (int i = 0; i <= n; i++) {
+        keys[i] = ITreeGetDatum(&prefixes[i]);
+    }
+    return n + 1;
+}
 
 /**
  * FUNCTION 2 itree_extract_value(itree, internal, internal)
- * 
+ *
  * Datum *extractValue(Datum itemValue, int32 *nkeys, bool **nullFlags)
-     * Returns a palloc'd array of keys given an item to be indexed. 
- * The number of returned keys must be stored into *nkeys. 
- * If any of the keys can be null, also palloc an array of *nkeys bool fields, 
- * store its address at *nullFlags, and set these null flags as needed. 
- * *nullFlags can be left NULL (its initial value) if all keys are non-null. 
+     * Returns a palloc'd array of keys given an item to be indexed.
+ * The number of returned keys must be stored into *nkeys.
+ * If any of the keys can be null, also palloc an array of *nkeys bool fields,
+ * store its address at *nullFlags, and set these null flags as needed.
+ * *nullFlags can be left NULL (its initial value) if all keys are non-null.
  * The return value can be NULL if the item contains no keys.
- * 
+ *
+ * Keys: the prefix key of every level and the self key of the value.
  */
 PG_FUNCTION_INFO_V1(itree_extract_value);
 Datum itree_extract_value(PG_FUNCTION_ARGS) {
     itree *tree = PG_GETARG_ITREE(0);
     int32 *nkeys = (int32 *)PG_GETARG_POINTER(1);
-    bool **nullFlags = (bool **)PG_GETARG_POINTER(2);
-    Datum *keys = NULL;
+    Datum *keys = (Datum *) palloc((ITREE_MAX_LEVELS + 1) * sizeof(Datum));
 
-    // Handle NULL value
-    if (tree == NULL) {
-        *nkeys = 0;
-        *nullFlags = NULL;
+    *nkeys = itree_gin_value_keys(tree, keys);
+    if (*nkeys == 0) {
+        pfree(keys);
         PG_RETURN_POINTER(NULL);
     }
+    PG_RETURN_POINTER(keys);
+}
 
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
-    int i, byte_pos;
+/**
+ * FUNCTION 2 of itree_array_gin_ops: itree_array_extract_value(itree[], internal, internal)
+ * The keys of all non NULL elements, GIN removes the duplicates of shared prefixes.
+ */
+PG_FUNCTION_INFO_V1(itree_array_extract_value);
+Datum itree_array_extract_value(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    int32 *nkeys = (int32 *)PG_GETARG_POINTER(1);
+    int nitems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+    ArrayIterator iterator;
+    Datum *keys;
+    Datum value;
+    bool isnull;
 
-    // Number of subpaths = number of segments
-    *nkeys = seg_count;
-    if (seg_count == 0) {
+    *nkeys = 0;
+    if (nitems == 0) {
         PG_RETURN_POINTER(NULL);
     }
-
-    // Allocate keys array
-    keys = (Datum *)palloc(seg_count * sizeof(Datum));
-
-    // Rebuild each prefix as an itree
-    byte_pos = 0;
-    for (i = 0; i < seg_count; i++) {
-        itree *subpath = (itree *)palloc0(ITREE_SIZE);
-        int j;
-
-        // Copy control and data up to this segment
-        subpath->control[0] = tree->control[0];
-        subpath->control[1] = tree->control[1];
-        for (j = 0; j < byte_pos; j++) {
-            subpath->data[j] = tree->data[j];
+    keys = (Datum *) palloc((Size) nitems * (ITREE_MAX_LEVELS + 1) * sizeof(Datum));
+    iterator = itree_array_iterator(array);
+    while (array_iterate(iterator, &value, &isnull)) {
+        if (!isnull) {
+            *nkeys += itree_gin_value_keys(DatumGetITree(value), keys + *nkeys);
         }
-
-        // Add current segment
-        if (segments[i] <= 255) {
-            subpath->data[byte_pos++] = (uint8_t)segments[i];
-        } else {
-            subpath->data[byte_pos++] = (uint8_t)(segments[i] >> 8);
-            subpath->data[byte_pos] = (uint8_t)(segments[i] & 0xFF);
-            if (byte_pos < 8) {
-                subpath->control[0] &= ~(1 << (7 - byte_pos));
-            } else {
-                subpath->control[1] &= ~(1 << (15 - byte_pos));
-            }
-            byte_pos++;
-        }
-
-        keys[i] = PointerGetDatum(subpath);
     }
+    array_free_iterator(iterator);
 
+    if (*nkeys == 0) {
+        pfree(keys);
+        PG_RETURN_POINTER(NULL);
+    }
     PG_RETURN_POINTER(keys);
 }
 
 
 /**
- * FUNCTION 3 Datum *extractQuery(Datum query, int32 *nkeys, StrategyNumber n, bool **pmatch, 
+ * FUNCTION 3 Datum *extractQuery(Datum query, int32 *nkeys, StrategyNumber n, bool **pmatch,
  *                      Pointer **extra_data, bool **nullFlags, int32 *searchMode)
- * Returns a palloc'd array of keys given a value to be queried; that is, 
- * query is the value on the right-hand side of an indexable operator 
- * whose left-hand side is the indexed column. 
+ * Returns a palloc'd array of keys given a value to be queried; that is,
+ * query is the value on the right-hand side of an indexable operator
+ * whose left-hand side is the indexed column.
  * n is the strategy number of the operator within the operator class.
  * The number of returned keys must be stored into *nkeys.
- * 
- * If any of the keys can be null, also palloc an array of *nkeys bool fields, 
- * store its address at *nullFlags, and set these null flags as needed. 
- * *nullFlags can be left NULL (its initial value) if all keys are non-null. 
+ *
+ * If any of the keys can be null, also palloc an array of *nkeys bool fields,
+ * store its address at *nullFlags, and set these null flags as needed.
+ * *nullFlags can be left NULL (its initial value) if all keys are non-null.
  * The return value can be NULL if the query contains no keys.
  *
  */
@@ -100,137 +267,446 @@ Datum itree_extract_query(PG_FUNCTION_ARGS) {
     StrategyNumber strategy = PG_GETARG_UINT16(2);
     bool **pmatch = (bool **)PG_GETARG_POINTER(3);
     Pointer **extra_data = (Pointer **)PG_GETARG_POINTER(4);
-    bool **nullFlags = (bool **)PG_GETARG_POINTER(5);
     int32 *searchMode = (int32 *)PG_GETARG_POINTER(6);
-
-    // Handle NULL query
-    if (query == NULL) {
-        *nkeys = 0;
-        *pmatch = NULL;
-        *extra_data = NULL;
-        *nullFlags = NULL;
-        *searchMode = GIN_SEARCH_MODE_DEFAULT;
-        PG_RETURN_POINTER(NULL);
-    }
-
     Datum *keys = NULL;
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(query, segments);
-    int i, byte_pos;
+    itree *key;
 
+    *searchMode = GIN_SEARCH_MODE_DEFAULT;
 
     switch (strategy) {
-        case 1:  // <@ value is a descendant of query or equal to it
-            // value should contain the full query path
+        case ITREE_GIN_DESCENDANT_STRATEGY:
+            // value <@ query: the prefix key of the canonical query
+            if (itree_packed_len(query) == 0) {
+                // every value is below the empty itree
+                *nkeys = 0;
+                *searchMode = GIN_SEARCH_MODE_ALL;
+                break;
+            }
+            key = (itree *) palloc(sizeof(itree));
+            itree_canonical_copy(query, key);
+            keys = (Datum *) palloc(sizeof(Datum));
+            keys[0] = ITreeGetDatum(key);
             *nkeys = 1;
-            keys = (Datum *)palloc(sizeof(Datum));
-            keys[0] = PointerGetDatum(query);  // Use query as-is
-            *searchMode = GIN_SEARCH_MODE_DEFAULT;
             break;
-        case 2:  // @> (ancestor of query)
-            *nkeys = seg_count;
-            if (seg_count == 0) {
-                *searchMode = GIN_SEARCH_MODE_DEFAULT;
-                PG_RETURN_POINTER(NULL);
+        case ITREE_GIN_ANCESTOR_STRATEGY:
+            // value @> query: the self key of any prefix of the query
+            keys = itree_gin_prefix_keys(query, true, nkeys);
+            if (keys == NULL) {
+                // only the empty itree is above the empty itree
+                *searchMode = GIN_SEARCH_MODE_INCLUDE_EMPTY;
             }
-            keys = (Datum *)palloc(seg_count * sizeof(Datum));
-            byte_pos = 0;
-            for (i = 0; i < seg_count; i++) {
-                itree *subpath = (itree *)palloc0(ITREE_SIZE);
-                int j;
-                subpath->control[0] = query->control[0];
-                subpath->control[1] = query->control[1];
-                for (j = 0; j < byte_pos; j++) {
-                    subpath->data[j] = query->data[j];
-                }
-                if (segments[i] <= 255) {
-                    subpath->data[byte_pos++] = (uint8_t)segments[i];
-                } else {
-                    subpath->data[byte_pos++] = (uint8_t)(segments[i] >> 8);
-                    subpath->data[byte_pos] = (uint8_t)(segments[i] & 0xFF);
-                    if (byte_pos < 8) {
-                        subpath->control[0] &= ~(1 << (7 - byte_pos));
-                    } else {
-                        subpath->control[1] &= ~(1 << (15 - byte_pos));
-                    }
-                    byte_pos++;
-                }
-                keys[i] = PointerGetDatum(subpath);
-            }
-            *searchMode = GIN_SEARCH_MODE_DEFAULT;
             break;
-
+        case ITREE_GIN_MATCH_STRATEGY:
+            // the query is an iquery here
+            keys = itree_gin_match_keys(PG_GETARG_IQUERY(0), nkeys, pmatch, extra_data, searchMode);
+            break;
         default:
             elog(ERROR, "unknown strategy number: %d", strategy);
-            *nkeys = 0;
-            *searchMode = GIN_SEARCH_MODE_DEFAULT;
-            PG_RETURN_POINTER(NULL);
     }
 
-    *pmatch = NULL;      // No partial matching needed
-    *extra_data = NULL;  // No extra data
-    *nullFlags = NULL;   // No null flags
     PG_RETURN_POINTER(keys);
 }
 
 /**
  * FUNCTION 4 : bool consistent(bool check[], StrategyNumber n, Datum query, int32 nkeys, Pointer extra_data[], bool *recheck, Datum queryKeys[], bool nullFlags[])
- * Returns true if an indexed item satisfies the query operator with strategy number n (or might satisfy it, if the recheck indication is returned). 
- * This function does not have direct access to the indexed item's value, since GIN does not store items explicitly. 
+ * Returns true if an indexed item satisfies the query operator with strategy number n (or might satisfy it, if the recheck indication is returned).
+ * This function does not have direct access to the indexed item's value, since GIN does not store items explicitly.
  * Rather, what is available is knowledge about which key values extracted from the query appear in a given indexed item.
- * The check array has length nkeys, which is the same as the number of keys previously returned by extractQuery for this query datum. 
- * Each element of the check array is true if the indexed item contains the corresponding query key, i.e., 
- * if (check[i] == true) the i-th key of the extractQuery result array is present in the indexed item. 
+ * The check array has length nkeys, which is the same as the number of keys previously returned by extractQuery for this query datum.
+ * Each element of the check array is true if the indexed item contains the corresponding query key, i.e.,
+ * if (check[i] == true) the i-th key of the extractQuery result array is present in the indexed item.
  * The original query datum is passed in case the consistent method needs to consult it, and so are the queryKeys[]
- * - no nullFlags possible, so nullFlags[] is left as NULL. 
- * 
+ * - no nullFlags possible, so nullFlags[] is left as NULL.
+ *
+ * On success, *recheck should be set to true if the heap tuple needs to be rechecked against the query operator,
+ * or false if the index test is exact. <@ and @> are exact on the keys of itree_extract_query,
+ * ~ is exact when the head is the whole iquery.
+ * An empty itree query has no keys and is rechecked: an itree[] without elements has no keys either.
  */
 PG_FUNCTION_INFO_V1(itree_consistent);
 Datum itree_consistent(PG_FUNCTION_ARGS) {
     bool *check = (bool *)PG_GETARG_POINTER(0);//array is already populated by the GIN index and indicates which query keys match the indexed item.
-    //StrategyNumber strategy = PG_GETARG_UINT16(1);
-    itree *query = PG_GETARG_ITREE(2);
+    StrategyNumber strategy = PG_GETARG_UINT16(1);
     int32 nkeys = PG_GETARG_INT32(3);
+    Pointer *extra_data = (Pointer *)PG_GETARG_POINTER(4);
     bool *recheck = (bool *)PG_GETARG_POINTER(5);
-    //Datum *queryKeys = (Datum *)PG_GETARG_POINTER(6);
-    // bool *nullFlags = (bool *)PG_GETARG_POINTER(7);
-    
-    /*
-    On success, *recheck should be set to true if the heap tuple needs to be rechecked against the query operator, 
-    or false if the index test is exact. That is:
-        1. a false return value guarantees that the heap tuple does not match the query; 
-        2. a true return value with *recheck set to false guarantees that the heap tuple does match the query; 
-        3. and a true return value with *recheck set to true means that the heap tuple might match the query, 
-        so it needs to be fetched and rechecked by evaluating the query operator directly against the originally indexed item.    
-    */ 
-    // Handle NULL query
-    if (query == NULL) {
-        PG_RETURN_NULL();
-    }
-
-    *recheck = false; // Default to no recheck needed for @> and <@ any key matched should mean a match
-    for (int i = 0; i < nkeys; i++) {
-        if (check[i]) {
-            PG_RETURN_BOOL(true);
-        }
+    bool result;
+
+    *recheck = false;
+    switch (strategy) {
+        case ITREE_GIN_DESCENDANT_STRATEGY:
+            // the one prefix key, or no key at all for the empty query
+            result = nkeys == 0 || check[0];
+            *recheck = nkeys == 0;
+            break;
+        case ITREE_GIN_ANCESTOR_STRATEGY:
+            // the value is exactly one of the query prefixes
+            result = nkeys == 0;
+            for (int i = 0; i < nkeys && !result; i++) {
+                result = check[i];
+            }
+            *recheck = nkeys == 0;
+            break;
+        case ITREE_GIN_MATCH_STRATEGY:
+            // the head matches, the rest of the iquery is rechecked
+            result = nkeys == 0 || check[0];
+            *recheck = nkeys == 0 || !((itree_gin_match *) extra_data[0])->exact;
+            break;
+        default:
+            elog(ERROR, "unknown strategy number: %d", strategy);
+            result = false;
     }
 
-    PG_RETURN_BOOL(false);
+    PG_RETURN_BOOL(result);
 }
 
 /**
- * GinTernaryValue triConsistent(GinTernaryValue check[], StrategyNumber n, Datum query, int32 nkeys, Pointer extra_data[], Datum queryKeys[], bool nullFlags[])
- * 
- * triConsistent is similar to consistent, but instead of Booleans in the check vector, there are three possible values for each key: GIN_TRUE, GIN_FALSE and GIN_MAYBE. 
- * GIN_FALSE and GIN_TRUE have the same meaning as regular Boolean values, while GIN_MAYBE means that the presence of that key is not known. 
- * When GIN_MAYBE values are present, the function should only return GIN_TRUE if the item certainly matches whether or not the index item contains the corresponding query keys. 
- * Likewise, the function must return GIN_FALSE only if the item certainly does not match, whether or not it contains the GIN_MAYBE keys. 
+ * FUNCTION 6 GinTernaryValue triConsistent(GinTernaryValue check[], StrategyNumber n, Datum query, int32 nkeys, Pointer extra_data[], Datum queryKeys[], bool nullFlags[])
+ *
+ * triConsistent is similar to consistent, but instead of Booleans in the check vector, there are three possible values for each key: GIN_TRUE, GIN_FALSE and GIN_MAYBE.
+ * GIN_FALSE and GIN_TRUE have the same meaning as regular Boolean values, while GIN_MAYBE means that the presence of that key is not known.
+ * When GIN_MAYBE values are present, the function should only return GIN_TRUE if the item certainly matches whether or not the index item contains the corresponding query keys.
+ * Likewise, the function must return GIN_FALSE only if the item certainly does not match, whether or not it contains the GIN_MAYBE keys.
  * If the result depends on the GIN_MAYBE entries, i.e., the match cannot be confirmed or refuted based on the known query keys, the function must return GIN_MAYBE.
  * When there are no GIN_MAYBE values in the check vector, a GIN_MAYBE return value is the equivalent of setting the recheck flag in the Boolean consistent function.
+ *
+ * <@ and @> are exact, GIN_MAYBE is only returned for GIN_MAYBE keys and the empty query.
+ * ~ returns GIN_MAYBE for a matching head unless the head is the whole iquery.
  */
+PG_FUNCTION_INFO_V1(itree_triconsistent);
+Datum itree_triconsistent(PG_FUNCTION_ARGS) {
+    GinTernaryValue *check = (GinTernaryValue *)PG_GETARG_POINTER(0);
+    StrategyNumber strategy = PG_GETARG_UINT16(1);
+    int32 nkeys = PG_GETARG_INT32(3);
+    Pointer *extra_data = (Pointer *)PG_GETARG_POINTER(4);
+    GinTernaryValue result;
+
+    switch (strategy) {
+        case ITREE_GIN_DESCENDANT_STRATEGY:
+            result = nkeys == 0 ? GIN_MAYBE : check[0];
+            break;
+        case ITREE_GIN_ANCESTOR_STRATEGY:
+            // OR over the self keys: any GIN_TRUE decides, otherwise any GIN_MAYBE keeps it open
+            result = nkeys == 0 ? GIN_MAYBE : GIN_FALSE;
+            for (int i = 0; i < nkeys && result != GIN_TRUE; i++) {
+                if (check[i] != GIN_FALSE) {
+                    result = check[i];
+                }
+            }
+            break;
+        case ITREE_GIN_MATCH_STRATEGY:
+            if (nkeys == 0) {
+                result = GIN_MAYBE;
+            } else if (check[0] == GIN_FALSE || ((itree_gin_match *) extra_data[0])->exact) {
+                result = check[0];
+            } else {
+                result = GIN_MAYBE;
+            }
+            break;
+        default:
+            elog(ERROR, "unknown strategy number: %d", strategy);
+            result = GIN_FALSE;
+    }
 
+    PG_RETURN_GIN_TERNARY_VALUE(result);
+}
 
-/******************************************************* 
- * OPTIONAL SUPPORT FUNCTIONS
-*******************************************************/
+/**
+ * GIN support for itree_var (itree_var_gin_ops), the keys of itree_gin_ops in the variable length form:
+ * the prefix keys are the value cut after each of its segments, the self key is the value followed by a 0 byte,
+ * which starts no segment. The keys compare with itree_var_cmp(): a self key sorts right after the prefix key
+ * of the same value and before its descendants. The consistent functions are the ones of itree_gin_ops,
+ * declared on itree_var as itree_var_gin_consistent and itree_var_gin_triconsistent.
+ * ~ scans the keys of the fixed leading levels of the iquery with partial match as itree_gin_ops does,
+ * without the limit of 16 data bytes on the head.
+ */
+static Datum itree_var_gin_key(const uint8_t *data, int len, bool self) {
+    itree_var *key = (itree_var *) palloc(VARHDRSZ + len + 1);
+
+    memcpy(key->data, data, len);
+    key->data[len] = 0;
+    SET_VARSIZE(key, VARHDRSZ + len + (self ? 1 : 0));
+    return PointerGetDatum(key);
+}
 
+/**
+ * The prefix keys of every level of a value, or the self keys of them, shortest first.
+ * keys must have room for the depth of the value, returns the number of keys.
+ */
+static int itree_var_gin_prefix_keys(const uint8_t *data, int len, bool self_keys, Datum *keys) {
+    int n = 0;
+
+    for (int pos = 0; pos < len; n++) {
+        pos = itree_var_level_len(data, len, n + 1);
+        keys[n] = itree_var_gin_key(data, pos, self_keys);
+    }
+    return n;
+}
+
+/**
+ * FUNCTION 5 itree_var_gin_compare_partial(itree_var, itree_var, smallint, internal)
+ * The ~ key is the prefix key of the fixed leading levels, its subtree is scanned as in itree_compare_partial().
+ * A self key has the 0 byte as its last segment.
+ */
+PG_FUNCTION_INFO_V1(itree_var_gin_compare_partial);
+Datum itree_var_gin_compare_partial(PG_FUNCTION_ARGS) {
+    itree_var *prefix = PG_GETARG_ITREE_VAR_PP(0);
+    itree_var *key = PG_GETARG_ITREE_VAR_PP(1);
+    itree_gin_match *match = (itree_gin_match *) PG_GETARG_POINTER(3);
+    const uint8_t *data = ITREE_VAR_DATA(key);
+    int len = ITREE_VAR_LEN(key);
+    int depth = itree_var_depth(data, len);
+    bool self = depth > 0 && data[itree_var_level_len(data, len, depth - 1)] == 0;
+
+    if (!itree_var_is_prefix(ITREE_VAR_DATA(prefix), ITREE_VAR_LEN(prefix), data, len)) {
+        PG_RETURN_INT32(1);
+    }
+    if (self != match->exact || depth - (int) self != match->head_levels) {
+        PG_RETURN_INT32(-1);
+    }
+    PG_RETURN_INT32(iquery_match_var(match->head, data, len - (int) self) ? 0 : -1);
+}
+
+/**
+ * Keys of value ~ query for itree_var_gin_ops, as itree_gin_match_keys(): no key without a fixed width head,
+ * the self key of the fixed leading levels when they are the whole iquery, otherwise a partial match key.
+ */
+static Datum *itree_var_gin_match_keys(const iquery *query, int32 *nkeys, bool **pmatch,
+                                       Pointer **extra_data, int32 *searchMode) {
+    itree_gin_match *match = (itree_gin_match *) palloc0(sizeof(itree_gin_match));
+    const iquery_item *item = IQUERY_FIRST(query);
+    // a segment of 1..65535 takes at most 3 bytes
+    uint8_t *prefix = (uint8_t *) palloc(query->nitems * 3);
+    int prefix_len = 0;
+    int prefix_levels = 0;
+    Datum *keys;
+
+    for (; prefix_levels < query->nitems && item->flags == 0 && item->nvalues == 1;
+         prefix_levels++, item = IQUERY_NEXT(item)) {
+        prefix_len += itree_var_encode_segment(item->values[0], prefix + prefix_len);
+    }
+
+    match->head = iquery_head(query, &match->head_levels);
+    *nkeys = 0;
+    if (match->head_levels == 0) {
+        *searchMode = GIN_SEARCH_MODE_ALL;
+        return NULL;
+    }
+    match->exact = match->head->nitems == query->nitems;
+
+    keys = (Datum *) palloc(sizeof(Datum));
+    *nkeys = 1;
+    *extra_data = (Pointer *) palloc(sizeof(Pointer));
+    (*extra_data)[0] = (Pointer) match;
+
+    if (match->exact && prefix_levels == match->head_levels) {
+        // plain segment values only, the one value that matches
+        keys[0] = itree_var_gin_key(prefix, prefix_len, true);
+    } else {
+        keys[0] = itree_var_gin_key(prefix, prefix_len, false);
+        *pmatch = (bool *) palloc(sizeof(bool));
+        (*pmatch)[0] = true;
+    }
+    return keys;
+}
+
+/**
+ * FUNCTION 2 itree_var_gin_extract_value(itree_var, internal, internal)
+ * Keys: the prefix key of every level and the self key of the value.
+ */
+PG_FUNCTION_INFO_V1(itree_var_gin_extract_value);
+Datum itree_var_gin_extract_value(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+    int32 *nkeys = (int32 *)PG_GETARG_POINTER(1);
+    int len = ITREE_VAR_LEN(tree);
+    Datum *keys;
+
+    *nkeys = 0;
+    if (len == 0) {
+        PG_RETURN_POINTER(NULL);
+    }
+    keys = (Datum *) palloc((itree_var_depth(ITREE_VAR_DATA(tree), len) + 1) * sizeof(Datum));
+    *nkeys = itree_var_gin_prefix_keys(ITREE_VAR_DATA(tree), len, false, keys);
+    keys[(*nkeys)++] = itree_var_gin_key(ITREE_VAR_DATA(tree), len, true);
+    PG_RETURN_POINTER(keys);
+}
+
+/**
+ * FUNCTION 3 itree_var_gin_extract_query(itree_var, internal, smallint, internal, internal, internal, internal)
+ * <@ looks up the prefix key of the query, @> the self keys of its prefixes and ~ the keys
+ * of the fixed leading levels of the iquery, as itree_extract_query().
+ */
+PG_FUNCTION_INFO_V1(itree_var_gin_extract_query);
+Datum itree_var_gin_extract_query(PG_FUNCTION_ARGS) {
+    int32 *nkeys = (int32 *)PG_GETARG_POINTER(1);
+    StrategyNumber strategy = PG_GETARG_UINT16(2);
+    bool **pmatch = (bool **)PG_GETARG_POINTER(3);
+    Pointer **extra_data = (Pointer **)PG_GETARG_POINTER(4);
+    int32 *searchMode = (int32 *)PG_GETARG_POINTER(6);
+    itree_var *query;
+    int len;
+    Datum *keys = NULL;
+
+    *nkeys = 0;
+    *searchMode = GIN_SEARCH_MODE_DEFAULT;
+    if (strategy == ITREE_GIN_MATCH_STRATEGY) {
+        // the query is an iquery here
+        PG_RETURN_POINTER(itree_var_gin_match_keys(PG_GETARG_IQUERY(0), nkeys, pmatch, extra_data, searchMode));
+    }
+
+    query = PG_GETARG_ITREE_VAR_PP(0);
+    len = ITREE_VAR_LEN(query);
+    switch (strategy) {
+        case ITREE_GIN_DESCENDANT_STRATEGY:
+            if (len == 0) {
+                *searchMode = GIN_SEARCH_MODE_ALL;
+                break;
+            }
+            keys = (Datum *) palloc(sizeof(Datum));
+            keys[0] = itree_var_gin_key(ITREE_VAR_DATA(query), len, false);
+            *nkeys = 1;
+            break;
+        case ITREE_GIN_ANCESTOR_STRATEGY:
+            if (len == 0) {
+                *searchMode = GIN_SEARCH_MODE_INCLUDE_EMPTY;
+                break;
+            }
+            keys = (Datum *) palloc(itree_var_depth(ITREE_VAR_DATA(query), len) * sizeof(Datum));
+            *nkeys = itree_var_gin_prefix_keys(ITREE_VAR_DATA(query), len, true, keys);
+            break;
+        default:
+            elog(ERROR, "unknown strategy number: %d", strategy);
+    }
+
+    PG_RETURN_POINTER(keys);
+}
+
+/**
+ * itree_gin_fp_ops: the keys of itree_gin_ops as int4 fingerprints, see itree_prefix_fingerprints().
+ * A prefix key is the fingerprint of the prefix with bit 0 cleared, a self key the fingerprint with bit 0 set.
+ * An entry takes a 4 byte key instead of 18 bytes and the keys are compared with btint4cmp,
+ * at the price of a heap recheck for every match: two prefixes can share a fingerprint.
+ * ~ looks up the prefix key of the fixed leading levels of the iquery, without partial match.
+ */
+#define ITREE_GIN_FP_SELF_BIT 0x01
+
+static inline Datum itree_gin_fp_key(uint32 fingerprint, bool self) {
+    return Int32GetDatum((int32) (self ? fingerprint | ITREE_GIN_FP_SELF_BIT : fingerprint & ~ITREE_GIN_FP_SELF_BIT));
+}
+
+/**
+ * FUNCTION 2 itree_gin_fp_extract_value(itree, internal, internal)
+ * The prefix key of every level and the self key of the value, in one array of by-value keys.
+ */
+PG_FUNCTION_INFO_V1(itree_gin_fp_extract_value);
+Datum itree_gin_fp_extract_value(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    int32 *nkeys = (int32 *)PG_GETARG_POINTER(1);
+    uint32 fingerprints[ITREE_MAX_LEVELS];
+    int n = itree_prefix_fingerprints(tree, fingerprints);
+    Datum *keys;
+
+    *nkeys = 0;
+    if (n == 0) {
+        PG_RETURN_POINTER(NULL);
+    }
+    keys = (Datum *) palloc((n + 1) * sizeof(Datum));
+    for (int i = 0; i < n; i++) {
+        keys[i] = itree_gin_fp_key(fingerprints[i], false);
+    }
+    keys[n] = itree_gin_fp_key(fingerprints[n - 1], true);
+    *nkeys = n + 1;
+    PG_RETURN_POINTER(keys);
+}
+
+/**
+ * FUNCTION 3 itree_gin_fp_extract_query(itree, internal, smallint, internal, internal, internal, internal)
+ * <@ looks up the prefix key of the query, @> the self keys of its prefixes, as itree_extract_query(),
+ * ~ the prefix key of the fixed leading levels.
+ */
+PG_FUNCTION_INFO_V1(itree_gin_fp_extract_query);
+Datum itree_gin_fp_extract_query(PG_FUNCTION_ARGS) {
+    int32 *nkeys = (int32 *)PG_GETARG_POINTER(1);
+    StrategyNumber strategy = PG_GETARG_UINT16(2);
+    int32 *searchMode = (int32 *)PG_GETARG_POINTER(6);
+    uint32 fingerprints[ITREE_MAX_LEVELS];
+    itree prefix;
+    int n;
+    Datum *keys = NULL;
+
+    *nkeys = 0;
+    *searchMode = GIN_SEARCH_MODE_DEFAULT;
+    switch (strategy) {
+        case ITREE_GIN_DESCENDANT_STRATEGY:
+        case ITREE_GIN_MATCH_STRATEGY:
+            if (strategy == ITREE_GIN_MATCH_STRATEGY) {
+                // the query is an iquery here
+                iquery_fixed_prefix(PG_GETARG_IQUERY(0), &prefix);
+            } else {
+                prefix = *PG_GETARG_ITREE(0);
+            }
+            n = itree_prefix_fingerprints(&prefix, fingerprints);
+            if (n == 0) {
+                // every value is below the empty itree, a leading * matches any value
+                *searchMode = GIN_SEARCH_MODE_ALL;
+                break;
+            }
+            keys = (Datum *) palloc(sizeof(Datum));
+            keys[0] = itree_gin_fp_key(fingerprints[n - 1], false);
+            *nkeys = 1;
+            break;
+        case ITREE_GIN_ANCESTOR_STRATEGY:
+            n = itree_prefix_fingerprints(PG_GETARG_ITREE(0), fingerprints);
+            if (n == 0) {
+                // only the empty itree is above the empty itree
+                *searchMode = GIN_SEARCH_MODE_INCLUDE_EMPTY;
+                break;
+            }
+            keys = (Datum *) palloc(n * sizeof(Datum));
+            for (int i = 0; i < n; i++) {
+                keys[i] = itree_gin_fp_key(fingerprints[i], true);
+            }
+            *nkeys = n;
+            break;
+        default:
+            elog(ERROR, "unknown strategy number: %d", strategy);
+    }
+
+    PG_RETURN_POINTER(keys);
+}
+
+/**
+ * FUNCTION 4 itree_gin_fp_consistent(internal, smallint, itree, int, internal, internal, internal, internal)
+ * The one key of <@ and ~, any of the self keys of @>; always rechecked.
+ */
+PG_FUNCTION_INFO_V1(itree_gin_fp_consistent);
+Datum itree_gin_fp_consistent(PG_FUNCTION_ARGS) {
+    bool *check = (bool *)PG_GETARG_POINTER(0);
+    int32 nkeys = PG_GETARG_INT32(3);
+    bool *recheck = (bool *)PG_GETARG_POINTER(5);
+    bool result = nkeys == 0;
+
+    for (int i = 0; i < nkeys && !result; i++) {
+        result = check[i];
+    }
+    *recheck = true;
+    PG_RETURN_BOOL(result);
+}
+
+/**
+ * FUNCTION 6 itree_gin_fp_triconsistent(internal, smallint, itree, int, internal, internal, internal)
+ * GIN_FALSE when no key can be present, GIN_MAYBE otherwise: a present key may be a collision.
+ */
+PG_FUNCTION_INFO_V1(itree_gin_fp_triconsistent);
+Datum itree_gin_fp_triconsistent(PG_FUNCTION_ARGS) {
+    GinTernaryValue *check = (GinTernaryValue *)PG_GETARG_POINTER(0);
+    int32 nkeys = PG_GETARG_INT32(3);
+    GinTernaryValue result = nkeys == 0 ? GIN_MAYBE : GIN_FALSE;
+
+    for (int i = 0; i < nkeys && result == GIN_FALSE; i++) {
+        if (check[i] != GIN_FALSE) {
+            result = GIN_MAYBE;
+        }
+    }
+    PG_RETURN_GIN_TERNARY_VALUE(result);
+}
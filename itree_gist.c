@@ -0,0 +1,383 @@
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/gist.h"     // For GiST-specific types and functions
+#include "access/stratnum.h" // For StrategyNumber
+#include "utils/sortsupport.h"
+#include "port/pg_bitutils.h"
+#include "itree.h"
+
+/**
+ * GiST support for itree: every index key is the range [lower, upper] in btree order of the itree values below it.
+ * A leaf key is the range [value, value], so the indexed value can be returned for index-only scans.
+ *
+ * All descendants of an itree are one contiguous range in btree order, starting with the itree itself,
+ * and all values in a range share the common prefix of its bounds.
+ * That is enough to answer <@, @>, the btree operators and the tree distance <-> from the range alone.
+ *
+ * Strategy numbers follow the ltree GiST opclass:
+ * 1 <, 2 <=, 3 =, 4 >=, 5 >, 10 @>, 11 <@, 15 <-> (ORDER BY)
+ */
+#define ITREE_GIST_ANCESTOR_STRATEGY   10
+#define ITREE_GIST_DESCENDANT_STRATEGY 11
+#define ITREE_GIST_DISTANCE_STRATEGY   15
+
+typedef struct {
+    itree lower;
+    itree upper;
+} itree_gist_key;
+
+#define DatumGetITreeGistKey(X) ((itree_gist_key *)DatumGetPointer(X))
+
+
+/**
+ * itree_gist_key_in(cstring): keys only exist inside the index.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_key_in);
+Datum itree_gist_key_in(PG_FUNCTION_ARGS) {
+    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                    errmsg("itree_gist_key_in not implemented")));
+    PG_RETURN_POINTER(NULL);
+}
+
+/**
+ * itree_gist_key_out(itree_gist_key): [lower,upper], e.g. for gist_page_items() of pageinspect.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_key_out);
+Datum itree_gist_key_out(PG_FUNCTION_ARGS) {
+    itree_gist_key *key = DatumGetITreeGistKey(PG_GETARG_DATUM(0));
+    char *lower = DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(&key->lower)));
+    char *upper = DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(&key->upper)));
+
+    PG_RETURN_CSTRING(psprintf("[%s,%s]", lower, upper));
+}
+
+/**
+ * True if some descendant of query (or query itself) can be in [lower, upper].
+ * The descendants are the contiguous range from query to its last descendant,
+ * so upper must reach query and lower must not be past the last descendant.
+ */
+static bool itree_gist_range_has_descendant(const itree_gist_key *key, const itree *query) {
+    if (itree_packed_cmp(&key->upper, query) < 0) {
+        return false;
+    }
+    return itree_packed_cmp(&key->lower, query) <= 0 || itree_packed_is_prefix(query, &key->lower);
+}
+
+/**
+ * True if some ancestor of query (or query itself) can be in [lower, upper].
+ * The ancestors are the prefixes of query, in ascending btree order, one of them must be in the range.
+ */
+static bool itree_gist_range_has_ancestor(const itree_gist_key *key, const itree *query) {
+    uint32 starts = itree_packed_starts(query);
+    int len = itree_packed_len(query);
+    itree prefix;
+
+    if (itree_packed_cmp(&key->lower, query) > 0) {
+        return false; // all ancestors sort before query
+    }
+
+    // each segment start after the first one ends a prefix, the full length is the last one
+    starts = (starts & ~1u) | (1u << len);
+    while (starts) {
+        int end = pg_rightmost_one_pos32(starts);
+
+        starts &= starts - 1;
+        itree_prefix_copy(query, end, &prefix);
+        if (itree_packed_cmp(&prefix, &key->upper) > 0) {
+            return false; // prefixes only get bigger
+        }
+        if (itree_packed_cmp(&prefix, &key->lower) >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Lower bound of the tree distance from query to any value in [lower, upper].
+ * Outside the range the values share at most as many segments with query as the nearer bound,
+ * and every value has at least the segments the bounds have in common.
+ */
+static int itree_gist_range_distance(const itree_gist_key *key, const itree *query) {
+    int common;
+    int bound_common;
+    int distance;
+
+    if (itree_packed_cmp(query, &key->lower) < 0) {
+        common = itree_packed_lcp(query, &key->lower);
+    } else if (itree_packed_cmp(query, &key->upper) > 0) {
+        common = itree_packed_lcp(query, &key->upper);
+    } else {
+        return 0;
+    }
+
+    bound_common = itree_packed_lcp(&key->lower, &key->upper);
+    distance = itree_packed_depth(query) - common + Max(bound_common - common, 0);
+
+    // query is outside the range, so it is not one of the values
+    return Max(distance, 1);
+}
+
+/**
+ * FUNCTION 1 bool consistent(internal, itree, smallint, oid, internal)
+ * Leaf keys are a single value and are answered exactly, inner keys by their range.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_consistent);
+Datum itree_gist_consistent(PG_FUNCTION_ARGS) {
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    itree *query = PG_GETARG_ITREE(1);
+    StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+    itree_gist_key *key = DatumGetITreeGistKey(entry->key);
+    bool leaf = GIST_LEAF(entry);
+    bool result;
+
+    *recheck = false;
+
+    switch (strategy) {
+        case BTLessStrategyNumber:
+            result = itree_packed_cmp(&key->lower, query) < 0;
+            break;
+        case BTLessEqualStrategyNumber:
+            result = itree_packed_cmp(&key->lower, query) <= 0;
+            break;
+        case BTEqualStrategyNumber:
+            result = itree_packed_cmp(&key->lower, query) <= 0 && itree_packed_cmp(&key->upper, query) >= 0;
+            break;
+        case BTGreaterEqualStrategyNumber:
+            result = itree_packed_cmp(&key->upper, query) >= 0;
+            break;
+        case BTGreaterStrategyNumber:
+            result = itree_packed_cmp(&key->upper, query) > 0;
+            break;
+        case ITREE_GIST_ANCESTOR_STRATEGY: // value @> query
+            result = leaf ? itree_packed_is_prefix(&key->lower, query)
+                          : itree_gist_range_has_ancestor(key, query);
+            break;
+        case ITREE_GIST_DESCENDANT_STRATEGY: // value <@ query
+            result = leaf ? itree_packed_is_prefix(query, &key->lower)
+                          : itree_gist_range_has_descendant(key, query);
+            break;
+        default:
+            elog(ERROR, "unknown strategy number: %d", strategy);
+            result = false;
+    }
+
+    PG_RETURN_BOOL(result);
+}
+
+/**
+ * FUNCTION 2 itree_gist_key union(internal, internal): smallest lower and biggest upper bound.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_union);
+Datum itree_gist_union(PG_FUNCTION_ARGS) {
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    int *size = (int *) PG_GETARG_POINTER(1);
+    itree_gist_key *result = (itree_gist_key *) palloc(sizeof(itree_gist_key));
+    itree_gist_key *first = DatumGetITreeGistKey(entryvec->vector[0].key);
+
+    *result = *first;
+    for (int i = 1; i < entryvec->n; i++) {
+        itree_gist_key *key = DatumGetITreeGistKey(entryvec->vector[i].key);
+
+        if (itree_packed_cmp(&key->lower, &result->lower) < 0) {
+            result->lower = key->lower;
+        }
+        if (itree_packed_cmp(&key->upper, &result->upper) > 0) {
+            result->upper = key->upper;
+        }
+    }
+
+    *size = sizeof(itree_gist_key);
+    PG_RETURN_POINTER(result);
+}
+
+/**
+ * FUNCTION 3 compress(internal): a leaf value becomes the canonical range [value, value].
+ */
+PG_FUNCTION_INFO_V1(itree_gist_compress);
+Datum itree_gist_compress(PG_FUNCTION_ARGS) {
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *retval = entry;
+
+    if (entry->leafkey) {
+        itree_gist_key *key = (itree_gist_key *) palloc(sizeof(itree_gist_key));
+
+        itree_canonical_copy(DatumGetITree(entry->key), &key->lower);
+        key->upper = key->lower;
+
+        retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+        gistentryinit(*retval, PointerGetDatum(key), entry->rel, entry->page, entry->offset, false);
+    }
+
+    PG_RETURN_POINTER(retval);
+}
+
+/**
+ * FUNCTION 5 penalty(internal, internal, internal): how much the range grows,
+ * measured on the order preserving itree_order_key() of the bounds.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_penalty);
+Datum itree_gist_penalty(PG_FUNCTION_ARGS) {
+    GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+    float *penalty = (float *) PG_GETARG_POINTER(2);
+    itree_gist_key *orig = DatumGetITreeGistKey(origentry->key);
+    itree_gist_key *add = DatumGetITreeGistKey(newentry->key);
+    uint64 orig_lower = itree_order_key(&orig->lower);
+    uint64 orig_upper = itree_order_key(&orig->upper);
+    uint64 add_lower = itree_order_key(&add->lower);
+    uint64 add_upper = itree_order_key(&add->upper);
+    double growth = 0.0;
+
+    if (add_lower < orig_lower) {
+        growth += (double) (orig_lower - add_lower);
+    }
+    if (add_upper > orig_upper) {
+        growth += (double) (add_upper - orig_upper);
+    }
+
+    *penalty = (float) growth;
+    PG_RETURN_POINTER(penalty);
+}
+
+typedef struct {
+    OffsetNumber offset;
+    itree_gist_key *key;
+} itree_gist_split_item;
+
+static int itree_gist_split_cmp(const void *a, const void *b) {
+    const itree_gist_split_item *ia = (const itree_gist_split_item *) a;
+    const itree_gist_split_item *ib = (const itree_gist_split_item *) b;
+    int cmp = itree_packed_cmp(&ia->key->lower, &ib->key->lower);
+
+    return cmp != 0 ? cmp : itree_packed_cmp(&ia->key->upper, &ib->key->upper);
+}
+
+/**
+ * Extend the range of a split side with one key.
+ */
+static void itree_gist_key_extend(itree_gist_key *side, bool *exists, const itree_gist_key *key) {
+    if (!*exists) {
+        *side = *key;
+        *exists = true;
+        return;
+    }
+    if (itree_packed_cmp(&key->lower, &side->lower) < 0) {
+        side->lower = key->lower;
+    }
+    if (itree_packed_cmp(&key->upper, &side->upper) > 0) {
+        side->upper = key->upper;
+    }
+}
+
+/**
+ * FUNCTION 6 picksplit(internal, internal): sort the keys in btree order and split in the middle,
+ * so both pages cover disjoint ranges and subtrees stay together.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_picksplit);
+Datum itree_gist_picksplit(PG_FUNCTION_ARGS) {
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+    OffsetNumber maxoff = entryvec->n - 1;
+    int nitems = maxoff - FirstOffsetNumber + 1;
+    itree_gist_split_item *items = (itree_gist_split_item *) palloc(nitems * sizeof(itree_gist_split_item));
+    itree_gist_key *left = (itree_gist_key *) palloc(sizeof(itree_gist_key));
+    itree_gist_key *right = (itree_gist_key *) palloc(sizeof(itree_gist_key));
+    bool left_exists = false;
+    bool right_exists = false;
+    int i;
+
+    for (i = 0; i < nitems; i++) {
+        items[i].offset = FirstOffsetNumber + i;
+        items[i].key = DatumGetITreeGistKey(entryvec->vector[FirstOffsetNumber + i].key);
+    }
+    qsort(items, nitems, sizeof(itree_gist_split_item), itree_gist_split_cmp);
+
+    v->spl_left = (OffsetNumber *) palloc(nitems * sizeof(OffsetNumber));
+    v->spl_right = (OffsetNumber *) palloc(nitems * sizeof(OffsetNumber));
+    v->spl_nleft = 0;
+    v->spl_nright = 0;
+
+    for (i = 0; i < nitems; i++) {
+        if (i < nitems / 2) {
+            v->spl_left[v->spl_nleft++] = items[i].offset;
+            itree_gist_key_extend(left, &left_exists, items[i].key);
+        } else {
+            v->spl_right[v->spl_nright++] = items[i].offset;
+            itree_gist_key_extend(right, &right_exists, items[i].key);
+        }
+    }
+
+    v->spl_ldatum = PointerGetDatum(left);
+    v->spl_rdatum = PointerGetDatum(right);
+
+    pfree(items);
+    PG_RETURN_POINTER(v);
+}
+
+/**
+ * FUNCTION 7 same(itree_gist_key, itree_gist_key, internal)
+ */
+PG_FUNCTION_INFO_V1(itree_gist_same);
+Datum itree_gist_same(PG_FUNCTION_ARGS) {
+    itree_gist_key *a = DatumGetITreeGistKey(PG_GETARG_DATUM(0));
+    itree_gist_key *b = DatumGetITreeGistKey(PG_GETARG_DATUM(1));
+    bool *result = (bool *) PG_GETARG_POINTER(2);
+
+    *result = itree_packed_cmp(&a->lower, &b->lower) == 0 && itree_packed_cmp(&a->upper, &b->upper) == 0;
+    PG_RETURN_POINTER(result);
+}
+
+/**
+ * FUNCTION 8 distance(internal, itree, smallint, oid, internal): tree distance for ORDER BY id <-> query.
+ * Exact on leaf keys, a lower bound on inner keys.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_distance);
+Datum itree_gist_distance(PG_FUNCTION_ARGS) {
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    itree *query = PG_GETARG_ITREE(1);
+    StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+    itree_gist_key *key = DatumGetITreeGistKey(entry->key);
+
+    if (strategy != ITREE_GIST_DISTANCE_STRATEGY) {
+        elog(ERROR, "unknown strategy number: %d", strategy);
+    }
+
+    *recheck = false;
+    if (GIST_LEAF(entry)) {
+        PG_RETURN_FLOAT8((float8) itree_packed_distance(&key->lower, query));
+    }
+    PG_RETURN_FLOAT8((float8) itree_gist_range_distance(key, query));
+}
+
+/**
+ * FUNCTION 9 fetch(internal): the value of a leaf key for index-only scans.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_fetch);
+Datum itree_gist_fetch(PG_FUNCTION_ARGS) {
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    itree_gist_key *key = DatumGetITreeGistKey(entry->key);
+    itree *value = (itree *) palloc(sizeof(itree));
+    GISTENTRY *retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+
+    *value = key->lower;
+    gistentryinit(*retval, ITreeGetDatum(value), entry->rel, entry->page, entry->offset, false);
+    PG_RETURN_POINTER(retval);
+}
+
+static int itree_gist_key_fastcmp(Datum x, Datum y, SortSupport ssup) {
+    return itree_packed_cmp(&DatumGetITreeGistKey(x)->lower, &DatumGetITreeGistKey(y)->lower);
+}
+
+/**
+ * FUNCTION 11 sortsupport(internal): sorted index build, leaf keys in btree order.
+ */
+PG_FUNCTION_INFO_V1(itree_gist_sortsupport);
+Datum itree_gist_sortsupport(PG_FUNCTION_ARGS) {
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = itree_gist_key_fastcmp;
+    PG_RETURN_VOID();
+}
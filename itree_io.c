@@ -20,87 +20,187 @@
 #include "utils/array.h"
 #include "utils/typcache.h"
 #include "utils/memutils.h"
+#include "utils/builtins.h"
 #include "catalog/pg_type_d.h" 
+#include "libpq/pqformat.h"
 #include "itree.h"
 
 PG_MODULE_MAGIC;
 
+/**
+ * Raise the error of a value that does not fit in the 16 data bytes, what names it in the message.
+ */
+void itree_size_error(int sqlerrcode, const char *what) {
+    ereport(ERROR, (errcode(sqlerrcode),
+                    errmsg("%s exceeds max size of %d bytes", what, ITREE_MAX_LEVELS),
+                    errdetail("Segments up to 255 take 1 byte, larger segments take 2 bytes.")));
+}
+
+/**
+ * Parse the text form into dst with the errors of itree_in, for the functions that take an itree as text.
+ * Every segment must be 1..65535, separated by a single '.', with nothing before or after,
+ * and all segments must fit in the 16 data bytes.
+ */
+void itree_parse_text(const char *input, itree *dst) {
+    const char *error_at;
+    int nsegments;
+
+    switch (itree_parse(input, dst, &error_at, &nsegments)) {
+        case ITREE_PARSE_OK:
+            break;
+        case ITREE_PARSE_EMPTY_SEGMENT:
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for itree: \"%s\"", input),
+                            errdetail("Segment %d is empty.", nsegments)));
+            break;
+        case ITREE_PARSE_UNEXPECTED_CHAR:
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for itree: \"%s\"", input),
+                            errdetail("Unexpected character at position %d.", (int) (error_at - input) + 1)));
+            break;
+        case ITREE_PARSE_OUT_OF_RANGE:
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("itree segment must be in range 1..65535 (got %.*s)",
+                                   (int) strspn(error_at, "0123456789"), error_at)));
+            break;
+        case ITREE_PARSE_TOO_LONG:
+            itree_size_error(ERRCODE_INVALID_TEXT_REPRESENTATION, "itree");
+            break;
+    }
+}
+
+/**
+ * Text input, parsed by itree_parse() in one pass.
+ */
 PG_FUNCTION_INFO_V1(itree_in);
 Datum itree_in(PG_FUNCTION_ARGS) {
-    char *input = PG_GETARG_CSTRING(0);
+    itree *result = (itree *) palloc(ITREE_SIZE);
 
-    // Handle the special case where the input is "NULL"
-    if (input == NULL || strcmp(input, "NULL") == 0 ||!input || !*input) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                        errmsg("invalid input syntax for itree: \"%s\"", input)));
-    }
+    itree_parse_text(PG_GETARG_CSTRING(0), result);
+    PG_RETURN_ITREE(result);
+}
 
-    itree *result = (itree *)palloc(ITREE_SIZE);
-    int levels = 0, byte_pos = 0;
-    char *ptr = input;
+/**
+ * Convert an itree Datum to cstring, formatted by itree_format() straight into the result.
+ */
+PG_FUNCTION_INFO_V1(itree_out);
+Datum itree_out(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    char *result = palloc(ITREE_MAX_TEXT_LEN + 1);
 
-    result->control[0] = 0xFF;
-    result->control[1] = 0xFF;
-    memset(result->data, 0, sizeof(result->data));
+    itree_format(tree, result);
+    PG_RETURN_CSTRING(result);
+}
 
-    while (levels < ITREE_MAX_LEVELS && byte_pos < ITREE_MAX_LEVELS) {
-        long val = strtol(ptr, &ptr, 10);//get the value and move the pointer
-        if (val <= 0 || val > 65535) {
-            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                            errmsg("itree segment must be in range 1..65535 (got %ld)", val)));
-        }
+/**
+ * Control bits on the wire are a big endian 16 bit word with the bit of data[i] at position 15 - i,
+ * as ITree.value and ITree.from_bytes in type.py, the reverse of ITREE_CONTROL_WORD.
+ */
+static uint32 itree_reverse_control(uint32 ctrl) {
+    uint32 result = 0;
 
-         // defensive:  start of a new segment - set control bit to 1
-        set_control_bit(result, byte_pos, 1);
-
-        if (val <= 255) {
-            result->data[byte_pos++] = (uint8_t)val;
-        } else  {
-            // 2-byte segment: store high then low byte
-            result->data[byte_pos] = (uint8_t)(val >> 8);
-            // Set control bit for the second byte to 0 (continuation)
-            set_control_bit(result, byte_pos + 1, 0);
-            result->data[byte_pos + 1] = (uint8_t)(val & 0xFF);
-            byte_pos += 2;
+    for (int i = 0; i < ITREE_MAX_LEVELS; i++) {
+        if (ctrl & (1u << i)) {
+            result |= 1u << (ITREE_MAX_LEVELS - 1 - i);
         }
-        levels++;
-
-        // Advance ptr to next segment separator, if any
-        if (*ptr == '.') ptr++;
-        else break;
-    }
-              
-    if (levels > ITREE_MAX_LEVELS) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                        errmsg("itree exceeds max levels (%d)", ITREE_MAX_LEVELS)));
     }
+    return result;
+}
 
-    PG_RETURN_ITREE(result);
+/**
+ * Binary output: the 18 byte layout of type.py, a 2 byte big endian control word
+ * followed by the 16 data bytes, always in the canonical form.
+ */
+PG_FUNCTION_INFO_V1(itree_send);
+Datum itree_send(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    itree canonical;
+    StringInfoData buf;
+
+    itree_canonical_copy(tree, &canonical);
+
+    pq_begintypsend(&buf);
+    pq_sendint16(&buf, (uint16) itree_reverse_control(ITREE_CONTROL_WORD(&canonical)));
+    pq_sendbytes(&buf, (const char *) canonical.data, ITREE_MAX_LEVELS);
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
-/** Convert an itree Datum to cstring */
-PG_FUNCTION_INFO_V1(itree_out);
-Datum itree_out(PG_FUNCTION_ARGS) {
-    if (PG_ARGISNULL(0)) {
-        PG_RETURN_CSTRING(pstrdup("NULL"));
+/**
+ * Binary input of the itree_send layout.
+ * Rejects anything itree_in could not have produced:
+ * an empty itree, a continuation bit that does not follow the first byte of a segment,
+ * a 0 byte inside a segment start and data or continuation bits after the end.
+ */
+PG_FUNCTION_INFO_V1(itree_recv);
+Datum itree_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    uint32 ctrl = itree_reverse_control(pq_getmsgint(buf, 2));
+    const uint8_t *data = (const uint8_t *) pq_getmsgbytes(buf, ITREE_MAX_LEVELS);
+    itree *result = init_itree();
+    bool ended = false;
+    bool after_start = false;
+
+    if (data[0] == 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid itree binary value: no segments")));
     }
 
-    itree *tree = PG_GETARG_ITREE(0);
-    char buffer[ITREE_MAX_LEVELS * 6];
-    int len = 0;
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
-
-    for (int i = 0; i < seg_count; i++) {
-        if (i > 0) buffer[len++] = '.';
-        len += sprintf(buffer + len, "%u", segments[i]);
+    for (int i = 0; i < ITREE_MAX_LEVELS; i++) {
+        bool start = (ctrl >> i) & 1;
+
+        if (ended) {
+            if (!start || data[i] != 0) {
+                ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                                errmsg("invalid itree binary value: data after the end at byte %d", i)));
+            }
+            continue;
+        }
+
+        if (start) {
+            ended = data[i] == 0;
+            after_start = !ended;
+        } else {
+            if (!after_start) {
+                ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                                errmsg("invalid itree binary value: continuation without a segment start at byte %d", i)));
+            }
+            after_start = false;
+        }
+        result->data[i] = data[i];
     }
 
-    char *result = palloc(len + 1);
+    result->control[0] = (uint8_t)(ctrl & 0xFF);
+    result->control[1] = (uint8_t)(ctrl >> 8);
+    PG_RETURN_ITREE(result);
+}
 
-    memcpy(result, buffer, len);
-    result[len] = '\0';
-    PG_RETURN_CSTRING(result);
+/**
+ * Text form of a value stored by itree 1.0, which declared 16 bytes for the type: only the control word and
+ * data[0..13] are on disk, the 2 bytes after them belong to the next field. Used once by ALTER EXTENSION
+ * itree UPDATE to rewrite the stored columns through text.
+ * 1.0 started from a control word of 0xFFFF, so the end marker of a value of 14 data bytes was the lost
+ * data[14] and is put back as a 0 byte. Values of 15 or 16 data bytes lost their tail in 1.0 already,
+ * they keep the segments that end within data[0..13].
+ */
+PG_FUNCTION_INFO_V1(itree_legacy_text);
+Datum itree_legacy_text(PG_FUNCTION_ARGS) {
+    const char *stored = (const char *) PG_GETARG_POINTER(0);
+    itree tree;
+    itree canonical;
+    char *result = palloc(ITREE_MAX_TEXT_LEN + 1);
+    int len;
+
+    memset(&tree, 0, sizeof(tree));
+    memcpy(&tree, stored, ITREE_LEGACY_SIZE);
+
+    len = itree_packed_len(&tree);
+    if (len > ITREE_LEGACY_SIZE - 2) {
+        // no start bit at data[14]: the 2 byte segment at data[13] lost its second byte
+        len = ITREE_LEGACY_SIZE - 3;
+    }
+    itree_prefix_copy(&tree, len, &canonical);
+    itree_format(&canonical, result);
+    PG_RETURN_TEXT_P(cstring_to_text(result));
 }
 
 PG_FUNCTION_INFO_V1(itree_typmod_in);
@@ -0,0 +1,153 @@
+/**
+ * itree_key: the same values as itree, stored in the memcmp ordered form of itree_key_encode().
+ * Equality, ordering, hashing and the subtree tests are plain byte operations on the stored bytes,
+ * for key columns that are mostly compared, sorted, joined and grouped.
+ * Text and binary I/O are the ones of itree, every other itree function takes it through the implicit cast.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "common/hashfn.h"
+#include "utils/sortsupport.h"
+#include "itree.h"
+
+#define DatumGetITreeKey(X) ((itree_key *) DatumGetPointer(X))
+#define PG_GETARG_ITREE_KEY(n) DatumGetITreeKey(PG_GETARG_DATUM(n))
+
+static Datum itree_key_from_itree(const itree *tree) {
+    itree_key *key = (itree_key *) palloc(sizeof(itree_key));
+
+    itree_key_encode(tree, key);
+    return PointerGetDatum(key);
+}
+
+static Datum itree_key_to_itree_datum(const itree_key *key) {
+    itree *tree = (itree *) palloc(sizeof(itree));
+
+    itree_key_decode(key, tree);
+    return ITreeGetDatum(tree);
+}
+
+PG_FUNCTION_INFO_V1(itree_key_in);
+Datum itree_key_in(PG_FUNCTION_ARGS) {
+    Datum tree = DirectFunctionCall1(itree_in, PG_GETARG_DATUM(0));
+
+    return itree_key_from_itree(DatumGetITree(tree));
+}
+
+PG_FUNCTION_INFO_V1(itree_key_out);
+Datum itree_key_out(PG_FUNCTION_ARGS) {
+    return DirectFunctionCall1(itree_out, itree_key_to_itree_datum(PG_GETARG_ITREE_KEY(0)));
+}
+
+/**
+ * Binary input and output in the itree_send() layout, a client does not see the key form.
+ */
+PG_FUNCTION_INFO_V1(itree_key_recv);
+Datum itree_key_recv(PG_FUNCTION_ARGS) {
+    Datum tree = DirectFunctionCall1(itree_recv, PG_GETARG_DATUM(0));
+
+    return itree_key_from_itree(DatumGetITree(tree));
+}
+
+PG_FUNCTION_INFO_V1(itree_key_send);
+Datum itree_key_send(PG_FUNCTION_ARGS) {
+    return DirectFunctionCall1(itree_send, itree_key_to_itree_datum(PG_GETARG_ITREE_KEY(0)));
+}
+
+/**
+ * Casts itree → itree_key (assignment, e.g. ALTER COLUMN ... TYPE itree_key) and itree_key → itree (implicit).
+ */
+PG_FUNCTION_INFO_V1(itree_to_key);
+Datum itree_to_key(PG_FUNCTION_ARGS) {
+    return itree_key_from_itree(PG_GETARG_ITREE(0));
+}
+
+PG_FUNCTION_INFO_V1(itree_key_to_itree);
+Datum itree_key_to_itree(PG_FUNCTION_ARGS) {
+    return itree_key_to_itree_datum(PG_GETARG_ITREE_KEY(0));
+}
+
+static inline int itree_key_memcmp(const itree_key *a, const itree_key *b) {
+    return memcmp(a->bytes, b->bytes, sizeof(a->bytes));
+}
+
+PG_FUNCTION_INFO_V1(itree_key_cmp);
+Datum itree_key_cmp(PG_FUNCTION_ARGS) {
+    int cmp = itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1));
+
+    PG_RETURN_INT32((cmp > 0) - (cmp < 0));
+}
+
+PG_FUNCTION_INFO_V1(itree_key_lt);
+Datum itree_key_lt(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)) < 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_key_le);
+Datum itree_key_le(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_key_eq);
+Datum itree_key_eq(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)) == 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_key_ne);
+Datum itree_key_ne(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)) != 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_key_ge);
+Datum itree_key_ge(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)) >= 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_key_gt);
+Datum itree_key_gt(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_memcmp(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)) > 0);
+}
+
+static int itree_key_fastcmp(Datum x, Datum y, SortSupport ssup) {
+    return itree_key_memcmp(DatumGetITreeKey(x), DatumGetITreeKey(y));
+}
+
+/**
+ * FUNCTION 2 itree_key_sortsupport(internal): the comparator is a memcmp() without fmgr overhead.
+ */
+PG_FUNCTION_INFO_V1(itree_key_sortsupport);
+Datum itree_key_sortsupport(PG_FUNCTION_ARGS) {
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = itree_key_fastcmp;
+    PG_RETURN_VOID();
+}
+
+/**
+ * Hash of the stored bytes, equal keys are byte equal.
+ */
+PG_FUNCTION_INFO_V1(itree_key_hash);
+Datum itree_key_hash(PG_FUNCTION_ARGS) {
+    return hash_any(PG_GETARG_ITREE_KEY(0)->bytes, sizeof(itree_key));
+}
+
+PG_FUNCTION_INFO_V1(itree_key_hash_extended);
+Datum itree_key_hash_extended(PG_FUNCTION_ARGS) {
+    return hash_any_extended(PG_GETARG_ITREE_KEY(0)->bytes, sizeof(itree_key), (uint64) PG_GETARG_INT64(1));
+}
+
+/**
+ * child <@ parent
+ */
+PG_FUNCTION_INFO_V1(itree_key_is_descendant);
+Datum itree_key_is_descendant(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_is_prefix(PG_GETARG_ITREE_KEY(1), PG_GETARG_ITREE_KEY(0)));
+}
+
+/**
+ * parent @> child
+ */
+PG_FUNCTION_INFO_V1(itree_key_is_ancestor);
+Datum itree_key_is_ancestor(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_key_is_prefix(PG_GETARG_ITREE_KEY(0), PG_GETARG_ITREE_KEY(1)));
+}
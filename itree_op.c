@@ -4,7 +4,11 @@
 #include <assert.h>
 #include "postgres.h"
 #include "fmgr.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/sortsupport.h"
+#include "lib/hyperloglog.h"
+#include "common/hashfn.h"
 #include "itree.h"
 
 
@@ -25,29 +29,16 @@ itree *init_itree() {
  * @return Pointer to the newly created itree.
  */
 itree *create_itree_from_segments(const uint16_t *segments) {
-    // Allocate memory for the itree
-    itree *result = init_itree();
-    int byte_pos = 0;
+    itree *result = (itree *) palloc(sizeof(itree));
+    int count = 0;
 
-    for (int i = 0; i < ITREE_MAX_LEVELS; i++) {
-        if (segments[i] == 0) {
-            break; // Stop processing when encountering an unused segment
-        }
-
-        if (segments[i] <= 255) { // 1-byte segment
-            result->data[byte_pos] = (uint8_t)segments[i];
-            set_control_bit(result, byte_pos, 1);
-            byte_pos++;
-        } else { // 2-byte segment
-            result->data[byte_pos] = (uint8_t)(segments[i] >> 8);
-            set_control_bit(result, byte_pos, 1);
-            byte_pos++;
-            result->data[byte_pos] = (uint8_t)(segments[i] & 0xFF);
-            set_control_bit(result, byte_pos, 0); // continuation
-            byte_pos++;
-        }
+    while (count < ITREE_MAX_LEVELS && segments[count] != 0) {
+        count++;
+    }
+    if (!itree_set_segments(segments, count, result)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("itree exceeds max size of %d bytes", ITREE_MAX_LEVELS)));
     }
-
     return result;
 }
 
@@ -102,106 +93,63 @@ void set_control_bit(itree* tree_instance, int data_index, int bit_value) {
 }
 
 /**
- * Get number of segments and extract them
+ * The matcher of the ancestor operand of <@ and @>, kept in fn_extra while the operand stays the same:
+ * in a seq scan with id <@ '1.2' it is prepared once, every row only compares its own bytes.
  */
-int itree_get_segments(itree *tree, uint16_t *segments) {
-    int seg_count = 0;
-    int byte_pos = 0;
-
-    while (byte_pos < ITREE_MAX_LEVELS) {
-        // End of itree: data byte is 0 and control bit is 1 (start of segment)
-        if (tree->data[byte_pos] == 0 && get_control_bit(tree, byte_pos))
-            break;
-
-        // If this byte starts a new segment
-        if (get_control_bit(tree, byte_pos)) {
-            // Check if next byte is part of this segment (2-byte segment)
-            if (byte_pos + 1 < ITREE_MAX_LEVELS && !get_control_bit(tree, byte_pos + 1)) {
-                segments[seg_count++] = ((uint16_t)tree->data[byte_pos] << 8) | tree->data[byte_pos + 1];
-                byte_pos += 2;
-                continue;
-            } else {   // Single byte segment
-                segments[seg_count++] = tree->data[byte_pos];
-            }
-        }
-        byte_pos++;
+typedef struct {
+    itree source; // the operand as passed, compared bytewise on each call
+    itree_prefix_matcher matcher;
+} itree_matcher_cache;
+
+static const itree_prefix_matcher *itree_cached_matcher(FunctionCallInfo fcinfo, const itree *prefix,
+                                                        itree_prefix_matcher *local) {
+    itree_matcher_cache *cache;
+
+    if (fcinfo->flinfo == NULL) {
+        itree_prefix_matcher_init(prefix, local);
+        return local;
+    }
+    cache = (itree_matcher_cache *) fcinfo->flinfo->fn_extra;
+    if (cache == NULL) {
+        cache = (itree_matcher_cache *) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(itree_matcher_cache));
+        fcinfo->flinfo->fn_extra = cache;
+    } else if (memcmp(&cache->source, prefix, sizeof(itree)) == 0) {
+        return &cache->matcher;
     }
-    return seg_count;
+    cache->source = *prefix;
+    itree_prefix_matcher_init(prefix, &cache->matcher);
+    return &cache->matcher;
 }
 
- /**
-  * Check if the first itree is a descendant of the second.
-  * child <@ parent
-  */
- PG_FUNCTION_INFO_V1(itree_is_descendant);
- Datum itree_is_descendant(PG_FUNCTION_ARGS) {
-     itree *child = PG_GETARG_ITREE(0);
-     itree *parent = PG_GETARG_ITREE(1);
-     uint16_t child_segs[ITREE_MAX_LEVELS] = {0};
-     uint16_t parent_segs[ITREE_MAX_LEVELS] = {0};
-     int child_len = itree_get_segments(child, child_segs);
-     int parent_len = itree_get_segments(parent, parent_segs);
- 
-     // Child must be longer or equal?(like ltree) and match the start of parent's segments
-     if (child_len < parent_len) {
-         PG_RETURN_BOOL(false);
-     }
- 
-     for (int i = 0; i < parent_len; i++) {
-         if (child_segs[i] != parent_segs[i]) {
-             PG_RETURN_BOOL(false);
-         }
-     }
- 
-     PG_RETURN_BOOL(true);
- }
- 
- /**
-  * Check if the first itree is an ancestor of the second.
-  * parent @> child
-  */
- PG_FUNCTION_INFO_V1(itree_is_ancestor);
- Datum itree_is_ancestor(PG_FUNCTION_ARGS) {
-     itree *parent = PG_GETARG_ITREE(0);
-     itree *child = PG_GETARG_ITREE(1);
-     uint16_t parent_segs[ITREE_MAX_LEVELS] = {0};
-     uint16_t child_segs[ITREE_MAX_LEVELS] = {0};
-     int parent_len = itree_get_segments(parent, parent_segs);
-     int child_len = itree_get_segments(child, child_segs);
- 
-     // Parent must be shorter or equal?(like ltree) and match the start of child's segments
-     if (parent_len > child_len) {
-         PG_RETURN_BOOL(false);
-     }
- 
-     for (int i = 0; i < parent_len; i++) {
-         if (parent_segs[i] != child_segs[i]) {
-             PG_RETURN_BOOL(false);
-         }
-     }
- 
-     PG_RETURN_BOOL(true);
- }
+/**
+ * Check if the first itree is a descendant of the second.
+ * child <@ parent
+ */
+PG_FUNCTION_INFO_V1(itree_is_descendant);
+Datum itree_is_descendant(PG_FUNCTION_ARGS) {
+    itree *child = PG_GETARG_ITREE(0);
+    itree_prefix_matcher local;
+
+    PG_RETURN_BOOL(itree_prefix_matcher_test(itree_cached_matcher(fcinfo, PG_GETARG_ITREE(1), &local), child));
+}
 
 /**
- * Compare two itree values: -1 (a < b), 0 (a = b), 1 (a > b)
+ * Check if the first itree is an ancestor of the second.
+ * parent @> child
  */
-static int int_itree_cmp(itree *a, itree *b) {
-    uint16_t a_segs[ITREE_MAX_LEVELS] = {0};
-    uint16_t b_segs[ITREE_MAX_LEVELS] = {0};
-    int a_len = itree_get_segments(a, a_segs);
-    int b_len = itree_get_segments(b, b_segs);
-    int i;
+PG_FUNCTION_INFO_V1(itree_is_ancestor);
+Datum itree_is_ancestor(PG_FUNCTION_ARGS) {
+    itree *child = PG_GETARG_ITREE(1);
+    itree_prefix_matcher local;
 
-    for (i = 0; i < a_len && i < b_len; i++) {
-        if (a_segs[i] < b_segs[i]) return -1;
-        if (a_segs[i] > b_segs[i]) return 1;
-    }
+    PG_RETURN_BOOL(itree_prefix_matcher_test(itree_cached_matcher(fcinfo, PG_GETARG_ITREE(0), &local), child));
+}
 
-    // If equal up to shorter length, shorter wins
-    if (a_len < b_len) return -1;
-    if (a_len > b_len) return 1;
-    return 0;
+/**
+ * Compare two itree values: -1 (a < b), 0 (a = b), 1 (a > b)
+ */
+static inline int int_itree_cmp(itree *a, itree *b) {
+    return itree_packed_cmp(a, b);
 }
 
  /**
@@ -239,6 +187,128 @@ Datum itree_cmp(PG_FUNCTION_ARGS) {
     PG_RETURN_INT32(int_itree_cmp(a, b));
 }
 
+/**
+ * Hash of the canonical packed bytes, for hash joins, hash aggregates and hash partitioning.
+ */
+PG_FUNCTION_INFO_V1(itree_hash);
+Datum itree_hash(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    itree canonical;
+
+    itree_canonical_copy(tree, &canonical);
+    return hash_any((unsigned char *) &canonical, sizeof(itree));
+}
+
+PG_FUNCTION_INFO_V1(itree_hash_extended);
+Datum itree_hash_extended(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    uint64 seed = (uint64) PG_GETARG_INT64(1);
+    itree canonical;
+
+    itree_canonical_copy(tree, &canonical);
+    return hash_any_extended((unsigned char *) &canonical, sizeof(itree), seed);
+}
+
+/**
+ * Sort support state for the abbreviated keys cardinality estimate.
+ */
+typedef struct {
+    int64 input_count;          // number of non-null values seen
+    bool estimating;            // still estimating the cardinality
+    hyperLogLogState abbr_card; // cardinality estimator of the abbreviated keys
+} itree_sortsupport_state;
+
+static int itree_fastcmp(Datum x, Datum y, SortSupport ssup) {
+    return int_itree_cmp(DatumGetITree(x), DatumGetITree(y));
+}
+
+/**
+ * Abbreviated keys are unsigned integers in the order of the full values.
+ */
+static int itree_cmp_abbrev(Datum x, Datum y, SortSupport ssup) {
+    return (x > y) - (x < y);
+}
+
+/**
+ * Abbreviated key: the itree_order_key() of the value, cut to the Datum width.
+ */
+static Datum itree_abbrev_convert(Datum original, SortSupport ssup) {
+    itree_sortsupport_state *state = (itree_sortsupport_state *) ssup->ssup_extra;
+    uint64 key = itree_order_key(DatumGetITree(original));
+
+    state->input_count++;
+    if (state->estimating) {
+        uint32 tmp = (uint32) key ^ (uint32) (key >> 32);
+
+        addHyperLogLog(&state->abbr_card, DatumGetUInt32(hash_uint32(tmp)));
+    }
+
+#if SIZEOF_DATUM == 8
+    return UInt64GetDatum(key);
+#else
+    return UInt32GetDatum((uint32) (key >> 32));
+#endif
+}
+
+/**
+ * Stop abbreviating when the keys are mostly equal, e.g. deep itrees under a few roots
+ * where the leading 8 bytes rarely differ. Same thresholds as the uuid sort support.
+ */
+static bool itree_abbrev_abort(int memtupcount, SortSupport ssup) {
+    itree_sortsupport_state *state = (itree_sortsupport_state *) ssup->ssup_extra;
+    double abbr_card;
+
+    if (memtupcount < 10000 || state->input_count < 10000 || !state->estimating) {
+        return false;
+    }
+
+    abbr_card = estimateHyperLogLog(&state->abbr_card);
+
+    // enough distinct keys, stop counting and keep abbreviating
+    if (abbr_card > 100000.0) {
+        state->estimating = false;
+        return false;
+    }
+
+    // less than 1 distinct key per 2000 values, the full compare is cheaper
+    if (abbr_card < state->input_count / 2000.0 + 0.5) {
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * FUNCTION 2 itree_sortsupport(internal) for btree sorts and index builds.
+ * Sets a direct comparator without fmgr overhead and abbreviated keys when asked for.
+ */
+PG_FUNCTION_INFO_V1(itree_sortsupport);
+Datum itree_sortsupport(PG_FUNCTION_ARGS) {
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = itree_fastcmp;
+    ssup->ssup_extra = NULL;
+
+    if (ssup->abbreviate) {
+        MemoryContext old_context = MemoryContextSwitchTo(ssup->ssup_cxt);
+        itree_sortsupport_state *state = palloc(sizeof(itree_sortsupport_state));
+
+        state->input_count = 0;
+        state->estimating = true;
+        initHyperLogLog(&state->abbr_card, 10);
+
+        ssup->ssup_extra = state;
+        ssup->abbrev_full_comparator = ssup->comparator;
+        ssup->comparator = itree_cmp_abbrev;
+        ssup->abbrev_converter = itree_abbrev_convert;
+        ssup->abbrev_abort = itree_abbrev_abort;
+
+        MemoryContextSwitchTo(old_context);
+    }
+
+    PG_RETURN_VOID();
+}
+
 PG_FUNCTION_INFO_V1(itree_lt);
 Datum itree_lt(PG_FUNCTION_ARGS) {
     itree *a = PG_GETARG_ITREE(0);
@@ -267,104 +337,78 @@ Datum itree_ge(PG_FUNCTION_ARGS) {
     PG_RETURN_BOOL(int_itree_cmp(a, b) >= 0);
 }
 
+/**
+ * itree <-> itree: tree distance, the number of edges on the path between the two nodes.
+ * '1.2.3' <-> '1.4' → 3
+ */
+PG_FUNCTION_INFO_V1(itree_distance);
+Datum itree_distance(PG_FUNCTION_ARGS) {
+    itree *a = PG_GETARG_ITREE(0);
+    itree *b = PG_GETARG_ITREE(1);
+    PG_RETURN_INT32(itree_packed_distance(a, b));
+}
+
 PG_FUNCTION_INFO_V1(ilevel);
 Datum ilevel(PG_FUNCTION_ARGS) {
     itree *tree = PG_GETARG_ITREE(0);
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
-    PG_RETURN_INT32(seg_count);
+    PG_RETURN_INT32(itree_packed_depth(tree));
 }
 
 
 /**
- * Concatenate two itree values.
- * This function assumes that the two itrees are valid and do not exceed the maximum levels.
- * It creates a new itree by concatenating the segments of both itrees.
+ * itree || itree: the data bytes and control bits of b are appended to those of a, nothing is decoded.
+ * '1.2' || '300.4' → 1.2.300.4
  */
 PG_FUNCTION_INFO_V1(itree_additree);
 Datum itree_additree(PG_FUNCTION_ARGS) {
     itree *a = PG_GETARG_ITREE(0);
     itree *b = PG_GETARG_ITREE(1);
-    uint16_t a_segments[ITREE_MAX_LEVELS] = {0};
-    uint16_t b_segments[ITREE_MAX_LEVELS] = {0};
+    itree *result = (itree *) palloc(sizeof(itree));
 
-    int a_seg_count = itree_get_segments(a, a_segments);
-    int b_seg_count = itree_get_segments(b, b_segments);
-
-    if( a_seg_count + b_seg_count > ITREE_MAX_LEVELS) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                        errmsg("itree concatenation exceeds maximum levels")));
+    if (!itree_splice_copy(a, itree_packed_len(a), b, 0, itree_packed_len(b), result)) {
+        itree_size_error(ERRCODE_INVALID_PARAMETER_VALUE, "itree concatenation");
     }
-
-    uint16_t all_segments[ITREE_MAX_LEVELS] = {0};
-
-    // Copy segments from a and b to all_segments
-    memcpy(all_segments, a_segments, sizeof(uint16_t) * a_seg_count);
-    memcpy(all_segments + a_seg_count, b_segments, sizeof(uint16_t) * b_seg_count);
-    
-    itree *result = create_itree_from_segments(all_segments);
-
     PG_RETURN_ITREE(result);
 }
 
-
 /**
- * Concatenate an itree with a single integer.
- * This function creates a new itree by appending the integer to the existing itree.
+ * itree || integer: appends one segment, the child n of a parent.
+ * '1.2' || 300 → 1.2.300
  */
 PG_FUNCTION_INFO_V1(itree_addint);
 Datum itree_addint(PG_FUNCTION_ARGS) {
     itree *tree = PG_GETARG_ITREE(0);
-    int32_t value = PG_GETARG_INT32(1);
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
+    int32 value = PG_GETARG_INT32(1);
+    itree *result = (itree *) palloc(sizeof(itree));
 
-    if (seg_count >= ITREE_MAX_LEVELS) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                        errmsg("itree concatenation exceeds maximum levels")));
+    if (value < 1 || value > 65535) {
+        ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                        errmsg("itree segment must be in range 1..65535 (got %d)", value)));
+    }
+    if (!itree_append_segment(tree, (uint16_t) value, result)) {
+        itree_size_error(ERRCODE_INVALID_PARAMETER_VALUE, "itree concatenation");
     }
-
-    segments[seg_count] = (uint16_t)value;
-
-    itree *result = create_itree_from_segments(segments);
-
     PG_RETURN_ITREE(result);
 }
 
 /**
- * Concatenate an itree with a text value.
- * This function creates a new itree by appending the segments of the text value to the existing itree.
+ * itree || text: appends the segments of the text form, with the input errors of itree.
+ * '1.2' || '3.4'::text → 1.2.3.4
  */
 PG_FUNCTION_INFO_V1(itree_addtext);
 Datum itree_addtext(PG_FUNCTION_ARGS) {
     itree *tree = PG_GETARG_ITREE(0);
-    text *text_value = PG_GETARG_TEXT_P(1);
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
-
-    char *cstring_value = text_to_cstring(text_value);
-    itree *text_itree = (itree *) DatumGetPointer(DirectFunctionCall1(itree_in, CStringGetDatum(cstring_value)));
-
-    uint16_t result_segments[ITREE_MAX_LEVELS] = {0};
-    int text_count = itree_get_segments(text_itree, result_segments);
+    char *input = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    itree *result = (itree *) palloc(sizeof(itree));
+    itree tail;
 
-
-    if ( seg_count + text_count > ITREE_MAX_LEVELS) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                        errmsg("itree concatenation exceeds maximum levels")));
+    itree_parse_text(input, &tail);
+    if (!itree_splice_copy(tree, itree_packed_len(tree), &tail, 0, itree_packed_len(&tail), result)) {
+        itree_size_error(ERRCODE_INVALID_PARAMETER_VALUE, "itree concatenation");
     }
-
-    // Copy segments from the original itree and the text itree to the result
-    memcpy(result_segments, segments, sizeof(uint16_t) * seg_count);
-    memcpy(result_segments + seg_count, result_segments, sizeof(uint16_t) * text_count);
-
-    itree *result = create_itree_from_segments(result_segments);
-
     PG_RETURN_ITREE(result);
 }
 
-
-
 /**
  * subitree ( itree, start integer, end integer ) → itree
  * 
@@ -376,25 +420,15 @@ Datum subitree(PG_FUNCTION_ARGS) {
     itree *tree = PG_GETARG_ITREE(0);
     int start = PG_GETARG_INT32(1);
     int end = PG_GETARG_INT32(2);
+    int depth = itree_packed_depth(tree);
+    itree *result;
 
-    if (start < 0 || end < 0 || start >= ITREE_MAX_LEVELS || end >= ITREE_MAX_LEVELS) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                        errmsg("itree subpath out of bounds")));
-    }
-
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
-
-    if (start >= seg_count || end > seg_count) {
+    if (start < 0 || start >= depth || end < start || end > depth) {
         ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                         errmsg("itree subpath out of bounds")));
     }
-
-    uint16_t sub_segments[ITREE_MAX_LEVELS] = {0};
-    memcpy(sub_segments, segments + start, sizeof(uint16_t) * (end - start));
-
-    itree *result = create_itree_from_segments(sub_segments);
-
+    result = (itree *) palloc(sizeof(itree));
+    itree_splice_copy(tree, 0, tree, itree_level_len(tree, start), itree_level_len(tree, end), result);
     PG_RETURN_ITREE(result);
 }
 
@@ -409,36 +443,197 @@ Datum subitree(PG_FUNCTION_ARGS) {
  * Get the parent:
  * subpath('1.2.3.4.5', 0, -1) → 1.2.3.4 
  * 
+ * The segment bounds come from the control bits, the bytes between them are copied as they are.
  */
 PG_FUNCTION_INFO_V1(subpath);
 Datum subpath(PG_FUNCTION_ARGS) {
     itree *tree = PG_GETARG_ITREE(0);
     int offset = PG_GETARG_INT32(1);
     int len = PG_GETARG_INT32(2);
+    int depth = itree_packed_depth(tree);
+    itree *result;
 
-    uint16_t segments[ITREE_MAX_LEVELS] = {0};
-    int seg_count = itree_get_segments(tree, segments);
-    
     // Adjust offset if negative
     if (offset < 0) {
-        offset = seg_count + offset; // Start from the end
+        offset = depth + offset; // Start from the end
     }
 
     // Adjust len if negative
     if (len < 0) {
-        len = seg_count + len - offset; // Exclude segments from the end
+        len = depth + len - offset; // Exclude segments from the end
     }
 
-    // Validate adjusted offset and len
-    if (offset < 0 || offset >= seg_count || len < 0 || offset + len > seg_count) {
+    // Validate adjusted offset and len, as int64 so a huge len can't wrap around
+    if (offset < 0 || offset >= depth || len < 0 || (int64) offset + len > depth) {
         ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                         errmsg("itree subpath out of bounds")));
     }
 
-    uint16_t sub_segments[ITREE_MAX_LEVELS] = {0};
-    memcpy(sub_segments, segments + offset, sizeof(uint16_t) * len);
+    result = (itree *) palloc(sizeof(itree));
+    itree_splice_copy(tree, 0, tree, itree_level_len(tree, offset), itree_level_len(tree, offset + len), result);
+    PG_RETURN_ITREE(result);
+}
+
+/**
+ * itree_rebase ( itree, old_prefix itree, new_prefix itree ) → itree
+ * Moves a node of the subtree of old_prefix under new_prefix, old_prefix itself becomes new_prefix.
+ * The bytes below old_prefix are spliced after new_prefix as they are, nothing is decoded.
+ * itree_rebase('1.2.3.4', '1.2', '7') → 7.3.4
+ */
+PG_FUNCTION_INFO_V1(itree_rebase);
+Datum itree_rebase(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    itree *old_prefix = PG_GETARG_ITREE(1);
+    itree *new_prefix = PG_GETARG_ITREE(2);
+    itree *result = (itree *) palloc(sizeof(itree));
+
+    if (!itree_packed_is_prefix(old_prefix, tree)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("itree %s is not in the subtree of %s",
+                               DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(tree))),
+                               DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(old_prefix))))));
+    }
+    if (!itree_splice_copy(new_prefix, itree_packed_len(new_prefix),
+                           tree, itree_packed_len(old_prefix), itree_packed_len(tree), result)) {
+        itree_size_error(ERRCODE_INVALID_PARAMETER_VALUE,
+                         psprintf("itree %s moved under %s",
+                                  DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(tree))),
+                                  DatumGetCString(DirectFunctionCall1(itree_out, ITreeGetDatum(new_prefix)))));
+    }
+    PG_RETURN_ITREE(result);
+}
+
+/**
+ * rollup_to_level ( itree, level integer ) → itree
+ * The ancestor of an itree at level, counting from 1, or the itree itself when it is not deeper.
+ * Cuts the packed bytes at the end of the segment, nothing is decoded.
+ * rollup_to_level('1.2.3.4', 2) → 1.2
+ */
+PG_FUNCTION_INFO_V1(rollup_to_level);
+Datum rollup_to_level(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    int level = PG_GETARG_INT32(1);
+    itree *result;
+
+    if (level < 1) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("rollup level must be at least 1 (got %d)", level)));
+    }
+    result = (itree *) palloc(sizeof(itree));
+    itree_prefix_copy(tree, itree_level_len(tree, level), result);
+    PG_RETURN_ITREE(result);
+}
+
+/**
+ * Transition and combine function of the itree_lca aggregate, also the lca of two itree values.
+ * The state only gets shorter: in an aggregate it is cut in place, the first input is already
+ * a copy in the aggregate context. Values without a common ancestor give the empty itree.
+ */
+PG_FUNCTION_INFO_V1(itree_lca_transfn);
+Datum itree_lca_transfn(PG_FUNCTION_ARGS) {
+    itree *state = PG_GETARG_ITREE(0);
+    itree *tree = PG_GETARG_ITREE(1);
+    itree lca;
+
+    itree_prefix_copy(state, itree_packed_lcp_len(state, tree), &lca);
+    if (!AggCheckCallContext(fcinfo, NULL)) {
+        state = (itree *) palloc(sizeof(itree));
+    }
+    *state = lca;
+    PG_RETURN_ITREE(state);
+}
+
+/**
+ * Final function of the itree_lca aggregate: NULL when the values have no common ancestor.
+ */
+PG_FUNCTION_INFO_V1(itree_lca_finalfn);
+Datum itree_lca_finalfn(PG_FUNCTION_ARGS) {
+    itree *state = PG_GETARG_ITREE(0);
+
+    if (itree_packed_len(state) == 0) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_ITREE(state);
+}
+
+/**
+ * itree_lca ( itree[] ) → itree
+ * Lowest common ancestor of the array elements, an element is its own ancestor.
+ * NULL elements are skipped, NULL when no element is left or there is no common ancestor.
+ * itree_lca('{1.2.3, 1.2.5.6}') → 1.2
+ */
+PG_FUNCTION_INFO_V1(itree_lca_array);
+Datum itree_lca_array(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    Datum *elems;
+    bool *nulls;
+    int nelems;
+    itree *result = NULL;
+
+    deconstruct_array(array, ARR_ELEMTYPE(array), sizeof(itree), false, TYPALIGN_INT, &elems, &nulls, &nelems);
+    for (int i = 0; i < nelems; i++) {
+        itree *tree = DatumGetITree(elems[i]);
+
+        if (nulls[i]) {
+            continue;
+        }
+        if (result == NULL) {
+            result = (itree *) palloc(sizeof(itree));
+            itree_canonical_copy(tree, result);
+        } else {
+            itree lca;
+
+            itree_prefix_copy(result, itree_packed_lcp_len(result, tree), &lca);
+            *result = lca;
+        }
+        if (itree_packed_len(result) == 0) {
+            break;
+        }
+    }
+    if (result == NULL || itree_packed_len(result) == 0) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_ITREE(result);
+}
+
+/**
+ * itree_next_sibling ( itree ) → itree
+ * The itree with the last segment incremented, the first itree after all descendants in btree order.
+ * itree_next_sibling('1.2.3') → 1.2.4
+ */
+PG_FUNCTION_INFO_V1(itree_next_sibling);
+Datum itree_next_sibling(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    uint16_t segments[ITREE_MAX_LEVELS] = {0};
+    int seg_count = itree_get_segments(tree, segments);
+
+    if (seg_count == 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("empty itree has no next sibling")));
+    }
+    if (segments[seg_count - 1] == 65535) {
+        ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                        errmsg("itree segment 65535 has no next sibling")));
+    }
+    if (segments[seg_count - 1] == 255 && itree_packed_len(tree) == ITREE_MAX_LEVELS) {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("itree next sibling exceeds %d data bytes", ITREE_MAX_LEVELS)));
+    }
+
+    segments[seg_count - 1]++;
+    PG_RETURN_ITREE(create_itree_from_segments(segments));
+}
 
-    itree *result = create_itree_from_segments(sub_segments);
+/**
+ * itree_subtree_upper ( itree ) → itree
+ * The greatest descendant of an itree, x <@ t is the btree range x BETWEEN t AND itree_subtree_upper(t).
+ * itree_subtree_upper('1.2') → 1.2.65535.65535.65535.65535.65535.65535.65535
+ */
+PG_FUNCTION_INFO_V1(itree_subtree_upper);
+Datum itree_subtree_upper(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    itree *result = (itree *) palloc(sizeof(itree));
 
+    itree_subtree_upper_copy(tree, result);
     PG_RETURN_ITREE(result);
-}
\ No newline at end of file
+}
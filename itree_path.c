@@ -0,0 +1,209 @@
+/**
+ * Walking the levels of an itree without recursive queries:
+ * itree_prefixes, itree_ancestors and itree_path_segments return one row per level in value-per-call mode,
+ * itree_parent, itree_nlevel_prefix and itree_children_range return one value.
+ * All of them cut or read the packed bytes along the control bits, nothing is decoded up front.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "access/htup_details.h"
+#include "port/pg_bitutils.h"
+#include "itree.h"
+
+/**
+ * State of the SRFs: the itree and the positions still to visit.
+ */
+typedef struct {
+    itree tree;
+    uint32 ends;   // ends of the segments not returned yet, see itree_packed_ends()
+    uint32 starts; // starts of the segments not returned yet
+} itree_walk_state;
+
+static itree_walk_state *itree_walk_init(FunctionCallInfo fcinfo, FuncCallContext *funcctx) {
+    itree_walk_state *state = (itree_walk_state *) MemoryContextAlloc(funcctx->multi_call_memory_ctx,
+                                                                      sizeof(itree_walk_state));
+
+    state->tree = *PG_GETARG_ITREE(0);
+    state->ends = itree_packed_ends(&state->tree);
+    state->starts = itree_packed_starts(&state->tree);
+    funcctx->user_fctx = state;
+    return state;
+}
+
+/**
+ * Next prefix of the walk, shortest first, or NULL when the ends are used up.
+ */
+static itree *itree_walk_next_prefix(itree_walk_state *state) {
+    itree *result;
+
+    if (state->ends == 0) {
+        return NULL;
+    }
+    result = (itree *) palloc(sizeof(itree));
+    itree_prefix_copy(&state->tree, pg_rightmost_one_pos32(state->ends), result);
+    state->ends &= state->ends - 1;
+    return result;
+}
+
+/**
+ * itree_prefixes ( itree ) → setof itree
+ * The itree cut after each of its levels, shortest first, the last row is the itree itself.
+ * itree_prefixes('1.2.3') → 1, 1.2, 1.2.3
+ */
+PG_FUNCTION_INFO_V1(itree_prefixes);
+Datum itree_prefixes(PG_FUNCTION_ARGS) {
+    FuncCallContext *funcctx;
+    itree *prefix;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        itree_walk_init(fcinfo, funcctx);
+    }
+    funcctx = SRF_PERCALL_SETUP();
+    prefix = itree_walk_next_prefix((itree_walk_state *) funcctx->user_fctx);
+    if (prefix == NULL) {
+        SRF_RETURN_DONE(funcctx);
+    }
+    SRF_RETURN_NEXT(funcctx, ITreeGetDatum(prefix));
+}
+
+/**
+ * itree_ancestors ( itree ) → setof itree
+ * The proper ancestors of the itree, root first: its prefixes without the itree itself.
+ * itree_ancestors('1.2.3') → 1, 1.2
+ */
+PG_FUNCTION_INFO_V1(itree_ancestors);
+Datum itree_ancestors(PG_FUNCTION_ARGS) {
+    FuncCallContext *funcctx;
+    itree *prefix;
+
+    if (SRF_IS_FIRSTCALL()) {
+        itree_walk_state *state;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        state = itree_walk_init(fcinfo, funcctx);
+        // the last end is the itree itself
+        if (state->ends) {
+            state->ends &= ~(1u << pg_leftmost_one_pos32(state->ends));
+        }
+    }
+    funcctx = SRF_PERCALL_SETUP();
+    prefix = itree_walk_next_prefix((itree_walk_state *) funcctx->user_fctx);
+    if (prefix == NULL) {
+        SRF_RETURN_DONE(funcctx);
+    }
+    SRF_RETURN_NEXT(funcctx, ITreeGetDatum(prefix));
+}
+
+/**
+ * itree_path_segments ( itree ) → setof integer
+ * The segment values of the itree, level by level.
+ * itree_path_segments('1.300.3') → 1, 300, 3
+ */
+PG_FUNCTION_INFO_V1(itree_path_segments);
+Datum itree_path_segments(PG_FUNCTION_ARGS) {
+    FuncCallContext *funcctx;
+    itree_walk_state *state;
+    int pos;
+    int32 value;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        itree_walk_init(fcinfo, funcctx);
+    }
+    funcctx = SRF_PERCALL_SETUP();
+    state = (itree_walk_state *) funcctx->user_fctx;
+    if (state->starts == 0) {
+        SRF_RETURN_DONE(funcctx);
+    }
+
+    // a segment takes 2 bytes when it ends 2 bytes after its start
+    pos = pg_rightmost_one_pos32(state->starts);
+    value = state->tree.data[pos];
+    if (pg_rightmost_one_pos32(state->ends) == pos + 2) {
+        value = (value << 8) | state->tree.data[pos + 1];
+    }
+    state->starts &= state->starts - 1;
+    state->ends &= state->ends - 1;
+    SRF_RETURN_NEXT(funcctx, Int32GetDatum(value));
+}
+
+/**
+ * itree_parent ( itree ) → itree
+ * The itree without its last level, NULL for a top level itree.
+ * itree_parent('1.2.3') → 1.2
+ */
+PG_FUNCTION_INFO_V1(itree_parent);
+Datum itree_parent(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    // the parent ends where the last segment starts
+    uint32 starts = itree_packed_starts(tree) & ~1u;
+    itree *result;
+
+    if (starts == 0) {
+        PG_RETURN_NULL();
+    }
+    result = (itree *) palloc(sizeof(itree));
+    itree_prefix_copy(tree, pg_leftmost_one_pos32(starts), result);
+    PG_RETURN_ITREE(result);
+}
+
+/**
+ * itree_nlevel_prefix ( itree, n integer ) → itree
+ * The first n levels of the itree, NULL when it has fewer levels.
+ * itree_nlevel_prefix('1.2.3', 2) → 1.2
+ */
+PG_FUNCTION_INFO_V1(itree_nlevel_prefix);
+Datum itree_nlevel_prefix(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    int levels = PG_GETARG_INT32(1);
+    itree *result;
+
+    if (levels < 1) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("prefix level must be at least 1 (got %d)", levels)));
+    }
+    if (levels > itree_packed_depth(tree)) {
+        PG_RETURN_NULL();
+    }
+    result = (itree *) palloc(sizeof(itree));
+    itree_prefix_copy(tree, itree_level_len(tree, levels), result);
+    PG_RETURN_ITREE(result);
+}
+
+/**
+ * itree_children_range ( itree, OUT lower itree, OUT upper itree ) → record
+ * The btree range of the proper descendants: the first child and the greatest descendant.
+ * WHERE id BETWEEN lower AND upper finds the children and their subtrees without the itree itself.
+ * NULL when no level fits below the itree.
+ * itree_children_range('1.2') → (1.2.1, 1.2.65535.65535.65535.65535.65535.65535.65535)
+ */
+PG_FUNCTION_INFO_V1(itree_children_range);
+Datum itree_children_range(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    int len = itree_packed_len(tree);
+    TupleDesc tupdesc;
+    itree *lower;
+    itree *upper;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        elog(ERROR, "return type must be a row type");
+    }
+    if (len == ITREE_MAX_LEVELS) {
+        PG_RETURN_NULL();
+    }
+
+    // the first child appends a segment 1, its start bit is already set in the canonical copy
+    lower = (itree *) palloc(sizeof(itree));
+    itree_canonical_copy(tree, lower);
+    lower->data[len] = 1;
+    upper = (itree *) palloc(sizeof(itree));
+    itree_subtree_upper_copy(tree, upper);
+
+    values[0] = ITreeGetDatum(lower);
+    values[1] = ITreeGetDatum(upper);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
@@ -0,0 +1,373 @@
+/**
+ * iquery: lquery style patterns over the levels of an itree.
+ *
+ * 1.*.3      level 1 is 1, the last level is 3, any number of levels in between
+ * 1.*{2}     exactly two levels below 1
+ * 1.2|7.!4   level 2 is 2 or 7, level 3 is anything but 4
+ *
+ * The matcher works on the packed bytes: the segments are read along the control bits
+ * and the items advance a bit set of reachable levels, one item at a time.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "port/pg_bitutils.h"
+#include "itree.h"
+
+static void iquery_syntax_error(const char *input, const char *detail) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                    errmsg("invalid input syntax for iquery: \"%s\"", input),
+                    errdetail("%s", detail)));
+}
+
+/**
+ * Parse an unsigned number at *ptr, -1 if there is no digit.
+ */
+static long iquery_parse_number(char **ptr) {
+    char *end;
+    long val;
+
+    if (**ptr < '0' || **ptr > '9') {
+        return -1;
+    }
+    val = strtol(*ptr, &end, 10);
+    *ptr = end;
+    return val;
+}
+
+/**
+ * Parse the level bound of a * item, 0..IQUERY_MAX_BOUND.
+ */
+static int iquery_parse_bound(char **ptr, int missing) {
+    long val = iquery_parse_number(ptr);
+
+    if (val < 0) {
+        return missing;
+    }
+    if (val > IQUERY_MAX_BOUND) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                        errmsg("iquery level count must be in range 0..%d (got %ld)", IQUERY_MAX_BOUND, val)));
+    }
+    return (int) val;
+}
+
+PG_FUNCTION_INFO_V1(iquery_in);
+Datum iquery_in(PG_FUNCTION_ARGS) {
+    char *input = PG_GETARG_CSTRING(0);
+    char *ptr = input;
+    StringInfoData buf;
+    iquery *result;
+    int nitems = 0;
+
+    initStringInfo(&buf);
+    appendStringInfoSpaces(&buf, IQUERY_HDRSIZE);
+
+    for (;;) {
+        int offset = buf.len;
+        iquery_item *item;
+
+        if (nitems == IQUERY_MAX_ITEMS) {
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("iquery exceeds max items (%d)", IQUERY_MAX_ITEMS)));
+        }
+        appendStringInfoSpaces(&buf, IQUERY_ITEM_SIZE(0));
+        item = (iquery_item *) (buf.data + offset);
+        memset(item, 0, IQUERY_ITEM_SIZE(0));
+
+        if (*ptr == '*') {
+            ptr++;
+            item->flags = IQUERY_ITEM_ANY;
+            item->low = 0;
+            item->high = IQUERY_UNBOUNDED;
+            if (*ptr == '{') {
+                ptr++;
+                item->low = iquery_parse_bound(&ptr, 0);
+                if (*ptr == ',') {
+                    ptr++;
+                    item->high = iquery_parse_bound(&ptr, IQUERY_UNBOUNDED);
+                } else if (ptr[-1] == '{') {
+                    iquery_syntax_error(input, "A level count is expected after \"{\".");
+                } else {
+                    item->high = item->low;
+                }
+                if (*ptr++ != '}') {
+                    iquery_syntax_error(input, "\"}\" is expected after the level count.");
+                }
+                if (item->low > item->high) {
+                    iquery_syntax_error(input, "The low level count is greater than the high one.");
+                }
+            }
+        } else {
+            int nvalues = 0;
+
+            item->low = 1;
+            item->high = 1;
+            if (*ptr == '!') {
+                ptr++;
+                item->flags = IQUERY_ITEM_NOT;
+            }
+            for (;;) {
+                long val = iquery_parse_number(&ptr);
+                uint16_t value;
+
+                if (val <= 0 || val > 65535) {
+                    if (val < 0) {
+                        iquery_syntax_error(input, "A segment value or \"*\" is expected.");
+                    }
+                    ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                                    errmsg("iquery segment must be in range 1..65535 (got %ld)", val)));
+                }
+                if (nvalues == IQUERY_MAX_VALUES) {
+                    ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                                    errmsg("iquery item exceeds max values (%d)", IQUERY_MAX_VALUES)));
+                }
+                // the buffer may move while it grows, item is not used after this
+                value = (uint16_t) val;
+                appendBinaryStringInfo(&buf, (const char *) &value, sizeof(uint16_t));
+                nvalues++;
+                if (*ptr != '|') {
+                    break;
+                }
+                ptr++;
+            }
+            ((iquery_item *) (buf.data + offset))->nvalues = (uint8_t) nvalues;
+        }
+        nitems++;
+
+        if (*ptr == '\0') {
+            break;
+        }
+        if (*ptr++ != '.') {
+            iquery_syntax_error(input, "\".\" is expected between items.");
+        }
+    }
+
+    result = (iquery *) buf.data;
+    SET_VARSIZE(result, buf.len);
+    result->nitems = (uint16_t) nitems;
+    result->reserved = 0;
+    PG_RETURN_IQUERY(result);
+}
+
+PG_FUNCTION_INFO_V1(iquery_out);
+Datum iquery_out(PG_FUNCTION_ARGS) {
+    iquery *query = PG_GETARG_IQUERY(0);
+    iquery_item *item = IQUERY_FIRST(query);
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    for (int i = 0; i < query->nitems; i++, item = IQUERY_NEXT(item)) {
+        if (i > 0) {
+            appendStringInfoChar(&buf, '.');
+        }
+        if (item->flags & IQUERY_ITEM_ANY) {
+            appendStringInfoChar(&buf, '*');
+            if (item->low == item->high) {
+                appendStringInfo(&buf, "{%d}", item->low);
+            } else if (item->high == IQUERY_UNBOUNDED) {
+                if (item->low > 0) {
+                    appendStringInfo(&buf, "{%d,}", item->low);
+                }
+            } else if (item->low == 0) {
+                appendStringInfo(&buf, "{,%d}", item->high);
+            } else {
+                appendStringInfo(&buf, "{%d,%d}", item->low, item->high);
+            }
+            continue;
+        }
+        if (item->flags & IQUERY_ITEM_NOT) {
+            appendStringInfoChar(&buf, '!');
+        }
+        for (int v = 0; v < item->nvalues; v++) {
+            if (v > 0) {
+                appendStringInfoChar(&buf, '|');
+            }
+            appendStringInfo(&buf, "%u", item->values[v]);
+        }
+    }
+    PG_RETURN_CSTRING(buf.data);
+}
+
+/**
+ * Mask of the levels whose segment matches a value item, bit i for segments[i].
+ */
+static uint32 iquery_item_levels(const iquery_item *item, const uint16_t *segments, int depth) {
+    uint32 levels = 0;
+
+    for (int i = 0; i < depth; i++) {
+        bool found = false;
+
+        for (int v = 0; v < item->nvalues && !found; v++) {
+            found = item->values[v] == segments[i];
+        }
+        if (found != ((item->flags & IQUERY_ITEM_NOT) != 0)) {
+            levels |= 1u << i;
+        }
+    }
+    return levels;
+}
+
+/**
+ * True if the whole itree matches the whole query.
+ * reach has bit i set when the items so far can consume exactly the first i levels.
+ */
+bool iquery_match(const iquery *query, const itree *tree) {
+    int len = itree_packed_len(tree);
+    uint32 ctrl = ITREE_CONTROL_WORD(tree) | (1u << len);
+    uint32 starts = itree_packed_starts(tree);
+    uint16_t segments[ITREE_MAX_LEVELS];
+    int depth = 0;
+    uint32 all;
+    uint32 reach = 1;
+    const iquery_item *item = IQUERY_FIRST(query);
+
+    // segments from the packed bytes, a start without a start bit after it has a continuation byte
+    for (; starts; starts &= starts - 1) {
+        int pos = pg_rightmost_one_pos32(starts);
+
+        segments[depth++] = (ctrl & (1u << (pos + 1))) ? tree->data[pos]
+                                                        : (uint16_t) ((tree->data[pos] << 8) | tree->data[pos + 1]);
+    }
+    all = (1u << (depth + 1)) - 1;
+
+    for (int i = 0; i < query->nitems && reach; i++, item = IQUERY_NEXT(item)) {
+        if (item->flags & IQUERY_ITEM_ANY) {
+            uint32 next = 0;
+
+            for (int k = item->low; k <= Min(item->high, depth); k++) {
+                next |= reach << k;
+            }
+            reach = next & all;
+        } else {
+            reach = (reach & iquery_item_levels(item, segments, depth)) << 1;
+        }
+    }
+    return (reach & (1u << depth)) != 0;
+}
+
+/**
+ * iquery_match() over the variable length form of itree_var, which has no limit on the number of levels:
+ * reach is an array instead of a bit mask. A segment above 65535 matches no value of an item,
+ * and a * item without upper bound (high is IQUERY_UNBOUNDED) takes any number of levels.
+ */
+bool iquery_match_var(const iquery *query, const uint8_t *data, int len) {
+    int depth = itree_var_depth(data, len);
+    uint32 *segments = (uint32 *) palloc((depth + 1) * sizeof(uint32));
+    bool *reach = (bool *) palloc0((depth + 1) * sizeof(bool));
+    bool *next = (bool *) palloc((depth + 1) * sizeof(bool));
+    const iquery_item *item = IQUERY_FIRST(query);
+    bool any = true;
+    bool result;
+
+    itree_var_get_segments(data, len, segments);
+    reach[0] = true;
+    for (int i = 0; i < query->nitems && any; i++, item = IQUERY_NEXT(item)) {
+        bool *swap;
+
+        memset(next, 0, (depth + 1) * sizeof(bool));
+        any = false;
+        for (int level = 0; level <= depth; level++) {
+            if (!reach[level]) {
+                continue;
+            }
+            if (item->flags & IQUERY_ITEM_ANY) {
+                int high = item->high == IQUERY_UNBOUNDED ? depth : item->high;
+
+                for (int k = item->low; k <= high && level + k <= depth; k++) {
+                    next[level + k] = any = true;
+                }
+            } else if (level < depth) {
+                bool found = false;
+
+                for (int v = 0; v < item->nvalues && !found; v++) {
+                    found = item->values[v] == segments[level];
+                }
+                if (found != ((item->flags & IQUERY_ITEM_NOT) != 0)) {
+                    next[level + 1] = any = true;
+                }
+            }
+        }
+        swap = reach;
+        reach = next;
+        next = swap;
+    }
+    result = any && reach[depth];
+
+    pfree(segments);
+    pfree(reach);
+    pfree(next);
+    return result;
+}
+
+/**
+ * The leading levels every match shares: the canonical itree of the leading
+ * single value items, as many as fit. Returns the number of levels.
+ */
+int iquery_fixed_prefix(const iquery *query, itree *prefix) {
+    const iquery_item *item = IQUERY_FIRST(query);
+    uint16_t segments[ITREE_MAX_LEVELS + 1] = {0};
+    int levels = 0;
+    int bytes = 0;
+    itree *tree;
+
+    for (int i = 0; i < query->nitems; i++, item = IQUERY_NEXT(item)) {
+        int width;
+
+        if (item->flags != 0 || item->nvalues != 1) {
+            break;
+        }
+        width = item->values[0] > 255 ? 2 : 1;
+        if (bytes + width > ITREE_MAX_LEVELS) {
+            break;
+        }
+        segments[levels++] = item->values[0];
+        bytes += width;
+    }
+
+    tree = create_itree_from_segments(segments);
+    *prefix = *tree;
+    pfree(tree);
+    return levels;
+}
+
+/**
+ * The leading fixed width items of query, a * item counts when its level count is fixed.
+ * head_levels is set to the number of levels the head matches, the head is NULL when it is empty.
+ */
+iquery *iquery_head(const iquery *query, int *head_levels) {
+    const iquery_item *item = IQUERY_FIRST(query);
+    iquery *head;
+    int nitems = 0;
+    Size size;
+
+    *head_levels = 0;
+    for (; nitems < query->nitems && item->low == item->high; nitems++, item = IQUERY_NEXT(item)) {
+        *head_levels += item->low;
+    }
+    if (nitems == 0) {
+        return NULL;
+    }
+
+    size = (const char *) item - (const char *) query;
+    head = (iquery *) palloc(size);
+    memcpy(head, query, size);
+    SET_VARSIZE(head, size);
+    head->nitems = (uint16_t) nitems;
+    return head;
+}
+
+PG_FUNCTION_INFO_V1(itree_matches);
+Datum itree_matches(PG_FUNCTION_ARGS) {
+    itree *tree = PG_GETARG_ITREE(0);
+    iquery *query = PG_GETARG_IQUERY(1);
+
+    PG_RETURN_BOOL(iquery_match(query, tree));
+}
+
+PG_FUNCTION_INFO_V1(iquery_matches);
+Datum iquery_matches(PG_FUNCTION_ARGS) {
+    iquery *query = PG_GETARG_IQUERY(0);
+    itree *tree = PG_GETARG_ITREE(1);
+
+    PG_RETURN_BOOL(iquery_match(query, tree));
+}
@@ -0,0 +1,325 @@
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/spgist.h"
+#include "access/stratnum.h" // For StrategyNumber
+#include "catalog/pg_type.h"
+#include "itree.h"
+
+/**
+ * SP-GiST support for itree: a trie of the segments. An inner tuple at level n branches on segment n
+ * of the values below it, the node labels are the segment values, -1 for the values that end at level n.
+ * The path of labels from the root is the common prefix of a subtree, it is not stored but rebuilt
+ * as the reconstructed value, so a subtree query descends a single path and an inner tuple costs
+ * its labels only. Leaves hold the whole itree, which gives index-only scans.
+ *
+ * Labels are decoded with itree_get_segments(), the consistent checks work on the packed reconstructed prefixes.
+ * Identical values end up in allTheSame inner tuples with -1 nodes, as for the text radix tree of PostgreSQL;
+ * a value that does not fit such a tuple splits it below a node labelled -2 that does not consume a level.
+ *
+ * Strategy numbers follow the itree GiST opclass:
+ * 1 <, 2 <=, 3 =, 4 >=, 5 >, 10 @>, 11 <@, 15 <-> (ORDER BY)
+ */
+#define ITREE_SPGIST_ANCESTOR_STRATEGY   10
+#define ITREE_SPGIST_DESCENDANT_STRATEGY 11
+#define ITREE_SPGIST_DISTANCE_STRATEGY   15
+
+#define ITREE_SPGIST_LABEL_END   -1 // the values end at this level
+#define ITREE_SPGIST_LABEL_SPLIT -2 // the allTheSame tuple below was split, no level consumed
+
+/**
+ * The label of tree at level: its segment there, or ITREE_SPGIST_LABEL_END when it has no more levels.
+ */
+static int32 itree_spgist_label(const itree *tree, int level) {
+    uint16_t segments[ITREE_MAX_LEVELS];
+    int count = itree_get_segments(tree, segments);
+
+    return level < count ? (int32) segments[level] : ITREE_SPGIST_LABEL_END;
+}
+
+/**
+ * The prefix of the subtree below node label of an inner tuple with prefix parent.
+ * parent is a prefix of stored values, so parent plus their next segment always fits.
+ */
+static void itree_spgist_node_prefix(const itree *parent, int32 label, itree *dst) {
+    uint16_t segments[ITREE_MAX_LEVELS + 1];
+    int count;
+
+    if (label < 0) {
+        *dst = *parent;
+        return;
+    }
+    count = itree_get_segments(parent, segments);
+    segments[count++] = (uint16_t) label;
+    if (!itree_set_segments(segments, count, dst)) {
+        elog(ERROR, "itree_spgist: prefix of the trie does not fit in itree");
+    }
+}
+
+static int itree_spgist_find_label(const Datum *labels, int n, int32 label) {
+    for (int i = 0; i < n; i++) {
+        if (DatumGetInt32(labels[i]) == label) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Exact test of value against one scan key, for leaves and for the values of an END node.
+ */
+static bool itree_spgist_value_consistent(const itree *value, StrategyNumber strategy, const itree *query) {
+    switch (strategy) {
+        case BTLessStrategyNumber:
+            return itree_packed_cmp(value, query) < 0;
+        case BTLessEqualStrategyNumber:
+            return itree_packed_cmp(value, query) <= 0;
+        case BTEqualStrategyNumber:
+            return itree_packed_cmp(value, query) == 0;
+        case BTGreaterEqualStrategyNumber:
+            return itree_packed_cmp(value, query) >= 0;
+        case BTGreaterStrategyNumber:
+            return itree_packed_cmp(value, query) > 0;
+        case ITREE_SPGIST_ANCESTOR_STRATEGY:
+            return itree_packed_is_prefix(value, query);
+        case ITREE_SPGIST_DESCENDANT_STRATEGY:
+            return itree_packed_is_prefix(query, value);
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", strategy);
+            return false; // keep compiler quiet
+    }
+}
+
+/**
+ * True if some value starting with prefix can satisfy the scan key.
+ * The values starting with prefix are the btree range from prefix to its last descendant.
+ */
+static bool itree_spgist_subtree_consistent(const itree *prefix, StrategyNumber strategy, const itree *query) {
+    switch (strategy) {
+        case BTLessStrategyNumber:
+            return itree_packed_cmp(prefix, query) < 0;
+        case BTLessEqualStrategyNumber:
+            return itree_packed_cmp(prefix, query) <= 0;
+        case BTGreaterEqualStrategyNumber:
+            return itree_packed_cmp(prefix, query) >= 0 || itree_packed_is_prefix(prefix, query);
+        case BTGreaterStrategyNumber:
+            // the query after the whole subtree leaves nothing greater
+            return itree_packed_cmp(prefix, query) > 0 || itree_packed_is_prefix(prefix, query);
+        case BTEqualStrategyNumber:
+        case ITREE_SPGIST_ANCESTOR_STRATEGY:
+            return itree_packed_is_prefix(prefix, query);
+        case ITREE_SPGIST_DESCENDANT_STRATEGY:
+            return itree_packed_is_prefix(prefix, query) || itree_packed_is_prefix(query, prefix);
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", strategy);
+            return false; // keep compiler quiet
+    }
+}
+
+/**
+ * Lower bound of the tree distance from query to the values starting with prefix:
+ * 0 on the path to query, otherwise down from query to the common ancestor and at least down to prefix.
+ */
+static double itree_spgist_subtree_distance(const itree *prefix, const itree *query) {
+    int common;
+
+    if (itree_packed_is_prefix(prefix, query)) {
+        return 0.0;
+    }
+    common = itree_packed_lcp(prefix, query);
+    return (double) (itree_packed_depth(query) + itree_packed_depth(prefix) - 2 * common);
+}
+
+static void itree_spgist_check_distance(ScanKey orderby) {
+    if (orderby->sk_strategy != ITREE_SPGIST_DISTANCE_STRATEGY) {
+        elog(ERROR, "unrecognized strategy number: %d", orderby->sk_strategy);
+    }
+}
+
+/**
+ * FUNCTION 1 config(internal, internal)
+ * No prefixes, int4 labels, leaves of the indexed itree.
+ */
+PG_FUNCTION_INFO_V1(itree_spgist_config);
+Datum itree_spgist_config(PG_FUNCTION_ARGS) {
+    spgConfigIn *cfgin = (spgConfigIn *) PG_GETARG_POINTER(0);
+    spgConfigOut *cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+    cfg->prefixType = VOIDOID;
+    cfg->labelType = INT4OID;
+    cfg->leafType = cfgin->attType;
+    cfg->canReturnData = true;
+    cfg->longValuesOK = false;
+    PG_RETURN_VOID();
+}
+
+/**
+ * FUNCTION 2 choose(internal, internal)
+ * Descends to the node of the segment of the value at this level, or adds it in label order.
+ */
+PG_FUNCTION_INFO_V1(itree_spgist_choose);
+Datum itree_spgist_choose(PG_FUNCTION_ARGS) {
+    spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
+    spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
+    int32 label = itree_spgist_label(DatumGetITree(in->datum), in->level);
+    int node = itree_spgist_find_label(in->nodeLabels, in->nNodes, label);
+
+    if (node >= 0) {
+        // for an allTheSame tuple the core picks any of its nodes
+        out->resultType = spgMatchNode;
+        out->result.matchNode.nodeN = node;
+        out->result.matchNode.levelAdd = label >= 0 ? 1 : 0;
+        out->result.matchNode.restDatum = in->datum;
+    } else if (in->allTheSame) {
+        // nodes can't be added to an allTheSame tuple: push it down below a node that does not consume the level
+        out->resultType = spgSplitTuple;
+        out->result.splitTuple.prefixHasPrefix = false;
+        out->result.splitTuple.prefixNNodes = 1;
+        out->result.splitTuple.prefixNodeLabels = (Datum *) palloc(sizeof(Datum));
+        out->result.splitTuple.prefixNodeLabels[0] = Int32GetDatum(ITREE_SPGIST_LABEL_SPLIT);
+        out->result.splitTuple.childNodeN = 0;
+        out->result.splitTuple.postfixHasPrefix = false;
+    } else {
+        out->resultType = spgAddNode;
+        out->result.addNode.nodeLabel = Int32GetDatum(label);
+        out->result.addNode.nodeN = 0;
+        while (out->result.addNode.nodeN < in->nNodes &&
+               DatumGetInt32(in->nodeLabels[out->result.addNode.nodeN]) < label) {
+            out->result.addNode.nodeN++;
+        }
+    }
+    PG_RETURN_VOID();
+}
+
+typedef struct {
+    int32 label;
+    int index;
+} itree_spgist_labelled;
+
+static int itree_spgist_labelled_cmp(const void *a, const void *b) {
+    int32 la = ((const itree_spgist_labelled *) a)->label;
+    int32 lb = ((const itree_spgist_labelled *) b)->label;
+
+    return (la > lb) - (la < lb);
+}
+
+/**
+ * FUNCTION 3 picksplit(internal, internal)
+ * One node per distinct segment at this level, the leaves keep the whole values.
+ */
+PG_FUNCTION_INFO_V1(itree_spgist_picksplit);
+Datum itree_spgist_picksplit(PG_FUNCTION_ARGS) {
+    spgPickSplitIn *in = (spgPickSplitIn *) PG_GETARG_POINTER(0);
+    spgPickSplitOut *out = (spgPickSplitOut *) PG_GETARG_POINTER(1);
+    itree_spgist_labelled *labelled = palloc(in->nTuples * sizeof(itree_spgist_labelled));
+
+    for (int i = 0; i < in->nTuples; i++) {
+        labelled[i].label = itree_spgist_label(DatumGetITree(in->datums[i]), in->level);
+        labelled[i].index = i;
+    }
+    qsort(labelled, in->nTuples, sizeof(itree_spgist_labelled), itree_spgist_labelled_cmp);
+
+    out->hasPrefix = false;
+    out->nNodes = 0;
+    out->nodeLabels = (Datum *) palloc(in->nTuples * sizeof(Datum));
+    out->mapTuplesToNodes = (int *) palloc(in->nTuples * sizeof(int));
+    out->leafTupleDatums = (Datum *) palloc(in->nTuples * sizeof(Datum));
+    for (int i = 0; i < in->nTuples; i++) {
+        if (i == 0 || labelled[i].label != labelled[i - 1].label) {
+            out->nodeLabels[out->nNodes++] = Int32GetDatum(labelled[i].label);
+        }
+        out->mapTuplesToNodes[labelled[i].index] = out->nNodes - 1;
+        out->leafTupleDatums[labelled[i].index] = in->datums[labelled[i].index];
+    }
+    pfree(labelled);
+    PG_RETURN_VOID();
+}
+
+/**
+ * FUNCTION 4 inner_consistent(internal, internal)
+ * A node is visited when some value of its subtree can satisfy all scan keys,
+ * its distances are the lower bounds of the subtree.
+ */
+PG_FUNCTION_INFO_V1(itree_spgist_inner_consistent);
+Datum itree_spgist_inner_consistent(PG_FUNCTION_ARGS) {
+    spgInnerConsistentIn *in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
+    spgInnerConsistentOut *out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
+    itree parent;
+
+    if (in->reconstructedValue == (Datum) 0) {
+        itree_set_segments(NULL, 0, &parent);
+    } else {
+        parent = *DatumGetITree(in->reconstructedValue);
+    }
+
+    out->nNodes = 0;
+    out->nodeNumbers = (int *) palloc(in->nNodes * sizeof(int));
+    out->levelAdds = (int *) palloc(in->nNodes * sizeof(int));
+    out->reconstructedValues = (Datum *) palloc(in->nNodes * sizeof(Datum));
+    out->distances = in->norderbys > 0 ? (double **) palloc(in->nNodes * sizeof(double *)) : NULL;
+
+    for (int i = 0; i < in->nNodes; i++) {
+        int32 label = DatumGetInt32(in->nodeLabels[i]);
+        itree *prefix = (itree *) palloc(sizeof(itree));
+        bool consistent = true;
+
+        itree_spgist_node_prefix(&parent, label, prefix);
+        for (int k = 0; k < in->nkeys && consistent; k++) {
+            StrategyNumber strategy = in->scankeys[k].sk_strategy;
+            itree *query = DatumGetITree(in->scankeys[k].sk_argument);
+
+            consistent = label == ITREE_SPGIST_LABEL_END ? itree_spgist_value_consistent(prefix, strategy, query)
+                                                         : itree_spgist_subtree_consistent(prefix, strategy, query);
+        }
+        if (!consistent) {
+            pfree(prefix);
+            continue;
+        }
+
+        out->nodeNumbers[out->nNodes] = i;
+        out->levelAdds[out->nNodes] = label >= 0 ? 1 : 0;
+        out->reconstructedValues[out->nNodes] = ITreeGetDatum(prefix);
+        if (in->norderbys > 0) {
+            double *distances = (double *) palloc(in->norderbys * sizeof(double));
+
+            for (int k = 0; k < in->norderbys; k++) {
+                itree *query = DatumGetITree(in->orderbys[k].sk_argument);
+
+                itree_spgist_check_distance(&in->orderbys[k]);
+                distances[k] = label == ITREE_SPGIST_LABEL_END ? (double) itree_packed_distance(prefix, query)
+                                                               : itree_spgist_subtree_distance(prefix, query);
+            }
+            out->distances[out->nNodes] = distances;
+        }
+        out->nNodes++;
+    }
+    PG_RETURN_VOID();
+}
+
+/**
+ * FUNCTION 5 leaf_consistent(internal, internal)
+ * Leaves hold the whole value, all keys and distances are exact.
+ */
+PG_FUNCTION_INFO_V1(itree_spgist_leaf_consistent);
+Datum itree_spgist_leaf_consistent(PG_FUNCTION_ARGS) {
+    spgLeafConsistentIn *in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
+    spgLeafConsistentOut *out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
+    itree *value = DatumGetITree(in->leafDatum);
+
+    out->recheck = false;
+    out->recheckDistances = false;
+    out->leafValue = in->returnData ? in->leafDatum : (Datum) 0;
+
+    for (int k = 0; k < in->nkeys; k++) {
+        if (!itree_spgist_value_consistent(value, in->scankeys[k].sk_strategy, DatumGetITree(in->scankeys[k].sk_argument))) {
+            PG_RETURN_BOOL(false);
+        }
+    }
+    if (in->norderbys > 0) {
+        out->distances = (double *) palloc(in->norderbys * sizeof(double));
+        for (int k = 0; k < in->norderbys; k++) {
+            itree_spgist_check_distance(&in->orderbys[k]);
+            out->distances[k] = (double) itree_packed_distance(value, DatumGetITree(in->orderbys[k].sk_argument));
+        }
+    }
+    PG_RETURN_BOOL(true);
+}
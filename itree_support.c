@@ -0,0 +1,565 @@
+/**
+ * Planner support functions and selectivity estimators for the itree operators.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "catalog/pg_am_d.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type_d.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pathnodes.h"
+#include "nodes/supportnodes.h"
+#include "port/pg_bitutils.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/typcache.h"
+#include "itree.h"
+
+static Const *itree_make_const(Oid type, itree *value) {
+    return makeConst(type, -1, InvalidOid, sizeof(itree), ITreeGetDatum(value), false, false);
+}
+
+/**
+ * The constant of an itree_key column: value in the memcmp ordered key form.
+ */
+static Const *itree_make_key_const(Oid type, const itree *value) {
+    itree_key *key = (itree_key *) palloc(sizeof(itree_key));
+
+    itree_key_encode(value, key);
+    return makeConst(type, -1, InvalidOid, sizeof(itree_key), PointerGetDatum(key), false, false);
+}
+
+/**
+ * The constant of an itree_var column.
+ */
+static Const *itree_make_var_const(Oid type, const uint8_t *data, int len) {
+    return makeConst(type, -1, InvalidOid, -1, PointerGetDatum(itree_var_make(data, len)), false, false);
+}
+
+/**
+ * The constant argument of an indexable itree clause and the indexed expression it is compared to.
+ * const_arg is the argument of the operator function that has to be a constant, the other one is indexed.
+ * Returns NULL when the clause cannot be turned into btree conditions.
+ * BRIN indexes take them too: the minmax opclass has the btree strategy numbers.
+ */
+static Const *itree_index_clause_const(SupportRequestIndexCondition *req, int const_arg, Node **indexed) {
+    List *args;
+    Node *other;
+
+    if ((req->index->relam != BTREE_AM_OID && req->index->relam != BRIN_AM_OID) || req->indexarg != 1 - const_arg) {
+        return NULL;
+    }
+
+    if (is_opclause(req->node)) {
+        args = ((OpExpr *) req->node)->args;
+    } else if (is_funcclause(req->node)) {
+        args = ((FuncExpr *) req->node)->args;
+    } else {
+        return NULL;
+    }
+    if (list_length(args) != 2) {
+        return NULL;
+    }
+
+    *indexed = (Node *) list_nth(args, 1 - const_arg);
+    other = (Node *) list_nth(args, const_arg);
+    if (!IsA(other, Const) || ((Const *) other)->constisnull) {
+        return NULL;
+    }
+    return (Const *) other;
+}
+
+/**
+ * Btree conditions indexed >= prefix AND indexed <= itree_subtree_upper(prefix),
+ * the descendants of the canonical prefix. NIL if the opfamily lacks the operators.
+ * as_key: indexed is an itree_key, the bounds are encoded as keys.
+ */
+static List *itree_subtree_range(SupportRequestIndexCondition *req, Node *indexed, const itree *prefix, bool as_key) {
+    Oid type = exprType(indexed);
+    Oid ge_op = get_opfamily_member(req->opfamily, type, type, BTGreaterEqualStrategyNumber);
+    Oid le_op = get_opfamily_member(req->opfamily, type, type, BTLessEqualStrategyNumber);
+    itree *lower;
+    itree *upper;
+
+    if (!OidIsValid(ge_op) || !OidIsValid(le_op)) {
+        return NIL;
+    }
+
+    lower = (itree *) palloc(sizeof(itree));
+    upper = (itree *) palloc(sizeof(itree));
+    itree_canonical_copy(prefix, lower);
+    itree_subtree_upper_copy(lower, upper);
+
+    return list_make2(make_opclause(ge_op, BOOLOID, false, (Expr *) indexed,
+                                    (Expr *) (as_key ? itree_make_key_const(type, lower) : itree_make_const(type, lower)),
+                                    InvalidOid, InvalidOid),
+                      make_opclause(le_op, BOOLOID, false, (Expr *) indexed,
+                                    (Expr *) (as_key ? itree_make_key_const(type, upper) : itree_make_const(type, upper)),
+                                    InvalidOid, InvalidOid));
+}
+
+/**
+ * Btree index conditions for a subtree test against a constant itree: the range
+ * indexed >= prefix AND indexed <= itree_subtree_upper(prefix).
+ * All descendants of prefix are one contiguous range in btree order, so the range is exact
+ * and the original <@ or @> clause is not rechecked.
+ *
+ * prefix_arg is the argument of the operator function that holds the subtree root:
+ * 1 for itree_is_descendant(indexed, prefix), 0 for itree_is_ancestor(prefix, indexed).
+ */
+static List *itree_subtree_index_conditions(SupportRequestIndexCondition *req, int prefix_arg, bool as_key) {
+    Node *indexed;
+    Const *prefix = itree_index_clause_const(req, prefix_arg, &indexed);
+    List *conditions;
+    itree decoded;
+
+    if (prefix == NULL) {
+        return NIL;
+    }
+
+    if (as_key) {
+        itree_key_decode((itree_key *) DatumGetPointer(prefix->constvalue), &decoded);
+        conditions = itree_subtree_range(req, indexed, &decoded, true);
+    } else {
+        conditions = itree_subtree_range(req, indexed, DatumGetITree(prefix->constvalue), false);
+    }
+    req->lossy = false;
+    return conditions;
+}
+
+/**
+ * Btree index conditions for a subtree test on an itree_var column: indexed >= prefix AND
+ * indexed < itree_var_subtree_next(prefix), the first value after the subtree. Exact as for itree,
+ * the second condition is left out when no value follows the subtree.
+ */
+static List *itree_var_subtree_index_conditions(SupportRequestIndexCondition *req, int prefix_arg) {
+    Node *indexed;
+    Const *prefix_const = itree_index_clause_const(req, prefix_arg, &indexed);
+    Oid type;
+    Oid ge_op;
+    Oid lt_op;
+    itree_var *prefix;
+    uint8_t *next;
+    int next_len;
+    List *conditions;
+
+    if (prefix_const == NULL) {
+        return NIL;
+    }
+    type = exprType(indexed);
+    ge_op = get_opfamily_member(req->opfamily, type, type, BTGreaterEqualStrategyNumber);
+    lt_op = get_opfamily_member(req->opfamily, type, type, BTLessStrategyNumber);
+    if (!OidIsValid(ge_op) || !OidIsValid(lt_op)) {
+        return NIL;
+    }
+
+    prefix = DatumGetITreeVarPP(prefix_const->constvalue);
+    conditions = list_make1(make_opclause(ge_op, BOOLOID, false, (Expr *) indexed,
+                                          (Expr *) itree_make_var_const(type, ITREE_VAR_DATA(prefix), ITREE_VAR_LEN(prefix)),
+                                          InvalidOid, InvalidOid));
+    next = (uint8_t *) palloc(ITREE_VAR_LEN(prefix) + 1);
+    next_len = itree_var_subtree_next(ITREE_VAR_DATA(prefix), ITREE_VAR_LEN(prefix), next);
+    if (next_len >= 0) {
+        conditions = lappend(conditions, make_opclause(lt_op, BOOLOID, false, (Expr *) indexed,
+                                                       (Expr *) itree_make_var_const(type, next, next_len),
+                                                       InvalidOid, InvalidOid));
+    }
+    req->lossy = false;
+    return conditions;
+}
+
+/**
+ * Btree index conditions for indexed ~ const iquery: every match is below the fixed
+ * leading levels of the iquery, so their subtree range is scanned and the clause is rechecked.
+ * An iquery of plain segment values only matches one itree, indexed = that itree is exact.
+ */
+static List *itree_match_index_conditions(SupportRequestIndexCondition *req) {
+    int query_arg = 1 - req->indexarg;
+    Node *indexed;
+    Const *query_const = itree_index_clause_const(req, query_arg, &indexed);
+    iquery *query;
+    itree *prefix;
+    int levels;
+    Oid type;
+    Oid eq_op;
+
+    if (query_const == NULL) {
+        return NIL;
+    }
+
+    query = DatumGetIQuery(query_const->constvalue);
+    prefix = (itree *) palloc(sizeof(itree));
+    levels = iquery_fixed_prefix(query, prefix);
+    if (levels == 0) {
+        return NIL;
+    }
+
+    type = exprType(indexed);
+    eq_op = get_opfamily_member(req->opfamily, type, type, BTEqualStrategyNumber);
+    if (levels == query->nitems && OidIsValid(eq_op)) {
+        req->lossy = false;
+        return list_make1(make_opclause(eq_op, BOOLOID, false, (Expr *) indexed,
+                                        (Expr *) itree_make_const(type, prefix), InvalidOid, InvalidOid));
+    }
+
+    req->lossy = true;
+    return itree_subtree_range(req, indexed, prefix, false);
+}
+
+/**
+ * SUPPORT function of itree_is_descendant: indexed <@ const becomes a btree range scan.
+ */
+PG_FUNCTION_INFO_V1(itree_descendant_support);
+Datum itree_descendant_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_subtree_index_conditions((SupportRequestIndexCondition *) rawreq, 1, false);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * SUPPORT function of itree_is_ancestor: const @> indexed becomes a btree range scan.
+ */
+PG_FUNCTION_INFO_V1(itree_ancestor_support);
+Datum itree_ancestor_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_subtree_index_conditions((SupportRequestIndexCondition *) rawreq, 0, false);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * SUPPORT function of itree_key_is_descendant: indexed <@ const on an itree_key column.
+ */
+PG_FUNCTION_INFO_V1(itree_key_descendant_support);
+Datum itree_key_descendant_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_subtree_index_conditions((SupportRequestIndexCondition *) rawreq, 1, true);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * SUPPORT function of itree_key_is_ancestor: const @> indexed on an itree_key column.
+ */
+PG_FUNCTION_INFO_V1(itree_key_ancestor_support);
+Datum itree_key_ancestor_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_subtree_index_conditions((SupportRequestIndexCondition *) rawreq, 0, true);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * SUPPORT function of itree_var_is_descendant: indexed <@ const on an itree_var column.
+ */
+PG_FUNCTION_INFO_V1(itree_var_descendant_support);
+Datum itree_var_descendant_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_var_subtree_index_conditions((SupportRequestIndexCondition *) rawreq, 1);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * SUPPORT function of itree_var_is_ancestor: const @> indexed on an itree_var column.
+ */
+PG_FUNCTION_INFO_V1(itree_var_ancestor_support);
+Datum itree_var_ancestor_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_var_subtree_index_conditions((SupportRequestIndexCondition *) rawreq, 0);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * SUPPORT function of itree_matches and iquery_matches: indexed ~ const becomes a btree
+ * range scan over the fixed leading levels of the iquery.
+ */
+PG_FUNCTION_INFO_V1(itree_match_support);
+Datum itree_match_support(PG_FUNCTION_ARGS) {
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *ret = NULL;
+
+    if (IsA(rawreq, SupportRequestIndexCondition)) {
+        ret = (Node *) itree_match_index_conditions((SupportRequestIndexCondition *) rawreq);
+    }
+
+    PG_RETURN_POINTER(ret);
+}
+
+/**
+ * Selectivity when there are no statistics, the same guess ltree makes for its <@ and @>.
+ */
+#define ITREE_DEFAULT_SUBTREE_SEL 0.001
+#define ITREE_DEFAULT_DEPTH 4.0
+
+/**
+ * Fraction of the histogram population below value. The bounds are in btree order,
+ * each bucket holds the same number of rows, and inside a bucket the position is
+ * interpolated on itree_order_key(), which is order preserving.
+ */
+static double itree_histogram_position(const AttStatsSlot *hist, const itree *value) {
+    int nbuckets = hist->nvalues - 1;
+    int lo = 0;
+    int hi = nbuckets;
+    double lower_key;
+    double upper_key;
+    double fraction = 0.5;
+
+    if (itree_packed_cmp(value, DatumGetITree(hist->values[0])) <= 0) {
+        return 0.0;
+    }
+    if (itree_packed_cmp(value, DatumGetITree(hist->values[nbuckets])) >= 0) {
+        return 1.0;
+    }
+
+    // bucket lo with values[lo] < value <= values[lo + 1]
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+
+        if (itree_packed_cmp(DatumGetITree(hist->values[mid]), value) < 0) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    lower_key = (double) itree_order_key(DatumGetITree(hist->values[lo]));
+    upper_key = (double) itree_order_key(DatumGetITree(hist->values[lo + 1]));
+    if (upper_key > lower_key) {
+        fraction = ((double) itree_order_key(value) - lower_key) / (upper_key - lower_key);
+        CLAMP_PROBABILITY(fraction);
+    }
+    return (lo + fraction) / nbuckets;
+}
+
+/**
+ * Selectivity of "column <@ root": the MCVs are tested directly, the other rows are
+ * the part of the histogram between root and itree_subtree_upper(root), as a subtree
+ * is one contiguous range in btree order.
+ */
+static double itree_descendant_selectivity(VariableStatData *vardata, const itree *root) {
+    Form_pg_statistic stats = (Form_pg_statistic) GETSTRUCT(vardata->statsTuple);
+    double other_frac = 1.0 - stats->stanullfrac;
+    double selec = 0.0;
+    AttStatsSlot sslot;
+    itree upper;
+
+    if (get_attstatsslot(&sslot, vardata->statsTuple, STATISTIC_KIND_MCV, InvalidOid,
+                         ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS)) {
+        for (int i = 0; i < sslot.nvalues; i++) {
+            if (itree_packed_is_prefix(root, DatumGetITree(sslot.values[i]))) {
+                selec += sslot.numbers[i];
+            }
+            other_frac -= sslot.numbers[i];
+        }
+        free_attstatsslot(&sslot);
+    }
+
+    if (get_attstatsslot(&sslot, vardata->statsTuple, STATISTIC_KIND_HISTOGRAM, InvalidOid,
+                         ATTSTATSSLOT_VALUES)) {
+        if (sslot.nvalues >= 2) {
+            itree_subtree_upper_copy(root, &upper);
+            selec += other_frac * (itree_histogram_position(&sslot, &upper) -
+                                   itree_histogram_position(&sslot, root));
+        }
+        free_attstatsslot(&sslot);
+    } else if (other_frac > 0) {
+        selec += other_frac * ITREE_DEFAULT_SUBTREE_SEL;
+    }
+
+    return selec;
+}
+
+/**
+ * Selectivity of "column @> node": the column equals one of the prefixes of node,
+ * the sum of the equality selectivities of the prefixes.
+ */
+static double itree_ancestor_selectivity(VariableStatData *vardata, const itree *node) {
+    Oid eq_opr = lookup_type_cache(vardata->atttype, TYPECACHE_EQ_OPR)->eq_opr;
+    uint32 ends = itree_packed_ends(node);
+    double selec = 0.0;
+
+    if (ends == 0 || !OidIsValid(eq_opr)) {
+        return ITREE_DEFAULT_SUBTREE_SEL;
+    }
+
+    for (; ends; ends &= ends - 1) {
+        itree *prefix = (itree *) palloc(sizeof(itree));
+
+        itree_prefix_copy(node, pg_rightmost_one_pos32(ends), prefix);
+        selec += var_eq_const(vardata, eq_opr, InvalidOid, ITreeGetDatum(prefix), false, true, false);
+    }
+    return selec;
+}
+
+/**
+ * RESTRICT estimator of <@ (is_descendant_op) and @>.
+ * With the column on the right the operator is commuted: node <@ column is column @> node.
+ */
+static double itree_subtree_restrict(PlannerInfo *root, List *args, int varRelid, bool is_descendant_op) {
+    VariableStatData vardata;
+    Node *other;
+    bool varonleft;
+    double selec;
+    itree *value;
+
+    if (!get_restriction_variable(root, args, varRelid, &vardata, &other, &varonleft)) {
+        return ITREE_DEFAULT_SUBTREE_SEL;
+    }
+    if (!IsA(other, Const)) {
+        ReleaseVariableStats(vardata);
+        return ITREE_DEFAULT_SUBTREE_SEL;
+    }
+    if (((Const *) other)->constisnull) {
+        ReleaseVariableStats(vardata);
+        return 0.0;
+    }
+    if (!HeapTupleIsValid(vardata.statsTuple)) {
+        ReleaseVariableStats(vardata);
+        return ITREE_DEFAULT_SUBTREE_SEL;
+    }
+
+    value = DatumGetITree(((Const *) other)->constvalue);
+    if (is_descendant_op == varonleft) {
+        selec = itree_descendant_selectivity(&vardata, value);
+    } else {
+        selec = itree_ancestor_selectivity(&vardata, value);
+    }
+
+    ReleaseVariableStats(vardata);
+    CLAMP_PROBABILITY(selec);
+    return selec;
+}
+
+/**
+ * Average number of levels of a column, from the MCVs and histogram bounds.
+ */
+static double itree_average_depth(VariableStatData *vardata) {
+    AttStatsSlot sslot;
+    double levels = 0.0;
+    int count = 0;
+
+    if (!HeapTupleIsValid(vardata->statsTuple)) {
+        return ITREE_DEFAULT_DEPTH;
+    }
+    if (get_attstatsslot(&sslot, vardata->statsTuple, STATISTIC_KIND_HISTOGRAM, InvalidOid, ATTSTATSSLOT_VALUES)) {
+        for (int i = 0; i < sslot.nvalues; i++) {
+            levels += itree_packed_depth(DatumGetITree(sslot.values[i]));
+        }
+        count += sslot.nvalues;
+        free_attstatsslot(&sslot);
+    }
+    if (get_attstatsslot(&sslot, vardata->statsTuple, STATISTIC_KIND_MCV, InvalidOid, ATTSTATSSLOT_VALUES)) {
+        for (int i = 0; i < sslot.nvalues; i++) {
+            levels += itree_packed_depth(DatumGetITree(sslot.values[i]));
+        }
+        count += sslot.nvalues;
+        free_attstatsslot(&sslot);
+    }
+    return count > 0 ? levels / count : ITREE_DEFAULT_DEPTH;
+}
+
+/**
+ * JOIN estimator of descendant <@ ancestor (is_descendant_op) and ancestor @> descendant.
+ * A descendant row has one ancestor per level, each one is a single distinct value of the
+ * ancestor column: the selectivity is the average depth over the number of distinct ancestors.
+ */
+static double itree_subtree_join(PlannerInfo *root, List *args, SpecialJoinInfo *sjinfo, bool is_descendant_op) {
+    VariableStatData vardata1;
+    VariableStatData vardata2;
+    VariableStatData *descendants;
+    VariableStatData *ancestors;
+    bool join_is_reversed;
+    bool isdefault;
+    double ndistinct;
+    double selec;
+
+    get_join_variables(root, args, sjinfo, &vardata1, &vardata2, &join_is_reversed);
+    descendants = is_descendant_op ? &vardata1 : &vardata2;
+    ancestors = is_descendant_op ? &vardata2 : &vardata1;
+
+    ndistinct = get_variable_numdistinct(ancestors, &isdefault);
+    selec = itree_average_depth(descendants) / Max(ndistinct, 1.0);
+
+    ReleaseVariableStats(vardata1);
+    ReleaseVariableStats(vardata2);
+    CLAMP_PROBABILITY(selec);
+    return selec;
+}
+
+/**
+ * RESTRICT = itree_descendant_sel for <@
+ */
+PG_FUNCTION_INFO_V1(itree_descendant_sel);
+Datum itree_descendant_sel(PG_FUNCTION_ARGS) {
+    PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+    List *args = (List *) PG_GETARG_POINTER(2);
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(itree_subtree_restrict(root, args, varRelid, true));
+}
+
+/**
+ * RESTRICT = itree_ancestor_sel for @>
+ */
+PG_FUNCTION_INFO_V1(itree_ancestor_sel);
+Datum itree_ancestor_sel(PG_FUNCTION_ARGS) {
+    PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+    List *args = (List *) PG_GETARG_POINTER(2);
+    int varRelid = PG_GETARG_INT32(3);
+
+    PG_RETURN_FLOAT8(itree_subtree_restrict(root, args, varRelid, false));
+}
+
+/**
+ * JOIN = itree_descendant_joinsel for <@
+ */
+PG_FUNCTION_INFO_V1(itree_descendant_joinsel);
+Datum itree_descendant_joinsel(PG_FUNCTION_ARGS) {
+    PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+    List *args = (List *) PG_GETARG_POINTER(2);
+    SpecialJoinInfo *sjinfo = (SpecialJoinInfo *) PG_GETARG_POINTER(4);
+
+    PG_RETURN_FLOAT8(itree_subtree_join(root, args, sjinfo, true));
+}
+
+/**
+ * JOIN = itree_ancestor_joinsel for @>
+ */
+PG_FUNCTION_INFO_V1(itree_ancestor_joinsel);
+Datum itree_ancestor_joinsel(PG_FUNCTION_ARGS) {
+    PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+    List *args = (List *) PG_GETARG_POINTER(2);
+    SpecialJoinInfo *sjinfo = (SpecialJoinInfo *) PG_GETARG_POINTER(4);
+
+    PG_RETURN_FLOAT8(itree_subtree_join(root, args, sjinfo, false));
+}
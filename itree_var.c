@@ -0,0 +1,302 @@
+/**
+ * itree_var: itree values without the fixed 18 bytes, a varlena of variable length segments.
+ * Segments are 1..2147483647 and there is no limit on the number of levels,
+ * a segment up to 127 takes 1 byte, up to 16383 2 bytes, see itree_var_encode_segment().
+ * With the 1 byte short varlena header a 3 level value of small segments takes 4 bytes.
+ *
+ * The bytes are in btree order, equality, ordering, hashing and the subtree tests are byte operations
+ * without decoding the segments, as for itree_key. itree casts implicitly to itree_var,
+ * itree_var casts back by assignment when the value fits in an itree.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "common/hashfn.h"
+#include "libpq/pqformat.h"
+#include "utils/sortsupport.h"
+#include "itree.h"
+
+/**
+ * A palloc'd itree_var of len bytes of the variable length form, with a 4 byte header.
+ * heap_form_tuple() stores it with a short header when it fits.
+ */
+itree_var *itree_var_make(const uint8_t *data, int len) {
+    itree_var *result = (itree_var *) palloc(VARHDRSZ + len);
+
+    SET_VARSIZE(result, VARHDRSZ + len);
+    memcpy(result->data, data, len);
+    return result;
+}
+
+/**
+ * Text input, the syntax of itree with segments up to 2147483647 and any number of levels.
+ */
+PG_FUNCTION_INFO_V1(itree_var_in);
+Datum itree_var_in(PG_FUNCTION_ARGS) {
+    const char *input = PG_GETARG_CSTRING(0);
+    itree_var *result = (itree_var *) palloc(VARHDRSZ + strlen(input));
+    const char *error_at;
+    int nsegments;
+    int len;
+
+    switch (itree_var_parse(input, result->data, &len, &error_at, &nsegments)) {
+        case ITREE_PARSE_OK:
+            break;
+        case ITREE_PARSE_EMPTY_SEGMENT:
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for itree_var: \"%s\"", input),
+                            errdetail("Segment %d is empty.", nsegments)));
+            break;
+        case ITREE_PARSE_UNEXPECTED_CHAR:
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("invalid input syntax for itree_var: \"%s\"", input),
+                            errdetail("Unexpected character at position %d.", (int) (error_at - input) + 1)));
+            break;
+        case ITREE_PARSE_OUT_OF_RANGE:
+        case ITREE_PARSE_TOO_LONG:
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                            errmsg("itree_var segment must be in range 1..%d (got %.*s)", ITREE_VAR_MAX_SEGMENT,
+                                   (int) strspn(error_at, "0123456789"), error_at)));
+            break;
+    }
+
+    SET_VARSIZE(result, VARHDRSZ + len);
+    PG_RETURN_POINTER(result);
+}
+
+PG_FUNCTION_INFO_V1(itree_var_out);
+Datum itree_var_out(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+    char *result = palloc(ITREE_VAR_MAX_TEXT_LEN(ITREE_VAR_LEN(tree)) + 1);
+
+    itree_var_format(ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree), result);
+    PG_RETURN_CSTRING(result);
+}
+
+/**
+ * Binary output: the stored segment bytes as they are, the message length is the value length.
+ */
+PG_FUNCTION_INFO_V1(itree_var_send);
+Datum itree_var_send(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendbytes(&buf, (const char *) ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree));
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/**
+ * Binary input of the itree_var_send layout, rejects bytes that itree_var_in could not have produced,
+ * the empty value included.
+ */
+PG_FUNCTION_INFO_V1(itree_var_recv);
+Datum itree_var_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    int len = buf->len - buf->cursor;
+    const uint8_t *data = (const uint8_t *) pq_getmsgbytes(buf, len);
+
+    if (len == 0 || itree_var_validate(data, len) < 0) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid itree_var binary value")));
+    }
+    PG_RETURN_POINTER(itree_var_make(data, len));
+}
+
+/**
+ * Casts itree → itree_var (implicit) and itree_var → itree (assignment), the latter fails
+ * for values with a segment above 65535 or more than the 16 data bytes of itree.
+ */
+PG_FUNCTION_INFO_V1(itree_to_var);
+Datum itree_to_var(PG_FUNCTION_ARGS) {
+    uint8_t data[ITREE_VAR_MAX_ITREE_LEN];
+    int len = itree_var_encode_itree(PG_GETARG_ITREE(0), data);
+
+    PG_RETURN_POINTER(itree_var_make(data, len));
+}
+
+PG_FUNCTION_INFO_V1(itree_var_to_itree);
+Datum itree_var_to_itree(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+    itree *result = (itree *) palloc(sizeof(itree));
+
+    switch (itree_var_decode_itree(ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree), result)) {
+        case ITREE_PARSE_OK:
+            break;
+        case ITREE_PARSE_TOO_LONG:
+            itree_size_error(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE, "itree_var value");
+            break;
+        default:
+            ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                            errmsg("itree_var value does not fit in itree"),
+                            errdetail("itree segments are 1..65535.")));
+            break;
+    }
+    PG_RETURN_ITREE(result);
+}
+
+static inline int itree_var_compare(const itree_var *a, const itree_var *b) {
+    return itree_var_packed_cmp(ITREE_VAR_DATA(a), ITREE_VAR_LEN(a), ITREE_VAR_DATA(b), ITREE_VAR_LEN(b));
+}
+
+PG_FUNCTION_INFO_V1(itree_var_cmp);
+Datum itree_var_cmp(PG_FUNCTION_ARGS) {
+    PG_RETURN_INT32(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)));
+}
+
+PG_FUNCTION_INFO_V1(itree_var_lt);
+Datum itree_var_lt(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)) < 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_var_le);
+Datum itree_var_le(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_var_eq);
+Datum itree_var_eq(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)) == 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_var_ne);
+Datum itree_var_ne(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)) != 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_var_ge);
+Datum itree_var_ge(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)) >= 0);
+}
+
+PG_FUNCTION_INFO_V1(itree_var_gt);
+Datum itree_var_gt(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_compare(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)) > 0);
+}
+
+/**
+ * The comparator of a sort: values compressed in a large row are detoasted and freed again.
+ */
+static int itree_var_fastcmp(Datum x, Datum y, SortSupport ssup) {
+    itree_var *a = DatumGetITreeVarPP(x);
+    itree_var *b = DatumGetITreeVarPP(y);
+    int result = itree_var_compare(a, b);
+
+    if ((Pointer) a != DatumGetPointer(x)) {
+        pfree(a);
+    }
+    if ((Pointer) b != DatumGetPointer(y)) {
+        pfree(b);
+    }
+    return result;
+}
+
+/**
+ * FUNCTION 2 itree_var_sortsupport(internal)
+ */
+PG_FUNCTION_INFO_V1(itree_var_sortsupport);
+Datum itree_var_sortsupport(PG_FUNCTION_ARGS) {
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = itree_var_fastcmp;
+    PG_RETURN_VOID();
+}
+
+/**
+ * Hash of the segment bytes, equal values are byte equal.
+ */
+PG_FUNCTION_INFO_V1(itree_var_hash);
+Datum itree_var_hash(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+
+    return hash_any(ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree));
+}
+
+PG_FUNCTION_INFO_V1(itree_var_hash_extended);
+Datum itree_var_hash_extended(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+
+    return hash_any_extended(ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree), (uint64) PG_GETARG_INT64(1));
+}
+
+static inline bool itree_var_prefix_of(const itree_var *prefix, const itree_var *tree) {
+    return itree_var_is_prefix(ITREE_VAR_DATA(prefix), ITREE_VAR_LEN(prefix), ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree));
+}
+
+/**
+ * child <@ parent
+ */
+PG_FUNCTION_INFO_V1(itree_var_is_descendant);
+Datum itree_var_is_descendant(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_prefix_of(PG_GETARG_ITREE_VAR_PP(1), PG_GETARG_ITREE_VAR_PP(0)));
+}
+
+/**
+ * parent @> child
+ */
+PG_FUNCTION_INFO_V1(itree_var_is_ancestor);
+Datum itree_var_is_ancestor(PG_FUNCTION_ARGS) {
+    PG_RETURN_BOOL(itree_var_prefix_of(PG_GETARG_ITREE_VAR_PP(0), PG_GETARG_ITREE_VAR_PP(1)));
+}
+
+/**
+ * itree_var ~ iquery and iquery ~ itree_var
+ */
+PG_FUNCTION_INFO_V1(itree_var_matches);
+Datum itree_var_matches(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+
+    PG_RETURN_BOOL(iquery_match_var(PG_GETARG_IQUERY(1), ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree)));
+}
+
+PG_FUNCTION_INFO_V1(iquery_matches_var);
+Datum iquery_matches_var(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(1);
+
+    PG_RETURN_BOOL(iquery_match_var(PG_GETARG_IQUERY(0), ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree)));
+}
+
+/**
+ * itree_var_ilevel ( itree_var ) → integer, the number of levels
+ */
+PG_FUNCTION_INFO_V1(itree_var_ilevel);
+Datum itree_var_ilevel(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+
+    PG_RETURN_INT32(itree_var_depth(ITREE_VAR_DATA(tree), ITREE_VAR_LEN(tree)));
+}
+
+/**
+ * itree_var || itree_var: the segment bytes of both, one after the other.
+ */
+PG_FUNCTION_INFO_V1(itree_var_concat);
+Datum itree_var_concat(PG_FUNCTION_ARGS) {
+    itree_var *a = PG_GETARG_ITREE_VAR_PP(0);
+    itree_var *b = PG_GETARG_ITREE_VAR_PP(1);
+    itree_var *result = (itree_var *) palloc(VARHDRSZ + ITREE_VAR_LEN(a) + ITREE_VAR_LEN(b));
+
+    SET_VARSIZE(result, VARHDRSZ + ITREE_VAR_LEN(a) + ITREE_VAR_LEN(b));
+    memcpy(result->data, ITREE_VAR_DATA(a), ITREE_VAR_LEN(a));
+    memcpy(result->data + ITREE_VAR_LEN(a), ITREE_VAR_DATA(b), ITREE_VAR_LEN(b));
+    PG_RETURN_POINTER(result);
+}
+
+/**
+ * itree_var || integer: one more level.
+ */
+PG_FUNCTION_INFO_V1(itree_var_addint);
+Datum itree_var_addint(PG_FUNCTION_ARGS) {
+    itree_var *tree = PG_GETARG_ITREE_VAR_PP(0);
+    int32 value = PG_GETARG_INT32(1);
+    int len = ITREE_VAR_LEN(tree);
+    itree_var *result;
+
+    if (value < 1) {
+        ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                        errmsg("itree_var segment must be in range 1..%d (got %d)", ITREE_VAR_MAX_SEGMENT, value)));
+    }
+    result = (itree_var *) palloc(VARHDRSZ + len + 5);
+    memcpy(result->data, ITREE_VAR_DATA(tree), len);
+    len += itree_var_encode_segment((uint32) value, result->data + len);
+    SET_VARSIZE(result, VARHDRSZ + len);
+    PG_RETURN_POINTER(result);
+}
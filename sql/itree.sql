@@ -1,5 +1,6 @@
 -- Drop and recreate extension for a clean slate
 DROP EXTENSION IF EXISTS itree cascade;
+-- a fresh install runs itree--1.1.sql
 CREATE EXTENSION itree;
 
 
@@ -52,7 +53,7 @@ SELECT NULL::itree;
 --max level 1 byte segments ok
 SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16'::itree;
 
--- more then max level ignored
+-- more then max level not allowed, the 17th level is not truncated
 SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17'::itree;
 
 -- more then max 16 byte storage not allowed
@@ -62,13 +63,17 @@ select '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.300'::itree;
 --empty internal segment not allowed
 SELECT '1..3'::itree;
 
---empty last segment ignored
+--empty last segment not allowed
 SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.'::itree;
 
 --INVALID last segment not ignored
 SELECT '1.2.0'::itree;
 SELECT '1.2.-3'::itree;
 
+--trailing garbage not allowed
+SELECT '1.2x'::itree;
+SELECT ' 1.2'::itree;
+
 --2 byte segment is ok
 SELECT '256'::itree as two_byte_segment;
 -- Expected: 1.256
@@ -77,6 +82,17 @@ SELECT '256'::itree as two_byte_segment;
 SELECT '1.2.3'::itree AS basic_input;
 -- Expected: 1.2.3
 
+-- Binary output has the layout of ITree.value in type.py
+SELECT itree_send('1.2.300.4.500'::itree) AS binary_output;
+-- Expected: \xedff0102012c0401f4000000000000000000
+
+-- All 18 bytes are stored
+CREATE TEMP TABLE itree_full (id itree);
+INSERT INTO itree_full VALUES
+    ('1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16'),
+    ('256.257.258.259.260.261.262.263');
+SELECT id, ilevel(id) FROM itree_full;
+
 -- more then 2 byte segment not allowed
 SELECT '1.65536'::itree AS too_big_input;
 -- Expected: ERROR:  itree segment must be in range 1..65535 (got 65536)
@@ -136,6 +152,45 @@ SELECT '300'::itree >= '300'::itree AS ge_true;
 SELECT '2'::itree >= '300'::itree AS ge_false;
 -- Expected: f
 
+-- 1-byte segments sort before 2-byte segments whatever their first byte
+SELECT '5'::itree < '256'::itree AS lt_1byte_2byte;
+-- Expected: t
+
+SELECT '1.1.9'::itree < '1.257'::itree AS lt_same_high_byte;
+-- Expected: t
+
+-- Packed compare must give the order of the decoded segments,
+-- itree_path_segments reads the segments from the control bits one at a time and is the reference
+SELECT setseed(0.42);
+CREATE TEMP TABLE itree_cmp_rand AS
+SELECT i, string_agg(seg::text, '.' ORDER BY l)::itree AS id
+FROM generate_series(1, 400) i,
+     LATERAL (SELECT l, (ARRAY[1, 2, 3, 254, 255, 256, 257, 300, 511, 65535])[1 + floor(random() * 10)::int] AS seg
+              FROM generate_series(1, 1 + (i * 0 + floor(random() * 7))::int) l) s
+GROUP BY i;
+
+SELECT count(*) AS cmp_mismatches
+FROM itree_cmp_rand a, itree_cmp_rand b
+WHERE sign(itree_cmp(a.id, b.id)) <> sign(btarraycmp(ARRAY(SELECT itree_path_segments(a.id)),
+                                                     ARRAY(SELECT itree_path_segments(b.id))));
+-- Expected: 0
+
+SELECT count(*) AS order_mismatches
+FROM (SELECT rank() OVER (ORDER BY id) AS by_itree,
+             rank() OVER (ORDER BY ARRAY(SELECT itree_path_segments(id))) AS by_segments
+      FROM itree_cmp_rand) r
+WHERE by_itree <> by_segments;
+-- Expected: 0
+
+-- Index build sorts with the sort support and abbreviated keys, every value must be found again
+CREATE INDEX itree_cmp_rand_idx ON itree_cmp_rand (id);
+SET enable_seqscan = off;
+SELECT count(*) AS index_misses
+FROM itree_cmp_rand a
+WHERE NOT EXISTS (SELECT 1 FROM itree_cmp_rand b WHERE b.id = a.id);
+-- Expected: 0
+RESET enable_seqscan;
+
 -- Test hierarchical operators (GIN support)
 SELECT '1.2.3'::itree <@ '1.2'::itree AS descendant_true;
 -- Expected: t
@@ -270,7 +325,7 @@ SELECT id FROM itree_pk WHERE id > '1.2'::itree AND id < '300'::itree;
 --  2
 
 -- Verify B-tree index usage
-EXPLAIN SELECT id FROM itree_pk WHERE id = '1.2'::itree;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_pk WHERE id = '1.2'::itree;
 -- Expected: Index Scan using itree_pk_pkey
 
 -- Test GIN index
@@ -324,8 +379,932 @@ SELECT * FROM itree_gin_test WHERE ref_id <@ NULL::itree;
 -- Expected: No rows
 
 -- Verify GIN index usage
-EXPLAIN SELECT ref_id FROM itree_gin_test WHERE ref_id <@ '1.2'::itree;
+EXPLAIN (COSTS OFF) SELECT ref_id FROM itree_gin_test WHERE ref_id <@ '1.2'::itree;
 -- Expected: Bitmap Index Scan on itree_gin_idx
 
 -- Reset seqscan
-SET enable_seqscan = on;
\ No newline at end of file
+SET enable_seqscan = on;
+-- GIN answers must be the seq scan answers, without heap rechecks
+CREATE TEMP TABLE itree_gin_rand AS SELECT id FROM itree_cmp_rand;
+CREATE INDEX itree_gin_rand_idx ON itree_gin_rand USING gin (id itree_gin_ops);
+CREATE TEMP TABLE itree_gin_probe AS
+SELECT DISTINCT q FROM (SELECT subpath(id, 0, 1) AS q FROM itree_cmp_rand
+                       UNION ALL SELECT subpath(id, 0, 2) FROM itree_cmp_rand WHERE ilevel(id) >= 2
+                       UNION ALL SELECT id FROM itree_cmp_rand
+                       UNION ALL VALUES ('65535'::itree), ('1.2.3.4.5.6.7')) p;
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+CREATE TEMP TABLE itree_gin_seq AS
+SELECT q,
+       (SELECT array_agg(id ORDER BY id) FROM itree_gin_rand t WHERE t.id <@ q) AS descendants,
+       (SELECT array_agg(id ORDER BY id) FROM itree_gin_rand t WHERE t.id @> q) AS ancestors
+FROM itree_gin_probe;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_gin_rand WHERE id @> '1.2.3'::itree;
+-- Expected: Bitmap Index Scan on itree_gin_rand_idx
+SELECT count(*) AS gin_mismatches
+FROM itree_gin_seq s
+WHERE s.descendants IS DISTINCT FROM (SELECT array_agg(id ORDER BY id) FROM itree_gin_rand t WHERE t.id <@ s.q)
+   OR s.ancestors IS DISTINCT FROM (SELECT array_agg(id ORDER BY id) FROM itree_gin_rand t WHERE t.id @> s.q);
+-- Expected: 0
+SELECT count(*) FILTER (WHERE cardinality(descendants) > 1) > 0 AS has_descendants,
+       count(*) FILTER (WHERE cardinality(ancestors) > 1) > 0 AS has_ancestors
+FROM itree_gin_seq;
+-- Expected: t t
+RESET enable_seqscan;
+
+-- HASH
+SELECT
+    opfname,
+    amprocnum,
+    proname
+FROM pg_amproc
+JOIN pg_proc ON pg_amproc.amproc = pg_proc.oid
+JOIN pg_opfamily ON pg_amproc.amprocfamily = pg_opfamily.oid
+WHERE opfname = 'itree_hash_ops'
+ORDER BY amprocnum;
+
+-- equal values hash equal whichever function built them
+SELECT itree_hash('1.2.300'::itree) = itree_hash('1.2'::itree || 300) AS hash_eq;
+-- Expected: t
+
+SELECT itree_hash_extended('1.2.300'::itree, 42) = itree_hash_extended('1.2'::itree || 300, 42) AS hash_extended_eq;
+-- Expected: t
+
+-- GROUP BY can use a hash aggregate
+SET enable_sort = off;
+EXPLAIN (COSTS OFF) SELECT ref_id, count(*) FROM itree_gin_test GROUP BY ref_id;
+-- Expected: HashAggregate
+
+SELECT ref_id, count(*) FROM itree_gin_test GROUP BY ref_id ORDER BY ref_id;
+RESET enable_sort;
+
+-- joins can hash
+SET enable_mergejoin = off;
+SET enable_nestloop = off;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM itree_gin_test g JOIN itree_pk p ON g.ref_id = p.id;
+-- Expected: Hash Join on the itree equality
+SELECT count(*) AS hash_join_rows FROM itree_gin_test g JOIN itree_pk p ON g.ref_id = p.id;
+-- Expected: 6
+RESET enable_mergejoin;
+RESET enable_nestloop;
+-- GIST
+SELECT am.amname AS index_method,
+       opf.opfname AS opfamily_name,
+       amop.amopopr::regoperator AS opfamily_operator,
+       amop.amopstrategy
+    FROM pg_am am, pg_opfamily opf, pg_amop amop
+    WHERE opf.opfmethod = am.oid AND
+          amop.amopfamily = opf.oid and am.amname ='gist' and opf.opfname = 'itree_gist_ops'
+    ORDER BY amop.amopstrategy;
+SELECT
+    opfname,
+    amprocnum,
+    proname
+FROM pg_amproc
+JOIN pg_proc ON pg_amproc.amproc = pg_proc.oid
+JOIN pg_opfamily ON pg_amproc.amprocfamily = pg_opfamily.oid
+WHERE opfname = 'itree_gist_ops'
+ORDER BY amprocnum;
+-- tree distance: steps up to the common ancestor and down again
+SELECT '1.2.3'::itree <-> '1.4'::itree AS dist_3;
+-- Expected: 3
+SELECT '1.2'::itree <-> '1.2.300.4'::itree AS dist_descendant;
+-- Expected: 2
+SELECT '1.2'::itree <-> '1.2'::itree AS dist_equal;
+-- Expected: 0
+CREATE TEMP TABLE itree_gist_test AS SELECT id FROM itree_cmp_rand;
+CREATE INDEX itree_gist_idx ON itree_gist_test USING gist (id);
+VACUUM ANALYZE itree_gist_test;
+SET enable_seqscan = off;
+-- index answers must match the text prefix reference
+SELECT count(*) AS descendant_mismatches
+FROM (SELECT DISTINCT subpath(id, 0, 1) AS q FROM itree_cmp_rand
+      UNION SELECT subpath(id, 0, 2) FROM itree_cmp_rand WHERE ilevel(id) >= 2
+      UNION SELECT '65535'::itree) p
+WHERE (SELECT count(*) FROM itree_gist_test t WHERE t.id <@ p.q)
+   <> (SELECT count(*) FROM itree_cmp_rand r WHERE r.id::text || '.' LIKE p.q::text || '.%');
+-- Expected: 0
+SELECT count(*) AS ancestor_mismatches
+FROM (SELECT DISTINCT id AS q FROM itree_cmp_rand UNION SELECT '1.2.3.4.5'::itree) p
+WHERE (SELECT count(*) FROM itree_gist_test t WHERE t.id @> p.q)
+   <> (SELECT count(*) FROM itree_cmp_rand r WHERE p.q::text || '.' LIKE r.id::text || '.%');
+-- Expected: 0
+SELECT count(*) AS range_mismatches
+FROM itree_cmp_rand p
+WHERE (SELECT count(*) FROM itree_gist_test t WHERE t.id >= p.id AND t.id < '2.1'::itree)
+   <> (SELECT count(*) FROM itree_cmp_rand r WHERE itree_cmp(r.id, p.id) >= 0 AND itree_cmp(r.id, '2.1'::itree) < 0);
+-- Expected: 0
+-- nearest neighbours come back in distance order from an index only scan
+EXPLAIN (COSTS OFF) SELECT id FROM itree_gist_test ORDER BY id <-> '1.2.3'::itree LIMIT 5;
+-- Expected: Index Only Scan using itree_gist_idx
+SELECT count(*) AS knn_misordered
+FROM (SELECT d, lag(d) OVER (ORDER BY n) AS prev
+      FROM (SELECT id <-> '1.2.3'::itree AS d, row_number() OVER () AS n
+            FROM (SELECT id FROM itree_gist_test ORDER BY id <-> '1.2.3'::itree LIMIT 100) k) s) o
+WHERE d < prev;
+-- Expected: 0
+RESET enable_seqscan;
+-- GiST enforces exclusion constraints, GIN cannot
+CREATE TEMP TABLE itree_gist_excl (id itree, EXCLUDE USING gist (id WITH =));
+INSERT INTO itree_gist_excl VALUES ('1.2'), ('1.2.3');
+INSERT INTO itree_gist_excl VALUES ('1.2');
+-- SUBTREE RANGES
+SELECT itree_next_sibling('1.2.3') AS next_sibling;
+-- Expected: 1.2.4
+SELECT itree_next_sibling('1.255') AS next_sibling_2byte;
+-- Expected: 1.256
+SELECT itree_next_sibling('1.65535');
+-- Expected: ERROR
+SELECT itree_subtree_upper('1.2') AS subtree_upper;
+-- Expected: 1.2.65535.65535.65535.65535.65535.65535.65535
+SELECT itree_subtree_upper('1.2.3') AS subtree_upper_odd;
+-- Expected: 1.2.3.65535.65535.65535.65535.65535.65535.255
+-- <@ and @> against a constant become a btree range scan, no GIN or GiST index needed
+CREATE TEMP TABLE itree_btree_range AS SELECT id FROM itree_cmp_rand;
+CREATE INDEX itree_btree_range_idx ON itree_btree_range (id);
+VACUUM ANALYZE itree_btree_range;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_btree_range WHERE id <@ '1.2'::itree;
+-- Expected: Index Only Scan with a range condition
+EXPLAIN (COSTS OFF) SELECT id FROM itree_btree_range WHERE '300'::itree @> id;
+-- Expected: Index Only Scan with a range condition
+-- every probe as a constant, so the range rewrite is used
+DO $$
+DECLARE
+    q itree;
+    n_index bigint;
+    n_ref bigint;
+    mismatches int := 0;
+BEGIN
+    FOR q IN SELECT subpath(id, 0, 1) FROM itree_cmp_rand
+             UNION SELECT subpath(id, 0, 2) FROM itree_cmp_rand WHERE ilevel(id) >= 2
+             UNION SELECT '65535'::itree
+    LOOP
+        SELECT count(*) INTO n_ref FROM itree_cmp_rand r WHERE r.id::text || '.' LIKE q::text || '.%';
+        EXECUTE format('SELECT count(*) FROM itree_btree_range WHERE id <@ %L::itree', q) INTO n_index;
+        IF n_index <> n_ref THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_btree_range WHERE %L::itree @> id', q) INTO n_index;
+        IF n_index <> n_ref THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'subtree range mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+-- SELECTIVITY
+-- subtrees of very different sizes: '1' has 10 rows, '10' has 1000
+CREATE TEMP TABLE itree_sel AS
+SELECT (a || '.' || b || '.' || c)::itree AS id
+FROM generate_series(1, 10) a, generate_series(1, a * a) b, generate_series(1, 10) c;
+CREATE TEMP TABLE itree_sel_parent AS
+SELECT DISTINCT subpath(id, 0, 1) AS id FROM itree_sel
+UNION ALL SELECT DISTINCT subpath(id, 0, 2) FROM itree_sel;
+ANALYZE itree_sel;
+ANALYZE itree_sel_parent;
+CREATE FUNCTION pg_temp.itree_plan_rows(query text) RETURNS float8 AS $$
+DECLARE
+    plan json;
+BEGIN
+    EXECUTE 'EXPLAIN (FORMAT JSON) ' || query INTO plan;
+    RETURN (plan->0->'Plan'->>'Plan Rows')::float8;
+END;
+$$ LANGUAGE plpgsql;
+SELECT count(*) AS subtree_10_rows FROM itree_sel WHERE id <@ '10';
+-- Expected: 1000
+SELECT pg_temp.itree_plan_rows($$SELECT * FROM itree_sel WHERE id <@ '10'$$) BETWEEN 500 AND 2000 AS subtree_10_estimate;
+-- Expected: t
+SELECT pg_temp.itree_plan_rows($$SELECT * FROM itree_sel WHERE '5' @> id$$) BETWEEN 125 AND 500 AS subtree_5_estimate;
+-- Expected: t
+SELECT pg_temp.itree_plan_rows($$SELECT * FROM itree_sel WHERE id @> '3.2.1'$$) <= 5 AS ancestors_estimate;
+-- Expected: t
+-- every row of itree_sel has 2 ancestors in itree_sel_parent
+SELECT count(*) AS subtree_join_rows FROM itree_sel a JOIN itree_sel_parent p ON a.id <@ p.id;
+-- Expected: 7700
+SELECT pg_temp.itree_plan_rows($$SELECT * FROM itree_sel a JOIN itree_sel_parent p ON a.id <@ p.id$$) BETWEEN 3850 AND 15400 AS subtree_join_estimate;
+-- Expected: t
+-- IQUERY
+SELECT '1.*.3'::iquery AS any_levels, '1.*{2}.*{1,}.*{,3}.*{2,4}.*{0,16}'::iquery AS level_counts, '!5|7.300|2'::iquery AS alternatives;
+-- Expected: 1.*.3 | 1.*{2}.*{1,}.*{,3}.*{2,4}.*{,16} | !5|7.300|2
+SELECT '1.2.3'::itree ~ '1.*.3' AS any_levels,
+       '1.3'::itree ~ '1.*.3' AS no_levels,
+       '1.2.3'::itree ~ '1.*{2}' AS two_levels,
+       '1.2'::itree ~ '1.*{2}' AS one_level,
+       '1.300.4'::itree ~ '1.2|300.!5' AS alternative,
+       '1.300.5'::itree ~ '1.2|300.!5' AS negated,
+       '*.3'::iquery ~ '1.2.3'::itree AS commuted;
+-- Expected: t t t f t f t
+SELECT '1..2'::iquery;
+-- Expected: ERROR
+SELECT '*{3,2}'::iquery;
+-- Expected: ERROR
+SELECT '1.65536'::iquery;
+-- Expected: ERROR
+SELECT '*{255}'::iquery;
+-- Expected: ERROR
+-- GIN matches the fixed width head with partial match, btree scans the subtree of the fixed leading levels
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_gin_rand WHERE id ~ '1.*.3';
+-- Expected: Bitmap Index Scan on itree_gin_rand_idx
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_btree_range WHERE id ~ '1.*.3';
+-- Expected: Index Only Scan with a range condition and a filter
+EXPLAIN (COSTS OFF) SELECT id FROM itree_btree_range WHERE '1.2'::iquery ~ id;
+-- Expected: Index Only Scan with an equality condition
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+-- index answers must be the seq scan answers, patterns as constants so the btree rewrite is used
+CREATE TEMP TABLE itree_query_probe (q iquery);
+INSERT INTO itree_query_probe VALUES
+    ('1.*'), ('*.1'), ('1.*.2'), ('1.*{1}'), ('*{2}'), ('300.*{1,2}'), ('!1.*'), ('1|2.2|3.*'),
+    ('*{1}.255'), ('65535.65535'), ('1.2'), ('*.256.*'), ('1.!2.*{,1}'), ('511'), ('2.*{2,}.3|65535');
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+CREATE TEMP TABLE itree_query_seq AS
+SELECT q, (SELECT count(*) FROM itree_cmp_rand r WHERE r.id ~ p.q) AS n FROM itree_query_probe p;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+SET enable_seqscan = off;
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT q, n FROM itree_query_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_gin_rand WHERE id ~ %L::iquery', probe.q) INTO n_index;
+        IF n_index <> probe.n THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_btree_range WHERE id ~ %L::iquery', probe.q) INTO n_index;
+        IF n_index <> probe.n THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'iquery index mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+RESET enable_seqscan;
+SELECT count(*) FILTER (WHERE n > 0) > 5 AS has_matches FROM itree_query_seq;
+-- Expected: t
+-- LCA AND ROLLUP
+SELECT rollup_to_level('1.2.3.4'::itree, 2) AS level_2,
+       rollup_to_level('1.300.3'::itree, 2) AS two_byte,
+       rollup_to_level('1.2'::itree, 5) AS shallower,
+       rollup_to_level('1.2.3'::itree, 2) = '1.2'::itree AS canonical;
+-- Expected: 1.2 | 1.300 | 1.2 | t
+SELECT rollup_to_level('1.2'::itree, 0);
+-- Expected: ERROR (rollup level must be at least 1)
+SELECT itree_lca(ARRAY['1.2.3', '1.2.5.6', '1.2']::itree[]) AS array_lca,
+       itree_lca(ARRAY['1.1.2', '1.258']::itree[]) AS same_bytes,
+       itree_lca(ARRAY['1.2', NULL, '1.2.3']::itree[]) AS skip_null,
+       itree_lca(ARRAY['1.2', '2.2']::itree[]) IS NULL AS no_common;
+-- Expected: 1.2 | 1 | 1.2 | t
+SELECT itree_lca(id) AS agg_lca FROM (VALUES ('1.2.3'::itree), ('1.2.4.5'), ('1.2.3.9'), (NULL)) v(id);
+-- Expected: 1.2
+SELECT itree_lca(id) IS NULL AS no_common, itree_lca(id) FILTER (WHERE false) IS NULL AS no_rows
+FROM (VALUES ('1.2'::itree), ('2.2')) v(id);
+-- Expected: t | t
+-- rollup_to_level must be the leading segments, itree_lca the longest common leading segments
+SELECT count(*) AS rollup_mismatches
+FROM itree_cmp_rand r, generate_series(1, 8) l
+WHERE rollup_to_level(r.id, l)::text <> array_to_string((string_to_array(r.id::text, '.'))[1:l], '.');
+-- Expected: 0
+SELECT count(*) AS lca_mismatches
+FROM itree_cmp_rand a, itree_cmp_rand b,
+     LATERAL (SELECT max(l) AS common FROM generate_series(1, least(ilevel(a.id), ilevel(b.id))) l
+              WHERE (string_to_array(a.id::text, '.'))[1:l] = (string_to_array(b.id::text, '.'))[1:l]) c
+WHERE a.i <= 100 AND itree_lca(ARRAY[a.id, b.id]) IS DISTINCT FROM rollup_to_level(a.id, c.common);
+-- Expected: 0
+SELECT count(*) AS agg_mismatches
+FROM (SELECT itree_lca(id) AS lca, itree_lca(array_agg(id)) AS lca_array
+      FROM itree_cmp_rand GROUP BY rollup_to_level(id, 1)) g
+WHERE lca IS DISTINCT FROM lca_array;
+-- Expected: 0
+-- parallel plans combine the partial states, temp tables are not scanned in parallel
+CREATE TABLE itree_lca_facts AS
+SELECT ('7.300.' || (i % 50 + 1) || '.' || (i % 7 + 1))::itree AS id, i AS amount FROM generate_series(1, 20000) i;
+ANALYZE itree_lca_facts;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+EXPLAIN (COSTS OFF) SELECT itree_lca(id) FROM itree_lca_facts;
+-- Expected: Partial Aggregate below a Gather
+SELECT itree_lca(id) AS lca, itree_lca(rollup_to_level(id, 3)) AS rollup_lca FROM itree_lca_facts;
+-- Expected: 7.300 | 7.300
+SELECT count(*) AS groups, sum(amount) AS amount
+FROM (SELECT rollup_to_level(id, 3), sum(amount) AS amount FROM itree_lca_facts GROUP BY 1) g;
+-- Expected: 50 | 200010000
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+DROP TABLE itree_lca_facts;
+-- ITREE ARRAYS
+SELECT '{1.3, 1.2}'::itree[] @> '1.2.5'::itree AS has_ancestor,
+       '1.2.5'::itree <@ '{1.3, 1.2}'::itree[] AS commuted_ancestor,
+       '{2.1, 1.2.5}'::itree[] <@ '1.2'::itree AS has_descendant,
+       '1.2'::itree @> '{2.1, 1.2.5}'::itree[] AS commuted_descendant,
+       '{1.3, 1.300}'::itree[] @> '1.2.5'::itree AS no_ancestor,
+       '{1.258}'::itree[] <@ '1.1'::itree AS same_bytes;
+-- Expected: t | t | t | t | f | f
+SELECT '{1.3, 1.2, 1}'::itree[] ?@> '1.2.5' AS first_ancestor,
+       '{2.1, NULL, 1.2.5, 1.2}'::itree[] ?<@ '1.2' AS first_descendant,
+       '{2.1, 1.2.5}'::itree[] ?~ '1.*' AS first_match,
+       ('{2.1}'::itree[] ?@> '1.2') IS NULL AS no_ancestor;
+-- Expected: 1.2 | 1.2.5 | 1.2.5 | t
+SELECT '{2.1, 1.2.5}'::itree[] ~ '1.*.5'::iquery AS matches,
+       '*.1'::iquery ~ '{2.1}'::itree[] AS commuted,
+       '{}'::itree[] <@ '1'::itree AS empty_array;
+-- Expected: t | t | f
+-- GIN over itree[]: every element under its prefix and self keys
+CREATE TEMP TABLE itree_tags AS
+SELECT t.i, CASE WHEN t.i % 10 = 0 THEN '{}'::itree[]
+                 ELSE ARRAY[a.id, b.id, CASE WHEN t.i % 3 = 0 THEN NULL ELSE c.id END] END AS tags
+FROM itree_cmp_rand t
+JOIN itree_cmp_rand a ON a.i = t.i
+JOIN itree_cmp_rand b ON b.i = t.i % 400 + 1
+JOIN itree_cmp_rand c ON c.i = (t.i * 13) % 400 + 1;
+CREATE INDEX itree_tags_idx ON itree_tags USING gin (tags itree_array_gin_ops);
+-- the support functions are declared on the opclass type
+SELECT amvalidate(oid) AS valid FROM pg_opclass WHERE opcname = 'itree_array_gin_ops';
+-- Expected: t
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT * FROM itree_tags WHERE tags <@ '1.2'::itree;
+-- Expected: Bitmap Index Scan on itree_tags_idx
+RESET enable_seqscan;
+-- index answers must be the seq scan answers
+CREATE TEMP TABLE itree_tags_probe AS
+SELECT DISTINCT rollup_to_level(id, 2) AS p FROM itree_cmp_rand
+UNION SELECT id FROM itree_cmp_rand WHERE i <= 20;
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+CREATE TEMP TABLE itree_tags_seq AS
+SELECT p, (SELECT count(*) FROM itree_tags WHERE tags <@ p) AS below,
+          (SELECT count(*) FROM itree_tags WHERE tags @> p) AS above
+FROM itree_tags_probe;
+CREATE TEMP TABLE itree_tags_query_seq AS
+SELECT q, (SELECT count(*) FROM itree_tags WHERE tags ~ q) AS n FROM itree_query_probe;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+SET enable_seqscan = off;
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT p, below, above FROM itree_tags_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_tags WHERE tags <@ %L::itree', probe.p) INTO n_index;
+        IF n_index <> probe.below THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_tags WHERE %L::itree <@ tags', probe.p) INTO n_index;
+        IF n_index <> probe.above THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    FOR probe IN SELECT q, n FROM itree_tags_query_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_tags WHERE tags ~ %L::iquery', probe.q) INTO n_index;
+        IF n_index <> probe.n THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'itree[] index mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+RESET enable_seqscan;
+SELECT count(*) FILTER (WHERE below > 0) > 10 AS has_below, count(*) FILTER (WHERE above > 0) > 10 AS has_above
+FROM itree_tags_seq;
+-- Expected: t | t
+-- LEVEL WALKING
+SELECT * FROM itree_prefixes('1.300.3'::itree);
+-- Expected: 1, 1.300, 1.300.3
+SELECT * FROM itree_ancestors('1.300.3'::itree);
+-- Expected: 1, 1.300
+SELECT * FROM itree_path_segments('1.300.65535.3'::itree) WITH ORDINALITY AS s(segment, level);
+-- Expected: 1, 300, 65535, 3
+SELECT itree_parent('1.2.3'::itree) AS parent, itree_parent('1.300'::itree) AS two_byte,
+       itree_parent('1'::itree) IS NULL AS top_level, (SELECT count(*) FROM itree_ancestors('5'::itree)) AS top_ancestors;
+-- Expected: 1.2 | 1 | t | 0
+SELECT itree_nlevel_prefix('1.2.3'::itree, 2) AS level_2, itree_nlevel_prefix('1.2.3'::itree, 3) AS level_3,
+       itree_nlevel_prefix('1.2'::itree, 3) IS NULL AS too_deep;
+-- Expected: 1.2 | 1.2.3 | t
+SELECT itree_nlevel_prefix('1.2'::itree, 0);
+-- Expected: ERROR (prefix level must be at least 1)
+SELECT * FROM itree_children_range('1.2'::itree);
+-- Expected: 1.2.1 | 1.2.65535.65535.65535.65535.65535.65535.65535
+SELECT itree_children_range('255.255.255.255.255.255.255.255.255.255.255.255.255.255.255.255'::itree) IS NULL AS no_room;
+-- Expected: t
+-- the walks must agree with subpath and the text form
+SELECT count(*) AS prefix_mismatches
+FROM itree_cmp_rand r, itree_prefixes(r.id) WITH ORDINALITY p(prefix, level)
+WHERE p.prefix <> subpath(r.id, 0, p.level::int) OR p.prefix <> itree_nlevel_prefix(r.id, p.level::int);
+-- Expected: 0
+SELECT sum(ilevel(id)) = (SELECT count(*) FROM itree_cmp_rand, itree_prefixes(id)) AS prefix_rows,
+       sum(ilevel(id) - 1) = (SELECT count(*) FROM itree_cmp_rand, itree_ancestors(id)) AS ancestor_rows
+FROM itree_cmp_rand;
+-- Expected: t | t
+SELECT count(*) AS ancestor_mismatches
+FROM itree_cmp_rand r, itree_ancestors(r.id) a
+WHERE NOT (r.id <@ a AND r.id <> a);
+-- Expected: 0
+SELECT count(*) AS segment_mismatches
+FROM itree_cmp_rand r
+WHERE ARRAY(SELECT itree_path_segments(r.id)) <> string_to_array(r.id::text, '.')::int[];
+-- Expected: 0
+SELECT count(*) AS parent_mismatches
+FROM itree_cmp_rand r
+WHERE itree_parent(r.id) IS DISTINCT FROM CASE WHEN ilevel(r.id) > 1 THEN subpath(r.id, 0, -1) END;
+-- Expected: 0
+SELECT count(*) AS children_range_mismatches
+FROM itree_cmp_rand a CROSS JOIN LATERAL itree_children_range(a.id) c, itree_cmp_rand b
+WHERE (b.id BETWEEN c.lower AND c.upper) <> (b.id <@ a.id AND b.id <> a.id);
+-- Expected: 0
+-- BRIN
+-- minmax in btree order: loaded sorted, <@ against a constant is a range condition on the summaries
+CREATE TEMP TABLE itree_brin_minmax WITH (fillfactor = 10) AS SELECT i, id FROM itree_cmp_rand ORDER BY id;
+CREATE INDEX itree_brin_minmax_idx ON itree_brin_minmax USING brin (id) WITH (pages_per_range = 1);
+-- the common prefix of each range: also answers @>, which is no btree range
+CREATE TEMP TABLE itree_brin_prefix WITH (fillfactor = 10) AS SELECT i, id FROM itree_cmp_rand ORDER BY id;
+CREATE INDEX itree_brin_prefix_idx ON itree_brin_prefix USING brin (id itree_prefix_brin_ops) WITH (pages_per_range = 1);
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_brin_minmax WHERE id <@ '1.2'::itree;
+-- Expected: Bitmap Index Scan on itree_brin_minmax_idx with a range condition
+EXPLAIN (COSTS OFF) SELECT id FROM itree_brin_prefix WHERE id @> '1.2.3'::itree;
+-- Expected: Bitmap Index Scan on itree_brin_prefix_idx
+RESET enable_seqscan;
+-- rows moved to another branch cut the summaries of their ranges
+UPDATE itree_brin_minmax SET id = '9.9.9' WHERE i % 50 = 0;
+UPDATE itree_brin_prefix SET id = '9.9.9' WHERE i % 50 = 0;
+-- index answers must be the seq scan answers
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+CREATE TEMP TABLE itree_brin_seq AS
+SELECT p, (SELECT count(*) FROM itree_brin_prefix WHERE id <@ p) AS below,
+          (SELECT count(*) FROM itree_brin_prefix WHERE id @> p) AS above,
+          (SELECT count(*) FROM itree_brin_prefix WHERE id = p) AS equal
+FROM itree_tags_probe;
+CREATE TEMP TABLE itree_brin_query_seq AS
+SELECT q, (SELECT count(*) FROM itree_brin_prefix WHERE id ~ q) AS n FROM itree_query_probe;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+SET enable_seqscan = off;
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT p, below, above, equal FROM itree_brin_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_brin_minmax WHERE id <@ %L::itree', probe.p) INTO n_index;
+        IF n_index <> probe.below THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_brin_minmax WHERE id = %L::itree', probe.p) INTO n_index;
+        IF n_index <> probe.equal THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_brin_prefix WHERE id <@ %L::itree', probe.p) INTO n_index;
+        IF n_index <> probe.below THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_brin_prefix WHERE %L::itree <@ id', probe.p) INTO n_index;
+        IF n_index <> probe.above THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_brin_prefix WHERE id = %L::itree', probe.p) INTO n_index;
+        IF n_index <> probe.equal THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    FOR probe IN SELECT q, n FROM itree_brin_query_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_brin_prefix WHERE id ~ %L::iquery', probe.q) INTO n_index;
+        IF n_index <> probe.n THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'BRIN index mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+RESET enable_seqscan;
+SELECT count(*) FILTER (WHERE below > 0) > 10 AS has_below, count(*) FILTER (WHERE above > 0) > 10 AS has_above
+FROM itree_brin_seq;
+-- Expected: t | t
+-- BATCH FILTERS
+SELECT itree_descendant_bitmap('{1.2.3, 2, 1.2, NULL, 1.300}'::itree[], '1.2'::itree) AS array_bits,
+       itree_descendant_bitmap(itree_pack('{1.2.3, 2, 1.2}'), '1.2'::itree) AS packed_bits,
+       length(itree_pack('{1.2, 1.3}')) AS packed_bytes;
+-- Expected: 10100 | 101 | 36
+SELECT itree_descendant_bitmap('{}'::itree[], '1'::itree) AS empty,
+       itree_descendant_bitmap('{1.256, 1.2, 1.256.1}'::itree[], '1.256'::itree) AS two_byte;
+-- Expected: (empty) | 101
+SELECT itree_descendant_bitmap('\x0102'::bytea, '1'::itree);
+-- Expected: ERROR (not a multiple of 18 bytes)
+SELECT itree_pack(ARRAY['1'::itree, NULL]);
+-- Expected: ERROR (array must not contain nulls)
+-- the bitmaps and <@ with a changing right side must agree with the text prefix
+CREATE TEMP TABLE itree_batch_ids AS SELECT array_agg(id ORDER BY i) AS ids FROM itree_cmp_rand;
+SELECT count(*) AS bitmap_mismatches
+FROM itree_tags_probe p, itree_batch_ids a,
+     LATERAL (SELECT itree_descendant_bitmap(a.ids, p.p) AS by_array,
+                     itree_descendant_bitmap(itree_pack(a.ids), p.p) AS by_pack) b,
+     generate_series(1, 400) g
+WHERE get_bit(b.by_array, g - 1) <> get_bit(b.by_pack, g - 1)
+   OR (get_bit(b.by_array, g - 1) = 1) <> starts_with(a.ids[g]::text || '.', p.p::text || '.')
+   OR (a.ids[g] <@ p.p) <> starts_with(a.ids[g]::text || '.', p.p::text || '.')
+   OR (p.p @> a.ids[g]) <> starts_with(a.ids[g]::text || '.', p.p::text || '.');
+-- Expected: 0
+-- ITREE KEY
+SELECT extversion FROM pg_extension WHERE extname = 'itree';
+-- Expected: 1.1
+SELECT '1.300.2'::itree_key AS key, '1.300.2'::itree_key::itree AS tree,
+       itree_key_send('1.300.2') = itree_send('1.300.2') AS same_wire, ilevel('1.300.2'::itree_key) AS levels;
+-- Expected: 1.300.2 | 1.300.2 | t | 3
+SELECT '1.0'::itree_key;
+-- Expected: ERROR (segment out of range)
+SELECT '1.2'::itree_key < '1.256'::itree_key AS one_byte_first, '1.255'::itree_key < '1.256'::itree_key AS byte_255,
+       '1.2'::itree_key < '1.2.1'::itree_key AS prefix_first, '1.256.1'::itree_key <@ '1.256'::itree_key AS below,
+       '1.256'::itree_key @> '1.2'::itree_key AS not_above;
+-- Expected: t | t | t | t | f
+-- memcmp order, hashing and the subtree tests must agree with itree
+SELECT count(*) AS key_mismatches
+FROM itree_cmp_rand a, itree_cmp_rand b
+WHERE itree_key_cmp(a.id::itree_key, b.id::itree_key) <> itree_cmp(a.id, b.id)
+   OR (a.id::itree_key <@ b.id::itree_key) <> (a.id <@ b.id)
+   OR (a.id::itree_key @> b.id::itree_key) <> (a.id @> b.id)
+   OR (a.id = b.id AND itree_key_hash(a.id::itree_key) <> itree_key_hash(b.id::itree_key));
+-- Expected: 0
+SELECT count(*) AS round_trip_mismatches FROM itree_cmp_rand WHERE id::itree_key::itree <> id OR id::itree_key::text <> id::text;
+-- Expected: 0
+CREATE TEMP TABLE itree_key_test AS SELECT i, id::itree_key AS id FROM itree_cmp_rand;
+CREATE INDEX itree_key_test_idx ON itree_key_test (id);
+VACUUM ANALYZE itree_key_test;
+SELECT (SELECT array_agg(id::text ORDER BY id) FROM itree_key_test) = (SELECT array_agg(id::text ORDER BY id) FROM itree_cmp_rand) AS same_order,
+       (SELECT count(*) FROM (SELECT id FROM itree_key_test GROUP BY id) g) = (SELECT count(DISTINCT id) FROM itree_cmp_rand) AS same_groups;
+-- Expected: t | t
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_key_test WHERE id <@ '1.2'::itree_key;
+-- Expected: Index Only Scan with a range condition
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT p, below, above FROM itree_brin_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_key_test WHERE id <@ %L::itree_key', probe.p) INTO n_index;
+        IF n_index <> (SELECT count(*) FROM itree_cmp_rand WHERE id <@ probe.p) THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_key_test WHERE %L::itree_key @> id', probe.p) INTO n_index;
+        IF n_index <> (SELECT count(*) FROM itree_cmp_rand WHERE id <@ probe.p) THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'itree_key index mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+-- ITREE VAR
+CREATE TEMP TABLE itree_var_size (id itree_var, fixed itree);
+INSERT INTO itree_var_size VALUES ('1.2.3', '1.2.3'), ('1.300.20000', '1.300.20000');
+SELECT id, pg_column_size(id) AS var_bytes, pg_column_size(fixed) AS itree_bytes FROM itree_var_size ORDER BY id;
+-- Expected: 4 and 7 bytes with the short header, against 18
+SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20'::itree_var AS deep,
+       itree_var_ilevel('1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20') AS levels,
+       '1.70000.2147483647'::itree_var AS wide;
+-- Expected: 20 levels and segments above 65535
+SELECT '1.2147483648'::itree_var;
+-- Expected: ERROR (segment out of range)
+SELECT '1..2'::itree_var;
+-- Expected: ERROR (empty segment)
+SELECT '1.70000'::itree_var::itree;
+-- Expected: ERROR (does not fit in itree)
+SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.300'::itree_var::itree;
+-- Expected: ERROR (exceeds max size)
+SELECT '1.2'::itree_var < '1.128'::itree_var AS one_byte_first, '1.16383'::itree_var < '1.16384'::itree_var AS two_bytes_first,
+       '1.2'::itree_var < '1.2.1'::itree_var AS prefix_first, '1.2.3'::itree_var <@ '1.2'::itree_var AS below,
+       '1.2'::itree_var @> '1.20'::itree_var AS not_above;
+-- Expected: t | t | t | t | f
+-- order, hashing, the subtree tests and iquery matches must agree with itree
+SELECT count(*) AS var_mismatches
+FROM itree_cmp_rand a, itree_cmp_rand b
+WHERE itree_var_cmp(a.id, b.id) <> itree_cmp(a.id, b.id)
+   OR (a.id::itree_var <@ b.id::itree_var) <> (a.id <@ b.id)
+   OR (a.id::itree_var @> b.id::itree_var) <> (a.id @> b.id)
+   OR (a.id = b.id AND itree_var_hash(a.id) <> itree_var_hash(b.id));
+-- Expected: 0
+SELECT count(*) AS round_trip_mismatches FROM itree_cmp_rand WHERE id::itree_var::itree <> id OR id::itree_var::text <> id::text;
+-- Expected: 0
+SELECT count(*) AS match_mismatches
+FROM itree_cmp_rand a, (VALUES ('1.*'::iquery), ('*.2'), ('1.*{1}.3|255'), ('!1.*'), ('*{2}'), ('*.65535.*')) q(q)
+WHERE (a.id::itree_var ~ q.q) <> (a.id ~ q.q);
+-- Expected: 0
+SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20'::itree_var ~ '1.*.20' AS deep_match,
+       '1.70000.3'::itree_var ~ '1.!5.3' AS wide_not, '1.70000.3'::itree_var ~ '1.*{1}.3' AS wide_any,
+       '1.70000.3'::itree_var ~ '1.*{2}' AS wide_levels;
+-- Expected: t | t | t | t
+-- a bound of 16 is a bound, not the end of the levels of an itree
+SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20'::itree_var ~ '1.*{,16}' AS at_most_16,
+       '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20'::itree_var ~ '1.*{19}' AS exactly_19,
+       '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20'::itree_var ~ '*{17,}' AS at_least_17,
+       '1.2.3'::itree ~ '1.*{,16}' AS itree_clamped, '1.2.3'::itree ~ '1.*{20}' AS itree_too_deep;
+-- Expected: f | t | t | t | f
+SELECT '1.2'::itree_var || '70000.3'::itree_var AS concat, '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16'::itree_var || 17 AS deeper;
+-- Expected: 1.2.70000.3 | 1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17
+CREATE TEMP TABLE itree_var_test AS SELECT i, id::itree_var AS id FROM itree_cmp_rand;
+INSERT INTO itree_var_test SELECT 1000 + g, ('1.2.' || g || '.4.5.6.7.8.9.10.11.12.13.14.15.16.17.' || g * 100000)::itree_var
+FROM generate_series(1, 20) g;
+CREATE INDEX itree_var_test_idx ON itree_var_test (id);
+VACUUM ANALYZE itree_var_test;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_var_test WHERE id <@ '1.2'::itree_var;
+-- Expected: Index Only Scan up to the next sibling
+CREATE TEMP TABLE itree_var_probe AS
+SELECT p::itree_var AS p FROM itree_brin_seq
+UNION ALL VALUES ('1.2.5'::itree_var), ('1.2.5.4.5.6.7.8.9.10.11.12.13.14.15.16'), ('1.2.5.4.5.6.7.8.9.10.11.12.13.14.15.16.17.500000'),
+                 ('1.2147483647');
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT p FROM itree_var_probe LOOP
+        EXECUTE format('SELECT count(*) FROM itree_var_test WHERE id <@ %L::itree_var', probe.p) INTO n_index;
+        IF n_index <> (SELECT count(*) FROM itree_var_test WHERE starts_with(id::text || '.', probe.p::text || '.')) THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_var_test WHERE id @> %L::itree_var', probe.p) INTO n_index;
+        IF n_index <> (SELECT count(*) FROM itree_var_test WHERE starts_with(probe.p::text || '.', id::text || '.')) THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'itree_var btree mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+DROP INDEX itree_var_test_idx;
+CREATE INDEX itree_var_test_gin_idx ON itree_var_test USING gin (id itree_var_gin_ops);
+-- the support functions are declared on the opclass type
+SELECT amvalidate(oid) AS valid FROM pg_opclass WHERE opcname = 'itree_var_gin_ops';
+-- Expected: t
+SET enable_bitmapscan = on;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_var_test WHERE id @> '1.2.5.4'::itree_var;
+-- Expected: Bitmap Index Scan on the GIN index
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT p FROM itree_var_probe LOOP
+        EXECUTE format('SELECT count(*) FROM itree_var_test WHERE id <@ %L::itree_var', probe.p) INTO n_index;
+        IF n_index <> (SELECT count(*) FROM itree_var_test WHERE starts_with(id::text || '.', probe.p::text || '.')) THEN
+            mismatches := mismatches + 1;
+        END IF;
+        EXECUTE format('SELECT count(*) FROM itree_var_test WHERE id @> %L::itree_var', probe.p) INTO n_index;
+        IF n_index <> (SELECT count(*) FROM itree_var_test WHERE starts_with(probe.p::text || '.', id::text || '.')) THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'itree_var GIN mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+EXPLAIN (COSTS OFF) SELECT id FROM itree_var_test WHERE id ~ '1.2.*{15}';
+-- Expected: Bitmap Index Scan on the GIN index
+SELECT count(*) AS var_gin_match_mismatches
+FROM (VALUES ('1.2.*{15}'::iquery), ('1.2.3.*'), ('1.2.5.4.5.6.7.8.9.10.11.12.13.14.15.16.17.*'),
+             ('1.2.*{1}.4.*{12}.17.*'), ('1.*{,16}'), ('*.17.*'), ('255|256.*'), ('!1.*')) q(q)
+WHERE (SELECT count(*) FROM itree_var_test WHERE id ~ q.q)
+   <> (SELECT count(*) FROM itree_var_test WHERE itree_var_matches(id, q.q));
+-- Expected: 0
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+-- CLOSURE
+CREATE TEMP TABLE itree_closure_src (node itree, amount int);
+INSERT INTO itree_closure_src VALUES ('1', 10), ('1.2', 5), ('1.2.3', 1), ('1.2.3', 2), ('2.300', 7), (NULL, 4);
+SELECT itree_closure_create('itree_closure_src', 'node', 'amount');
+SELECT * FROM itree_closure_src_node_closure ORDER BY node;
+-- Expected: 1 has 4 rows in its subtree with a sum of 18, 2 has none of its own
+CREATE TEMP VIEW itree_closure_expected AS
+SELECT p AS node, count(*) FILTER (WHERE p = s.node) AS self_count, count(*) AS subtree_count,
+       coalesce(sum(s.amount) FILTER (WHERE p = s.node), 0) AS self_sum, coalesce(sum(s.amount), 0) AS subtree_sum
+FROM itree_closure_src s, itree_prefixes(s.node) p GROUP BY p;
+CREATE TEMP VIEW itree_closure_diff AS
+SELECT count(*) AS differences
+FROM ((TABLE itree_closure_expected EXCEPT TABLE itree_closure_src_node_closure)
+      UNION ALL (TABLE itree_closure_src_node_closure EXCEPT TABLE itree_closure_expected)) d;
+UPDATE itree_closure_src SET node = '2.5' WHERE node = '1.2.3';
+SELECT * FROM itree_closure_src_node_closure ORDER BY node;
+-- Expected: 1.2.3 is gone, 2.5 has the 2 moved rows
+INSERT INTO itree_closure_src SELECT id, i FROM itree_cmp_rand;
+SELECT * FROM itree_closure_diff;
+-- Expected: 0, 400 rows merged by one statement
+UPDATE itree_closure_src SET amount = amount + 1 WHERE node <@ '1';
+UPDATE itree_closure_src SET node = node || 7 WHERE node <@ '3' AND ilevel(node) < 5;
+SELECT * FROM itree_closure_diff;
+-- Expected: 0
+DELETE FROM itree_closure_src WHERE node <@ '2';
+SELECT * FROM itree_closure_diff;
+-- Expected: 0
+SELECT count(*) AS emptied FROM itree_closure_src_node_closure WHERE node <@ '2';
+-- Expected: 0, nodes without rows are deleted
+TRUNCATE itree_closure_src;
+SELECT count(*) AS after_truncate FROM itree_closure_src_node_closure;
+-- Expected: 0
+SELECT itree_closure_create('itree_closure_src', 'amount');
+-- Expected: ERROR (not an itree column)
+-- SPGIST
+CREATE TEMP TABLE itree_spgist_test AS SELECT id FROM itree_cmp_rand;
+INSERT INTO itree_spgist_test SELECT '1.2'::itree FROM generate_series(1, 1000);
+CREATE INDEX itree_spgist_idx ON itree_spgist_test USING spgist (id);
+-- more duplicates than a page holds fill allTheSame inner tuples, then other values split them
+INSERT INTO itree_spgist_test SELECT '1.2'::itree FROM generate_series(1, 1000);
+INSERT INTO itree_spgist_test SELECT id || 7 FROM itree_cmp_rand WHERE ilevel(id) < 5;
+VACUUM ANALYZE itree_spgist_test;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_spgist_test WHERE id <@ '1.2'::itree;
+-- Expected: Index Only Scan using itree_spgist_idx
+-- index answers must match the text prefix reference
+SELECT count(*) AS descendant_mismatches
+FROM (SELECT DISTINCT subpath(id, 0, 1) AS q FROM itree_cmp_rand
+      UNION SELECT subpath(id, 0, 2) FROM itree_cmp_rand WHERE ilevel(id) >= 2
+      UNION SELECT '65535'::itree) p
+WHERE (SELECT count(*) FROM itree_spgist_test t WHERE t.id <@ p.q)
+   <> (SELECT count(*) FROM itree_spgist_test r WHERE r.id::text || '.' LIKE p.q::text || '.%');
+-- Expected: 0
+SELECT count(*) AS ancestor_mismatches
+FROM (SELECT DISTINCT id AS q FROM itree_spgist_test UNION SELECT '1.2.3.4.5'::itree) p
+WHERE (SELECT count(*) FROM itree_spgist_test t WHERE t.id @> p.q)
+   <> (SELECT count(*) FROM itree_spgist_test r WHERE p.q::text || '.' LIKE r.id::text || '.%');
+-- Expected: 0
+SELECT count(*) AS equal_mismatches
+FROM (SELECT DISTINCT id AS q FROM itree_spgist_test UNION SELECT '1.2.3.4.5'::itree) p
+WHERE (SELECT count(*) FROM itree_spgist_test t WHERE t.id = p.q)
+   <> (SELECT count(*) FROM itree_spgist_test r WHERE r.id::text = p.q::text);
+-- Expected: 0
+SELECT count(*) AS range_mismatches
+FROM itree_cmp_rand p
+WHERE (SELECT count(*) FROM itree_spgist_test t WHERE t.id >= p.id AND t.id < '2.1'::itree)
+   <> (SELECT count(*) FROM itree_spgist_test r WHERE itree_cmp(r.id, p.id) >= 0 AND itree_cmp(r.id, '2.1'::itree) < 0)
+   OR (SELECT count(*) FROM itree_spgist_test t WHERE t.id > p.id AND t.id <= '257'::itree)
+   <> (SELECT count(*) FROM itree_spgist_test r WHERE itree_cmp(r.id, p.id) > 0 AND itree_cmp(r.id, '257'::itree) <= 0);
+-- Expected: 0
+-- nearest neighbours come back in distance order from an index only scan
+EXPLAIN (COSTS OFF) SELECT id FROM itree_spgist_test ORDER BY id <-> '1.2.3'::itree LIMIT 5;
+-- Expected: Index Only Scan using itree_spgist_idx
+SELECT count(*) AS knn_misordered
+FROM (SELECT d, lag(d) OVER (ORDER BY n) AS prev
+      FROM (SELECT id <-> '1.2.3'::itree AS d, row_number() OVER () AS n
+            FROM (SELECT id FROM itree_spgist_test ORDER BY id <-> '1.2.3'::itree LIMIT 2100) k) s) o
+WHERE d < prev;
+-- Expected: 0
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+-- GIN FINGERPRINT
+CREATE TEMP TABLE itree_gin_fp_rand AS SELECT id FROM itree_cmp_rand;
+CREATE INDEX itree_gin_fp_idx ON itree_gin_fp_rand USING gin (id itree_gin_fp_ops);
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT id FROM itree_gin_fp_rand WHERE id @> '1.2.3'::itree;
+-- Expected: Bitmap Index Scan on itree_gin_fp_idx with a recheck
+-- the same answers as the seq scans of the GIN section
+SELECT count(*) AS gin_fp_mismatches
+FROM itree_gin_seq s
+WHERE s.descendants IS DISTINCT FROM (SELECT array_agg(id ORDER BY id) FROM itree_gin_fp_rand t WHERE t.id <@ s.q)
+   OR s.ancestors IS DISTINCT FROM (SELECT array_agg(id ORDER BY id) FROM itree_gin_fp_rand t WHERE t.id @> s.q);
+-- Expected: 0
+DO $$
+DECLARE
+    probe record;
+    n_index bigint;
+    mismatches int := 0;
+BEGIN
+    FOR probe IN SELECT q, n FROM itree_query_seq LOOP
+        EXECUTE format('SELECT count(*) FROM itree_gin_fp_rand WHERE id ~ %L::iquery', probe.q) INTO n_index;
+        IF n_index <> probe.n THEN
+            mismatches := mismatches + 1;
+        END IF;
+    END LOOP;
+    RAISE NOTICE 'iquery fingerprint index mismatches: %', mismatches;
+END;
+$$;
+-- Expected: 0
+RESET enable_seqscan;
+-- PACKED CONCAT AND SUBPATH
+-- || and subpath splice the packed bytes, a text operand is parsed with the rules of the itree input
+SELECT '1.2.3'::itree || '4.5'::text AS concat_explicit_text;
+-- Expected: 1.2.3.4.5
+SELECT '1.300'::itree || '65535.7'::itree AS concat_wide;
+-- Expected: 1.300.65535.7
+SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14'::itree || 300 AS concat_last_two_bytes;
+-- Expected: 1.2.3.4.5.6.7.8.9.10.11.12.13.14.300
+SELECT '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15'::itree || 300 AS concat_too_long;
+-- Expected: ERROR, a 2 byte segment does not fit in the last byte
+SELECT '1.2'::itree || 0 AS concat_zero;
+-- Expected: ERROR
+SELECT '1.2'::itree || '3.x'::text AS concat_bad_text;
+-- Expected: ERROR
+SELECT subitree('1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16'::itree, 14, 16) AS subitree_last_levels;
+-- Expected: 15.16
+SELECT subitree('1.2.3.4'::itree, 2, 1) AS subitree_reversed;
+-- Expected: ERROR (subpath out of bounds)
+SELECT subpath('1.300.2.65535.3'::itree, 1, 3) AS subpath_wide, subpath('1.300.2.65535.3'::itree, -2, -1) AS subpath_wide_negative;
+-- Expected: 300.2.65535 | 65535
+-- splitting a value and joining the parts again gives the value back
+WITH deep AS MATERIALIZED (SELECT id FROM itree_cmp_rand WHERE ilevel(id) >= 2)
+SELECT count(*) AS split_mismatches FROM deep
+WHERE subpath(id, 0, 1) || subpath(id, 1, ilevel(id) - 1) <> id
+   OR subpath(id, 0, 1) || subitree(id, 1, ilevel(id))::text <> id
+   OR subpath(id, 0, -1) || subpath(id, -1, 1)::text::int <> id;
+-- Expected: 0
+
+-- CHILD ALLOCATOR
+-- itree_next_child() seeds its counter from the btree on the first call per parent, then counts on in shared memory
+CREATE TEMP TABLE itree_alloc (id itree PRIMARY KEY);
+INSERT INTO itree_alloc VALUES ('1'), ('1.1'), ('1.7'), ('1.7.3'), ('2'), ('6.255'), ('5.65534'),
+    ('1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.254');
+SELECT itree_next_child('itree_alloc', '1') AS first_child;
+-- Expected: 1.8, after the greatest child 1.7 of the index
+SELECT itree_next_child('itree_alloc', '1') AS second_child;
+-- Expected: 1.9, the counter moves on without the row of 1.8
+SELECT itree_next_child('itree_alloc_pkey', '1') AS through_index;
+-- Expected: 1.10, the index stands for the same counter as its table
+SELECT itree_next_child('itree_alloc', '1.7.3') AS leaf_child;
+-- Expected: 1.7.3.1
+SELECT itree_next_child('itree_alloc', '6') AS two_byte_child;
+-- Expected: 6.256, the first 2 byte segment
+SELECT itree_next_child('itree_alloc', '5') AS last_segment;
+-- Expected: 5.65535
+SELECT itree_next_child('itree_alloc', '5') AS past_last_segment;
+-- Expected: ERROR
+SELECT itree_next_child('itree_alloc', '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15') AS last_byte;
+-- Expected: 1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.255, the last segment that fits in one byte
+SELECT itree_next_child('itree_alloc', '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15') AS past_last_byte;
+-- Expected: ERROR
+SELECT itree_next_child('itree_alloc', '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16') AS full_parent;
+-- Expected: ERROR
+INSERT INTO itree_alloc SELECT itree_next_child('itree_alloc', '3') FROM generate_series(1, 300);
+SELECT count(*) AS children FROM itree_alloc a JOIN generate_series(1, 300) n ON a.id = '3'::itree || n;
+-- Expected: 300, the children 3.1 to 3.300
+CREATE TEMP TABLE itree_alloc_noidx (id itree);
+SELECT itree_next_child('itree_alloc_noidx', '1');
+-- Expected: ERROR
+-- a bucket holds 8 parents, one transaction can't hold counters of 5000 parents in 512 buckets
+SELECT count(itree_next_child('itree_alloc', '1000'::itree || i)) AS full_bucket FROM generate_series(1, 5000) i;
+-- Expected: ERROR
+SELECT itree_next_child('itree_alloc', '4') AS after_full_bucket;
+-- Expected: 4.1, the slots of the failed transaction are evicted once it has ended
+-- REBASE
+-- itree_rebase() splices the bytes below the old prefix after the new prefix
+SELECT itree_rebase('1.2.3.4', '1.2', '7') AS rebased, itree_rebase('1.2', '1.2', '300.5') AS rebased_root;
+-- Expected: 7.3.4 | 300.5
+SELECT itree_rebase('1.2.3.4.5.6.7.8.9.10.11.12', '1.2', '300.300.300') AS rebased_full;
+-- Expected: 300.300.300.3.4.5.6.7.8.9.10.11.12, all 16 data bytes
+SELECT itree_rebase('1.2.3.4.5.6.7.8.9.10.11.12', '1.2', '300.300.300.4') AS rebased_too_long;
+-- Expected: ERROR
+SELECT itree_rebase('1.2.3', '1.5', '7') AS rebased_outside;
+-- Expected: ERROR
+-- itree_move_subtree() moves the subtree of 1.2 under 9.1 in batches of 100 rows, one transaction each
+CREATE TEMP TABLE itree_move (id itree PRIMARY KEY, label text);
+INSERT INTO itree_move SELECT '1.2'::itree || i || j, i || '/' || j FROM generate_series(1, 30) i, generate_series(1, 10) j;
+INSERT INTO itree_move VALUES ('1.2', 'root'), ('1.3', 'sibling'), ('9', 'target'), ('9.2.1', 'taken');
+CALL itree_move_subtree('itree_move', 'id', '1.2', '9.1', 100);
+SELECT (SELECT count(*) FROM itree_move WHERE id <@ '1.2') AS left_behind,
+       (SELECT count(*) FROM itree_move WHERE id <@ '9.1') AS moved,
+       (SELECT count(*) FROM itree_move WHERE label LIKE '%/%'
+          AND id <> '9.1'::itree || split_part(label, '/', 1)::int || split_part(label, '/', 2)::int) AS misplaced,
+       (SELECT id FROM itree_move WHERE label = 'root') AS root;
+-- Expected: 0 | 301 | 0 | 9.1
+-- 9.1.1.1 would become 9.2.1, which is taken: nothing is moved
+CALL itree_move_subtree('itree_move', 'id', '9.1.1', '9.2', 100);
+-- Expected: ERROR
+SELECT count(*) AS not_moved FROM itree_move WHERE id <@ '9.1.1';
+-- Expected: 11
+CALL itree_move_subtree('itree_move', 'id', '9.1', '9.1.5', 100);
+-- Expected: ERROR
+-- collapsing 5.2.3 into its parent: 5.2.3.3.5 becomes 5.2.3.5, in the subtree of 5.2.3 again and taken
+-- by a row still to move, the levels are moved from the top so each key is free when it is taken
+INSERT INTO itree_move VALUES ('5.2.3', 'a'), ('5.2.3.3', 'b'), ('5.2.3.3.5', 'c'), ('5.2.3.5', 'd'), ('5.2.3.3.3', 'e');
+CALL itree_move_subtree('itree_move', 'id', '5.2.3', '5.2', 1);
+SELECT string_agg(label || '=' || id::text, ', ' ORDER BY label) AS collapsed FROM itree_move WHERE id <@ '5';
+-- Expected: a=5.2, b=5.2.3, c=5.2.3.5, d=5.2.5, e=5.2.3.3
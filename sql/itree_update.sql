@@ -0,0 +1,33 @@
+-- ALTER EXTENSION itree UPDATE rewrites the 16 byte values stored by itree 1.0
+SET client_min_messages = warning;
+DROP EXTENSION IF EXISTS itree CASCADE;
+RESET client_min_messages;
+CREATE EXTENSION itree VERSION '1.0';
+CREATE DOMAIN itree_update_d AS itree DEFAULT '7.7';
+CREATE TABLE itree_update_t (n int, id itree PRIMARY KEY, path itree[], d itree_update_d);
+CREATE INDEX itree_update_t_gin ON itree_update_t USING gin (id itree_gin_ops);
+INSERT INTO itree_update_t VALUES
+    (1, '1', ARRAY['1']::itree[], '1'),
+    (2, '1.2', ARRAY['1', '1.2']::itree[], '1.2'),
+    (3, '1.2.1000', ARRAY['1.2', '1.2.1000']::itree[], DEFAULT),
+    (4, '1.2.3.4.5.6.7.8.9.10.11.12.13', ARRAY['1.2', '1.2.3.4.5.6.7.8.9.10.11.12.13']::itree[], '1.2.3.4.5.6.7.8.9.10.11.12.13');
+-- longer values, the end marker of 14 data bytes and the tail of 15 were not stored by 1.0
+CREATE TABLE itree_update_long (n int, id itree);
+INSERT INTO itree_update_long VALUES
+    (1, '1.2.3.4.5.6.7.8.9.10.11.12.13.14'),
+    (2, '1.2.3.4.5.6.7.8.9.10.11.12.1000'),
+    (3, '1.2.3.4.5.6.7.8.9.10.11.12.13.14.15'),
+    (4, '1.2.3.4.5.6.7.8.9.10.11.12.13.1000');
+
+ALTER EXTENSION itree UPDATE;
+SELECT extversion FROM pg_extension WHERE extname = 'itree';
+SELECT typname, typlen FROM pg_type WHERE typname IN ('itree', 'itree_update_d') ORDER BY typname;
+SELECT n, id, path, d FROM itree_update_t ORDER BY n;
+SELECT n, id FROM itree_update_long ORDER BY n;
+-- Expected: 14 data bytes unchanged, 15 cut to the segments within data[0..13]
+SELECT indexname, indexdef FROM pg_indexes WHERE tablename = 'itree_update_t' ORDER BY indexname;
+SELECT n, id FROM itree_update_t WHERE id <@ '1.2' ORDER BY n;
+INSERT INTO itree_update_t (n, id) VALUES (5, '9') RETURNING n, id, d;
+SELECT to_regproc('itree_legacy_text') IS NULL AS reader_dropped;
+DROP TABLE itree_update_t, itree_update_long;
+DROP DOMAIN itree_update_d;
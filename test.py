@@ -1,8 +1,9 @@
 import os
 import pytest
+import psycopg
 from sqlalchemy import create_engine, text
 from sqlalchemy.exc import ProgrammingError
-from itree.type import ITree
+from itree.type import ITree, register_itree
 from dotenv import load_dotenv
 load_dotenv()
 
@@ -100,3 +101,49 @@ def test_itree_binary():
 
     itree2 = ITree.from_bytes(value)
     assert itree2 == itree, "ITree from bytes should match original ITree"
+
+def test_itree_binary_copy():
+    """COPY BINARY round trip through itree_recv and itree_send."""
+    with psycopg.connect(DATABASE_URL.replace('postgresql+psycopg', 'postgresql')) as conn:
+        conn.execute("CREATE EXTENSION IF NOT EXISTS itree;")
+        register_itree(conn)
+        conn.execute("CREATE TEMP TABLE itree_copy (id itree);")
+        values = [ITree('1.2.300.4.500'), ITree('1'), ITree('256.257.258.259.260.261.262.263')]
+
+        with conn.cursor().copy("COPY itree_copy (id) FROM STDIN (FORMAT BINARY)") as copy:
+            copy.set_types(['itree'])
+            for value in values:
+                copy.write_row([value])
+
+        with conn.cursor(binary=True) as cur:
+            rows = cur.execute("SELECT id FROM itree_copy;").fetchall()
+        assert [row[0] for row in rows] == values
+
+def test_itree_binary_copy_empty():
+    """itree_recv rejects the all-zero value, the empty itree that itree_in can't produce."""
+    with psycopg.connect(DATABASE_URL.replace('postgresql+psycopg', 'postgresql')) as conn:
+        conn.execute("CREATE EXTENSION IF NOT EXISTS itree;")
+        conn.execute("CREATE TEMP TABLE itree_copy_empty (id itree);")
+        # COPY BINARY header, one row with one 18 byte field of zeros, trailer
+        stream = (b"PGCOPY\n\xff\r\n\x00" + (0).to_bytes(4, 'big') + (0).to_bytes(4, 'big')
+                  + (1).to_bytes(2, 'big') + (18).to_bytes(4, 'big') + bytes(18)
+                  + (-1).to_bytes(2, 'big', signed=True))
+
+        with pytest.raises(psycopg.errors.InvalidBinaryRepresentation):
+            with conn.cursor().copy("COPY itree_copy_empty (id) FROM STDIN (FORMAT BINARY)") as copy:
+                copy.write(stream)
+
+
+def test_itree_var_binary_copy_empty():
+    """itree_var_recv rejects a value without segments, as itree_var_in does."""
+    with psycopg.connect(DATABASE_URL.replace('postgresql+psycopg', 'postgresql')) as conn:
+        conn.execute("CREATE EXTENSION IF NOT EXISTS itree;")
+        conn.execute("CREATE TEMP TABLE itree_var_copy_empty (id itree_var);")
+        # COPY BINARY header, one row with one field of 0 bytes, trailer
+        stream = (b"PGCOPY\n\xff\r\n\x00" + (0).to_bytes(4, 'big') + (0).to_bytes(4, 'big')
+                  + (1).to_bytes(2, 'big') + (0).to_bytes(4, 'big')
+                  + (-1).to_bytes(2, 'big', signed=True))
+
+        with pytest.raises(psycopg.errors.InvalidBinaryRepresentation):
+            with conn.cursor().copy("COPY itree_var_copy_empty (id) FROM STDIN (FORMAT BINARY)") as copy:
+                copy.write(stream)
@@ -5,6 +5,9 @@ from sqlalchemy.dialects.postgresql.base import PGTypeCompiler, ischema_names
 from sqlalchemy.sql import expression
 from sqlalchemy.types import Concatenable, UserDefinedType
 from pydantic import AfterValidator, PlainSerializer, WithJsonSchema
+from psycopg.adapt import Dumper, Loader
+from psycopg.pq import Format
+from psycopg.types import TypeInfo
 
 
 class ITree:
@@ -245,6 +248,36 @@ class ITreeType(Concatenable, UserDefinedType):
         if value:
             return ITree(value)
 
+class ITreeBinaryDumper(Dumper):
+    """Send ITree values in the itree_recv binary format, the 18 byte ITree.value."""
+    format = Format.BINARY
+
+    def dump(self, obj):
+        return ITree(obj).value
+
+
+class ITreeBinaryLoader(Loader):
+    """Load itree_send binary values, e.g. from COPY ... (FORMAT BINARY) or binary cursors."""
+    format = Format.BINARY
+
+    def load(self, data):
+        return ITree.from_bytes(bytes(data))
+
+
+def register_itree(conn):
+    """Register the itree type and its binary adapters on a psycopg connection.
+
+    With SQLAlchemy register it on every new DBAPI connection:
+    event.listen(engine, "connect", lambda dbapi_conn, _: register_itree(dbapi_conn))
+    """
+    info = TypeInfo.fetch(conn, 'itree')
+    if info is None:
+        raise ValueError("itree type not found, is the itree extension installed?")
+    info.register(conn)
+    dumper = type('ITreeBinaryDumper', (ITreeBinaryDumper,), {'oid': info.oid})
+    conn.adapters.register_dumper(ITree, dumper)
+    conn.adapters.register_loader(info.oid, ITreeBinaryLoader)
+
 def visit_ITREE(self, type_, **kw):
     return 'ITREE'
 